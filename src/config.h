@@ -12,6 +12,9 @@
 #include <list>
 #include "log.h"
 #include "mutex.h"
+#include "noncopyable.h"
+#include <atomic>
+#include <type_traits>
 
 namespace tinytcp {
 
@@ -333,6 +336,37 @@ private:
     std::map<uint64_t, on_change_cb> m_cbs;
 };
 
+/**
+ * 热路径上读取配置用, 只支持可以放进std::atomic的标量类型
+ * ConfigVar::value()每次都要拿读写锁, 多个线程同时读时锁所在的cache line会来回失效
+ * 这里把值缓存在原子变量里, 读取不加锁, 配置变更时通过add_listener刷新
+ * 一般定义成和ConfigVar同一个编译单元里的全局变量, 在ConfigVar之后初始化
+ */
+template<class T>
+class ConfigCache : Noncopyable {
+public:
+    static_assert(std::is_trivially_copyable<T>::value, "ConfigCache only supports trivially copyable types");
+
+    explicit ConfigCache(typename ConfigVar<T>::ptr var)
+        : m_var(var)
+        , m_val(var->value()) {
+        m_listener_id = m_var->add_listener([this](const T& /*old_value*/, const T& new_value) {
+            m_val.store(new_value, std::memory_order_relaxed);
+        });
+    }
+
+    ~ConfigCache() {
+        m_var->del_listener(m_listener_id);
+    }
+
+    T value() const noexcept { return m_val.load(std::memory_order_relaxed); }
+
+private:
+    typename ConfigVar<T>::ptr m_var;
+    std::atomic<T> m_val;
+    uint64_t m_listener_id = 0;
+};
+
 class Config {
 public:
     using ConfigVarMap = std::map<std::string, ConfigVarBase::ptr>;
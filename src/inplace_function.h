@@ -0,0 +1,134 @@
+#pragma once
+
+#include <cstddef>
+#include <functional>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+namespace tinytcp {
+
+/**
+* 固定容量的可调用对象, 只能移动, 不能拷贝
+* 可调用对象直接构造在内部的缓冲区中, 从构造, 移动到调用都不会申请堆内存
+* 放不下的可调用对象在编译期报错, 不会退回到堆上
+*/
+template <typename Signature, size_t Capacity = 64>
+class InplaceFunction;
+
+template <typename R, typename... Args, size_t Capacity>
+class InplaceFunction<R(Args...), Capacity> {
+public:
+    static constexpr size_t capacity = Capacity;
+    static constexpr size_t alignment = alignof(std::max_align_t);
+
+    InplaceFunction() noexcept = default;
+    InplaceFunction(std::nullptr_t) noexcept {}
+
+    template <typename F,
+              typename D = typename std::decay<F>::type,
+              typename = typename std::enable_if<!std::is_same<D, InplaceFunction>::value>::type>
+    InplaceFunction(F&& f) {
+        static_assert(sizeof(D) <= Capacity, "InplaceFunction capacity is too small for this callable");
+        static_assert(alignof(D) <= alignment, "InplaceFunction alignment is too small for this callable");
+        static_assert(std::is_move_constructible<D>::value, "InplaceFunction needs a move constructible callable");
+        // 空的函数指针和std::function当成空对象, 和std::function的行为一致
+        if (is_null(f)) {
+            return;
+        }
+        new (m_storage) D(std::forward<F>(f));
+        m_ops = &ops_of<D>::value;
+    }
+
+    InplaceFunction(InplaceFunction&& other) noexcept {
+        move_from(other);
+    }
+
+    InplaceFunction& operator=(InplaceFunction&& other) noexcept {
+        if (this != &other) {
+            reset();
+            move_from(other);
+        }
+        return *this;
+    }
+
+    InplaceFunction& operator=(std::nullptr_t) noexcept {
+        reset();
+        return *this;
+    }
+
+    InplaceFunction(const InplaceFunction&) = delete;
+    InplaceFunction& operator=(const InplaceFunction&) = delete;
+
+    ~InplaceFunction() { reset(); }
+
+    explicit operator bool() const noexcept { return m_ops != nullptr; }
+
+    R operator()(Args... args) {
+        if (m_ops == nullptr) {
+            throw std::bad_function_call();
+        }
+        return m_ops->invoke(m_storage, std::forward<Args>(args)...);
+    }
+
+    void reset() noexcept {
+        if (m_ops != nullptr) {
+            m_ops->destroy(m_storage);
+            m_ops = nullptr;
+        }
+    }
+
+    void swap(InplaceFunction& other) noexcept {
+        InplaceFunction tmp(std::move(other));
+        other = std::move(*this);
+        *this = std::move(tmp);
+    }
+
+private:
+    // 每种可调用对象一份的操作表
+    struct ops_t {
+        R (*invoke)(void* storage, Args&&... args);
+        void (*move)(void* dest, void* src) noexcept;  // 移动到dest, 并析构src
+        void (*destroy)(void* storage) noexcept;
+    };
+
+    template <typename D>
+    struct ops_of {
+        static R invoke(void* storage, Args&&... args) {
+            return (*static_cast<D*>(storage))(std::forward<Args>(args)...);
+        }
+        static void move(void* dest, void* src) noexcept {
+            new (dest) D(std::move(*static_cast<D*>(src)));
+            static_cast<D*>(src)->~D();
+        }
+        static void destroy(void* storage) noexcept {
+            static_cast<D*>(storage)->~D();
+        }
+        static constexpr ops_t value = {&invoke, &move, &destroy};
+    };
+
+    template <typename F>
+    static bool is_null(const F&) noexcept { return false; }
+    template <typename Ret, typename... A>
+    static bool is_null(Ret (* const& f)(A...)) noexcept { return f == nullptr; }
+    template <typename Sig>
+    static bool is_null(const std::function<Sig>& f) noexcept { return !f; }
+
+    void move_from(InplaceFunction& other) noexcept {
+        if (other.m_ops != nullptr) {
+            other.m_ops->move(m_storage, other.m_storage);
+            m_ops = other.m_ops;
+            other.m_ops = nullptr;
+        }
+    }
+
+private:
+    alignas(alignment) unsigned char m_storage[Capacity];
+    const ops_t* m_ops = nullptr;
+};
+
+template <typename R, typename... Args, size_t Capacity>
+template <typename D>
+constexpr typename InplaceFunction<R(Args...), Capacity>::ops_t InplaceFunction<R(Args...), Capacity>::ops_of<D>::value;
+
+} // namespace tinytcp
@@ -1,40 +1,61 @@
 #pragma once
 
 
+#include <algorithm>
 #include <atomic>
+#include <chrono>
 #include <memory>
 #include <stdexcept>
 #include <thread>
 
-#include <memory>
-#include <thread>
-
+#include "mutex.h"
 #include "noncopyable.h"
 
 namespace tinytcp {
 
+// 有界MPMC队列, 每个槽位带一个序号(Dmitry Vyukov的做法):
+// 生产者/消费者各自CAS抢一个位置, 然后只读写自己的槽位, 不需要等前面的生产者确认,
+// 某个生产者被抢占只会让它自己的槽位晚一点可读, 不会阻塞其他生产者
+// 槽位i的序号: 等于pos表示空闲, 可以写入第pos个元素; 等于pos + 1表示第pos个元素已写入, 可以读取
 template <typename T>
 class LockFreeRingQueue : Noncopyable {
 public:
     using  ptr = std::shared_ptr<LockFreeRingQueue<T>>;
     using uptr = std::unique_ptr<LockFreeRingQueue<T>>;
 
+    // size向上取整到2的幂, 最小为2, 所有槽位都可以放元素
     explicit LockFreeRingQueue(uint32_t size);
 
     ~LockFreeRingQueue() = default;
 
-    bool push(const T& data, uint32_t timeout_ms = -1);
+    /**
+    * ms < 0  : 无限等待
+    * ms = 0  : try push/pop
+    * ms > 0  : 最多等待ms毫秒
+    * 队列满/空时在futex上挂起, 对端只有在有线程挂起时才会发起唤醒的系统调用
+    */
+    bool push(const T& data, int timeout_ms = 0);
+
+    bool pop(T* data, int timeout_ms = 0);
+
+    // 批量入队/出队, 一次CAS预留一段连续的位置, 返回实际处理的数量
+    // push_bulk空间不够时只放入能放下的部分, pop_bulk最多取出n个
+    uint32_t push_bulk(const T* data, uint32_t n);
 
-    bool pop(T* data, uint32_t timeout_ms = -1);
+    uint32_t pop_bulk(T* data, uint32_t n);
 
     bool is_empty() const noexcept;
 
     bool is_full() const noexcept;
 
+    // 并发修改时只是一个近似值
     uint32_t size() const noexcept;
 
     uint32_t capacity() const noexcept { return m_size; }
 
+    // 是否有消费者挂起在pop上
+    bool has_pop_waiter() const noexcept { return m_not_empty.has_waiter(); }
+
 private:
     static bool is_power_of_two(uint32_t num) noexcept;
 
@@ -44,101 +65,262 @@ private:
 
     uint32_t index_of_queue(uint32_t index) const noexcept;
 
+    bool try_push(const T& data);
+
+    bool try_pop(T* data);
+
+    // try_op失败时挂起在event上, 直到try_op成功或者超时
+    template <typename F>
+    static bool wait_for(FutexEvent& event, int timeout_ms, F&& try_op);
+
 private:
-    const uint32_t m_size;                     // Size of the queue, must be a power of two
-    std::atomic<uint32_t> m_length;            // Current length of the queue
-    std::atomic<uint32_t> m_read_index;        // Index for the consumer to read
-    std::atomic<uint32_t> m_write_index;       // Index for the producer to write
-    std::atomic<uint32_t> m_last_write_index;  // Last confirmed write index
-    std::unique_ptr<T[]>  m_queue;             // Array to store the queue elements
+    struct Slot {
+        std::atomic<uint32_t> seq;
+        T data;
+    };
+
+    // 生产者和消费者的位置各占一条cache line, 避免互相失效
+    alignas(64) std::atomic<uint32_t> m_write_index;  // 下一个写入的位置
+    alignas(64) std::atomic<uint32_t> m_read_index;   // 下一个读取的位置
+    alignas(64) const uint32_t m_size;                // Size of the queue, must be a power of two
+    std::unique_ptr<Slot[]> m_queue;                  // 槽位数组, 构造之后只读
+    alignas(64) FutexEvent m_not_empty;               // 等待队列非空的消费者, 单独一条cache line
+    alignas(64) FutexEvent m_not_full;                // 等待队列不满的生产者
 };
 
 template <typename T>
 LockFreeRingQueue<T>::LockFreeRingQueue(uint32_t size)
-    : m_size(size <= 1U             ? 2U
+    : m_write_index(0U),
+      m_read_index(0U),
+      m_size(size <= 1U             ? 2U
             : is_power_of_two(size) ? size
                                     : round_uppower_of_two(size)),
-      m_length(0U),
-      m_read_index(0U),
-      m_write_index(0U),
-      m_last_write_index(0U),
-      m_queue(std::make_unique<T[]>(m_size)) {
+      m_queue(std::make_unique<Slot[]>(m_size)) {
     if (size == 0U) {
         throw std::out_of_range("Queue size must be greater than 0");
     }
+    for (uint32_t i = 0; i < m_size; ++i) {
+        m_queue[i].seq.store(i, std::memory_order_relaxed);
+    }
 }
 
 template <typename T>
-bool LockFreeRingQueue<T>::push(const T& data, uint32_t timeout_ms) {
-    uint32_t current_read_index;
-    uint32_t current_write_index;
+bool LockFreeRingQueue<T>::push(const T& data, int timeout_ms) {
+    if (try_push(data)) {
+        return true;
+    }
+    if (timeout_ms == 0) {
+        return false;
+    }
+    return wait_for(m_not_full, timeout_ms, [this, &data]() { return try_push(data); });
+}
 
-    do {
-        current_read_index  = m_read_index.load(std::memory_order_relaxed);
-        current_write_index = m_write_index.load(std::memory_order_relaxed);
+template <typename T>
+bool LockFreeRingQueue<T>::pop(T* data, int timeout_ms) {
+    if (data == nullptr) {
+        throw std::invalid_argument("Null pointer passed to Dequeue");
+    }
+    if (try_pop(data)) {
+        return true;
+    }
+    if (timeout_ms == 0) {
+        return false;
+    }
+    return wait_for(m_not_empty, timeout_ms, [this, data]() { return try_pop(data); });
+}
 
-        // Check if the queue is full
-        if (index_of_queue(current_write_index + 1U) == index_of_queue(current_read_index)) {
-            return false;  // Queue is full
+template <typename T>
+template <typename F>
+bool LockFreeRingQueue<T>::wait_for(FutexEvent& event, int timeout_ms, F&& try_op) {
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout_ms);
+    while (true) {
+        uint32_t seq = event.prepare_wait();
+        // 登记之后再检查一次, 避免检查和挂起之间对端的唤醒丢失
+        if (try_op()) {
+            event.finish_wait();
+            return true;
         }
-    } while (!m_write_index.compare_exchange_weak(current_write_index, current_write_index + 1U, std::memory_order_release,
-                                                std::memory_order_relaxed));
-
-    m_queue[index_of_queue(current_write_index)] = data;
+        int wait_ms = -1;
+        if (timeout_ms > 0) {
+            auto remain = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now());
+            if (remain.count() <= 0) {
+                event.finish_wait();
+                return false;
+            }
+            wait_ms = (int)remain.count();
+        }
+        event.wait(seq, wait_ms);
+        event.finish_wait();
+    }
+}
 
-    // Confirm the write operation
-    while (!m_last_write_index.compare_exchange_weak(current_write_index, current_write_index + 1U,
-                                                   std::memory_order_release, std::memory_order_relaxed)) {
-        std::this_thread::yield();  // Yield CPU to avoid busy-waiting
+template <typename T>
+bool LockFreeRingQueue<T>::try_push(const T& data) {
+    uint32_t pos = m_write_index.load(std::memory_order_relaxed);
+    Slot* slot;
+    while (true) {
+        slot = &m_queue[index_of_queue(pos)];
+        uint32_t seq = slot->seq.load(std::memory_order_acquire);
+        int32_t diff = (int32_t)(seq - pos);
+        if (diff == 0) {
+            if (m_write_index.compare_exchange_weak(pos, pos + 1U, std::memory_order_relaxed, std::memory_order_relaxed)) {
+                break;
+            }
+        }
+        else if (diff < 0) {
+            return false;  // Queue is full, 槽位上一轮的元素还没被读走
+        }
+        else {
+            pos = m_write_index.load(std::memory_order_relaxed);
+        }
     }
 
-    m_length.fetch_add(1U, std::memory_order_relaxed);
+    slot->data = data;
+    // seq_cst和等待方登记之后的检查配对, 保证不会丢失唤醒
+    slot->seq.store(pos + 1U, std::memory_order_seq_cst);
+    m_not_empty.notify_all();
 
     return true;
 }
 
 template <typename T>
-bool LockFreeRingQueue<T>::pop(T* data, uint32_t timeout_ms) {
-    if (data == nullptr) {
-        throw std::invalid_argument("Null pointer passed to Dequeue");
+bool LockFreeRingQueue<T>::try_pop(T* data) {
+    uint32_t pos = m_read_index.load(std::memory_order_relaxed);
+    Slot* slot;
+    while (true) {
+        slot = &m_queue[index_of_queue(pos)];
+        uint32_t seq = slot->seq.load(std::memory_order_acquire);
+        int32_t diff = (int32_t)(seq - (pos + 1U));
+        if (diff == 0) {
+            if (m_read_index.compare_exchange_weak(pos, pos + 1U, std::memory_order_relaxed, std::memory_order_relaxed)) {
+                break;
+            }
+        }
+        else if (diff < 0) {
+            return false;  // Queue is empty
+        }
+        else {
+            pos = m_read_index.load(std::memory_order_relaxed);
+        }
     }
 
-    uint32_t current_read_index;
-    uint32_t current_last_write_index;
+    *data = slot->data;
+    // 槽位留给下一轮的第pos + m_size个元素
+    slot->seq.store(pos + m_size, std::memory_order_seq_cst);
+    m_not_full.notify_all();
 
-    do {
-        current_read_index = m_read_index.load(std::memory_order_relaxed);
-        current_last_write_index = m_last_write_index.load(std::memory_order_relaxed);
+    return true;
+}
 
-        // Check if the queue is empty
-        if (index_of_queue(current_last_write_index) == index_of_queue(current_read_index)) {
-            return false;  // Queue is empty
+template <typename T>
+uint32_t LockFreeRingQueue<T>::push_bulk(const T* data, uint32_t n) {
+    if (n == 0U) {
+        return 0U;
+    }
+
+    uint32_t pos = m_write_index.load(std::memory_order_relaxed);
+    uint32_t cnt;
+    while (true) {
+        // 从pos开始数连续的空闲槽位, 一次CAS全部预留
+        cnt = 0U;
+        int32_t diff = 0;
+        while (cnt < n && cnt < m_size) {
+            uint32_t seq = m_queue[index_of_queue(pos + cnt)].seq.load(std::memory_order_acquire);
+            diff = (int32_t)(seq - (pos + cnt));
+            if (diff != 0) {
+                break;
+            }
+            ++cnt;
+        }
+        if (cnt == 0U && diff < 0) {
+            return 0U;  // Queue is full
+        }
+        if (cnt != 0U &&
+            m_write_index.compare_exchange_weak(pos, pos + cnt, std::memory_order_relaxed, std::memory_order_relaxed)) {
+            break;
         }
+        if (cnt == 0U) {
+            pos = m_write_index.load(std::memory_order_relaxed);
+        }
+    }
 
-        *data = m_queue[index_of_queue(current_read_index)];
+    for (uint32_t i = 0; i < cnt; ++i) {
+        Slot& slot = m_queue[index_of_queue(pos + i)];
+        slot.data = data[i];
+        slot.seq.store(pos + i + 1U, std::memory_order_release);
+    }
+    // 和等待方登记之后的检查配对, 一批只需要一次
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    m_not_empty.notify_all();
 
-        if (m_read_index.compare_exchange_weak(current_read_index, current_read_index + 1U, std::memory_order_release,
-                                               std::memory_order_relaxed)) {
-            m_length.fetch_sub(1U, std::memory_order_relaxed);
-            return true;
+    return cnt;
+}
+
+template <typename T>
+uint32_t LockFreeRingQueue<T>::pop_bulk(T* data, uint32_t n) {
+    if (data == nullptr) {
+        throw std::invalid_argument("Null pointer passed to Dequeue");
+    }
+    if (n == 0U) {
+        return 0U;
+    }
+
+    uint32_t pos = m_read_index.load(std::memory_order_relaxed);
+    uint32_t cnt;
+    while (true) {
+        // 从pos开始数连续的已写入槽位, 一次CAS全部取走
+        cnt = 0U;
+        int32_t diff = 0;
+        while (cnt < n && cnt < m_size) {
+            uint32_t seq = m_queue[index_of_queue(pos + cnt)].seq.load(std::memory_order_acquire);
+            diff = (int32_t)(seq - (pos + cnt + 1U));
+            if (diff != 0) {
+                break;
+            }
+            ++cnt;
         }
-    } while (true);
+        if (cnt == 0U && diff < 0) {
+            return 0U;  // Queue is empty
+        }
+        if (cnt != 0U &&
+            m_read_index.compare_exchange_weak(pos, pos + cnt, std::memory_order_relaxed, std::memory_order_relaxed)) {
+            break;
+        }
+        if (cnt == 0U) {
+            pos = m_read_index.load(std::memory_order_relaxed);
+        }
+    }
+
+    for (uint32_t i = 0; i < cnt; ++i) {
+        Slot& slot = m_queue[index_of_queue(pos + i)];
+        data[i] = slot.data;
+        slot.seq.store(pos + i + m_size, std::memory_order_release);
+    }
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    m_not_full.notify_all();
+
+    return cnt;
 }
 
 template <typename T>
 bool LockFreeRingQueue<T>::is_empty() const noexcept {
-    return m_length.load(std::memory_order_relaxed) == 0U;
+    return size() == 0U;
 }
 
 template <typename T>
 bool LockFreeRingQueue<T>::is_full() const noexcept {
-    uint32_t next_write_index = index_of_queue(m_write_index.load(std::memory_order_relaxed) + 1U);
-    return next_write_index == m_read_index.load(std::memory_order_acquire);
+    return size() >= m_size;
 }
 
 template <typename T>
 uint32_t LockFreeRingQueue<T>::size() const noexcept {
-    return m_length.load(std::memory_order_relaxed);
+    uint32_t read_index = m_read_index.load(std::memory_order_acquire);
+    uint32_t write_index = m_write_index.load(std::memory_order_acquire);
+    int32_t len = (int32_t)(write_index - read_index);
+    if (len <= 0) {
+        return 0U;
+    }
+    return std::min((uint32_t)len, m_size);
 }
 
 template <typename T>
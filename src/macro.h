@@ -12,6 +12,15 @@
 #define TINYTCP_UNLICKLY(x) (x)
 #endif
 
+// 自旋等待时让出流水线, 超线程的另一个线程可以用上执行单元
+#if defined(__x86_64__) || defined(__i386__)
+#define TINYTCP_CPU_RELAX() __builtin_ia32_pause()
+#elif defined(__aarch64__)
+#define TINYTCP_CPU_RELAX() __asm__ __volatile__("yield" ::: "memory")
+#else
+#define TINYTCP_CPU_RELAX() do {} while (0)
+#endif
+
 
 #define TINYTCP_ASSERT(x) \
     if (TINYTCP_UNLICKLY(!(x))) { \
@@ -1,5 +1,11 @@
 #include "mutex.h"
 #include <stdexcept>
+#include <errno.h>
+#include <climits>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
 
 
 namespace tinytcp {
@@ -82,6 +88,26 @@ void RWMutex::unlock() {
 
 
 
+
+// futex事件
+bool FutexEvent::wait(uint32_t seq, int timeout_ms) {
+    timespec ts;
+    timespec* pts = nullptr;
+    if (timeout_ms >= 0) {
+        ts.tv_sec  = timeout_ms / 1000;
+        ts.tv_nsec = (long)(timeout_ms % 1000) * 1000000L;
+        pts = &ts;
+    }
+    // 值已经变了会直接返回EAGAIN, 被信号打断返回EINTR, 都交给调用方重新检查条件
+    long rt = syscall(SYS_futex, (uint32_t*)&m_seq, FUTEX_WAIT_PRIVATE, seq, pts, nullptr, 0);
+    return !(rt == -1 && errno == ETIMEDOUT);
+}
+
+void FutexEvent::wake() noexcept {
+    syscall(SYS_futex, (uint32_t*)&m_seq, FUTEX_WAKE_PRIVATE, INT_MAX, nullptr, nullptr, 0);
+}
+
+
 } // namespace tinytcp
 
 
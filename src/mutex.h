@@ -1,4 +1,5 @@
 #pragma once
+#include <atomic>
 #include <cstdint>
 #include <semaphore.h>
 #include <pthread.h>
@@ -166,6 +167,49 @@ private:
     pthread_rwlock_t m_lock;
 
 };
+
+// 基于futex的事件, 用于无锁队列空/满时挂起等待
+// 只有登记了等待者, notify才会进入内核, 没人等待时只多一次原子读
+// 用法: seq = prepare_wait(); 再检查一次条件; 不满足就wait(seq), 最后finish_wait()
+class FutexEvent : Noncopyable {
+public:
+    FutexEvent() = default;
+
+    uint32_t prepare_wait() noexcept {
+        m_waiters.fetch_add(1, std::memory_order_seq_cst);
+        uint32_t seq = m_seq.load(std::memory_order_seq_cst);
+        // 和notify方修改条件的seq_cst操作配对, 保证不会丢失唤醒
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        return seq;
+    }
+
+    void finish_wait() noexcept {
+        m_waiters.fetch_sub(1, std::memory_order_relaxed);
+    }
+
+    // timeout_ms < 0 无限等待, 返回false表示超时
+    bool wait(uint32_t seq, int timeout_ms);
+
+    bool has_waiter() const noexcept {
+        return m_waiters.load(std::memory_order_seq_cst) != 0;
+    }
+
+    // 条件改变之后调用, 没有等待者时不做系统调用
+    void notify_all() noexcept {
+        if (has_waiter()) {
+            m_seq.fetch_add(1, std::memory_order_seq_cst);
+            wake();
+        }
+    }
+
+private:
+    void wake() noexcept;
+
+private:
+    std::atomic<uint32_t> m_seq{0};      // futex字, 每次唤醒加一
+    std::atomic<uint32_t> m_waiters{0};  // 正在等待的线程数
+};
+
 } // namespace tinytcp
 
 
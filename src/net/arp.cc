@@ -34,7 +34,8 @@ PktBuffer* ARPProcessor::make_request(INetIF* netif, const ipaddr_t& dest) {
         return nullptr;
     }
 
-    bool ok = buf->alloc(sizeof(arp_pkt_t));
+    // 预留以太网包头和最小帧填充的空间, ether_raw_out时原地扩充
+    bool ok = buf->alloc_tx(sizeof(arp_pkt_t), ETHER_DATA_MIN - sizeof(arp_pkt_t));
     if (!ok) {
         TINYTCP_LOG_WARN(g_logger) << "alloc block error";
         buf->free();
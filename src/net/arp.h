@@ -1,5 +1,6 @@
 #pragma once
 
+#include <list>
 #include "ipaddr.h"
 #include "link_layer.h"
 #include "pktbuf.h"
@@ -3,6 +3,7 @@
 #include <functional>
 #include <variant>
 #include "netif.h"
+#include "src/timer.h"
 
 
 namespace tinytcp {
@@ -10,22 +11,20 @@ namespace tinytcp {
 // 网卡相关的具体信息
 struct msg_netif_t {
     INetIF* netif;
+    uint32_t queue;  // 有包的输入队列, 也是处理它的工作线程
 
-    msg_netif_t() : netif(nullptr) {}
-    msg_netif_t(INetIF* _netif) : netif(_netif) {}
+    msg_netif_t() : netif(nullptr), queue(0) {}
+    msg_netif_t(INetIF* _netif, uint32_t _queue = 0) : netif(_netif), queue(_queue) {}
     ~msg_netif_t()  = default;
 };
 
-// 定时器消息
+// 定时器消息, 回调直接放在消息中, 发送和执行都不申请内存
 struct msg_timer_t {
-    std::function<void()> func;
+    Timer::Callback func;
 
-    msg_timer_t() : func(nullptr) {}
-    msg_timer_t(std::function<void()>& cb) : func(std::move(cb)) {}
-    ~msg_timer_t() {
-        std::function<void()> empty;
-        func.swap(empty);
-    }
+    msg_timer_t() = default;
+    msg_timer_t(Timer::Callback&& cb) : func(std::move(cb)) {}
+    ~msg_timer_t() = default;
 };
 
 struct exmsg_t {
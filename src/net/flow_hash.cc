@@ -0,0 +1,63 @@
+#include "flow_hash.h"
+#include <algorithm>
+
+namespace tinytcp {
+
+// IPv4包头中用到的字段的偏移
+#define IPV4_HDR_MIN_SIZE       20
+#define IPV4_OFFSET_VER_IHL     0
+#define IPV4_OFFSET_FRAG        6
+#define IPV4_OFFSET_PROTOCOL    9
+#define IPV4_OFFSET_SRC         12
+#define IPV4_OFFSET_DST         16
+
+// murmur3的finalizer, 低位的差异扩散到所有位
+static inline uint32_t hash_mix(uint32_t h) {
+    h ^= h >> 16;
+    h *= 0x85ebca6bU;
+    h ^= h >> 13;
+    h *= 0xc2b2ae35U;
+    h ^= h >> 16;
+    return h;
+}
+
+uint32_t ipv4_flow_hash(const PktView& view) {
+    uint8_t ver_ihl = 0;
+    if (!view.peek(IPV4_OFFSET_VER_IHL, ver_ihl) || (ver_ihl >> 4) != 4) {
+        return 0;
+    }
+    uint32_t hdr_size = (ver_ihl & 0x0F) * 4U;
+    uint8_t protocol = 0;
+    uint16_t frag = 0;
+    uint32_t src = 0;
+    uint32_t dst = 0;
+    if (hdr_size < IPV4_HDR_MIN_SIZE ||
+        !view.peek(IPV4_OFFSET_PROTOCOL, protocol) ||
+        !view.read_be16(IPV4_OFFSET_FRAG, frag) ||
+        !view.read_be32(IPV4_OFFSET_SRC, src) ||
+        !view.read_be32(IPV4_OFFSET_DST, dst)) {
+        return 0;
+    }
+
+    // 分片中只有第一片带端口, 分片一律只按地址算, 同一个包的各个分片才会落到同一个工作线程
+    uint32_t ports = 0;
+    bool is_frag = (frag & 0x3FFF) != 0;
+    if (!is_frag && (protocol == IPV4_PROTOCOL_TCP || protocol == IPV4_PROTOCOL_UDP)) {
+        uint16_t src_port = 0;
+        uint16_t dst_port = 0;
+        if (view.read_be16(hdr_size, src_port) && view.read_be16(hdr_size + 2, dst_port)) {
+            ports = ((uint32_t)std::min(src_port, dst_port) << 16) | std::max(src_port, dst_port);
+            ports ^= (uint32_t)protocol << 8;
+        }
+    }
+
+    // 两个方向取同样的顺序, 保证对称
+    uint32_t lo = std::min(src, dst);
+    uint32_t hi = std::max(src, dst);
+    uint32_t h = hash_mix(lo ^ 0x9e3779b9U);
+    h = hash_mix(h ^ hi);
+    h = hash_mix(h ^ ports);
+    return h;
+}
+
+} // namespace tinytcp
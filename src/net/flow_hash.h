@@ -0,0 +1,24 @@
+#pragma once
+
+/**
+* 软件RSS: 按IPv4的 源/目的地址 + 协议 + TCP/UDP端口 算流的哈希, 用来把包分到固定的工作线程
+* 哈希是对称的, 交换源和目的之后结果不变, 一个连接两个方向的包落到同一个工作线程
+*/
+
+#include <inttypes.h>
+#include "pktview.h"
+
+namespace tinytcp {
+
+#define IPV4_PROTOCOL_TCP 6
+#define IPV4_PROTOCOL_UDP 17
+
+// view从IPv4包头开始, 不是完整的IPv4包头时返回0
+uint32_t ipv4_flow_hash(const PktView& view);
+
+// 哈希值映射到[0, cnt)
+inline uint32_t flow_hash_to_queue(uint32_t hash, uint32_t cnt) {
+    return (uint32_t)(((uint64_t)hash * cnt) >> 32);
+}
+
+} // namespace tinytcp
@@ -1,42 +1,534 @@
 #include "memblock.h"
+#include "src/config.h"
+#include "src/log.h"
+#include "src/macro.h"
+#include "src/mutex.h"
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
 
 
 namespace tinytcp {
 
+static tinytcp::ConfigVar<uint32_t>::ptr g_memblock_magazine_size =
+    tinytcp::Config::look_up("tcp.memblock_magazine_size", 32U, "memblock magazine size, 每个线程缓存的空闲内存块数量, 0表示不缓存");
 
-MemBlock::MemBlock(int block_size, int capacity)
-    : m_block_size(block_size) {
+static tinytcp::ConfigVar<bool>::ptr g_memblock_hugepage =
+    tinytcp::Config::look_up("tcp.memblock_hugepage", false, "memblock hugepage, 内存池使用大页(MAP_HUGETLB, 失败时用透明大页), 减少TLB miss");
+static tinytcp::ConfigVar<bool>::ptr g_memblock_prefault =
+    tinytcp::Config::look_up("tcp.memblock_prefault", true, "memblock prefault, 创建内存池时预先触发缺页, 第一波流量不再缺页");
+static tinytcp::ConfigVar<bool>::ptr g_memblock_mlock =
+    tinytcp::Config::look_up("tcp.memblock_mlock", false, "memblock mlock, 把内存池锁在内存中不被换出, 受RLIMIT_MEMLOCK限制");
 
-    m_queue.reset(new LockFreeRingQueue<uint8_t*>(capacity));
-    capacity = m_queue->capacity();
+static tinytcp::ConfigVar<uint64_t>::ptr g_memblock_grow_budget =
+    tinytcp::Config::look_up("tcp.memblock_grow_budget", (uint64_t)256 * 1024 * 1024,
+                             "memblock grow budget, 所有弹性内存池扩充出来的内存总量上限(字节)");
 
-    m_block.reset(new uint8_t[block_size * capacity]);
-    uint8_t *block_ptr = m_block.get();
+static tinytcp::Logger::ptr g_logger = TINYTCP_LOG_NAME("system");
+
+// 大页的大小, x86_64默认的2MB大页
+#define MEMBLOCK_HUGEPAGE_SIZE (2UL * 1024 * 1024)
+
+// 每个线程的magazine最多占内存池的多少分之一, 避免小的内存池全部被几个线程缓存起来
+#define MEMBLOCK_MAGAZINE_RATIO 16
+
+struct MemBlock::Magazine {
+    MemBlock* owner;                    // 所属的内存池, 内存池销毁之后为nullptr
+    std::unique_ptr<uint8_t*[]> objs;   // 空闲对象栈
+    std::atomic<uint32_t> count{0};     // 栈中的对象数, 只有所属线程会修改
+    std::atomic<bool> in_use{true};     // 有线程在使用, 线程退出之后可以给别的线程复用
+    Magazine* next = nullptr;           // 内存池的magazine链表, 加入之后不再修改
+    std::atomic<uint64_t> alloc_hit{0};
+    std::atomic<uint64_t> alloc_miss{0};
+    std::atomic<uint64_t> free_hit{0};
+    std::atomic<uint64_t> free_miss{0};
+};
+
+// 线程局部的magazine表, 按内存池编号索引, 线程退出时把缓存的对象还给内存池
+struct MemBlock::MagazineCache {
+    std::vector<Magazine*> mags;
+
+    ~MagazineCache();
+};
+
+// 保护magazine的创建, 销毁和统计, 热路径不使用
+static Mutex& magazine_mutex() {
+    static Mutex s_mutex;
+    return s_mutex;
+}
+
+static std::atomic<uint32_t> s_memblock_id{0};
+static std::atomic<size_t> s_grow_bytes{0};
+static thread_local MemBlock::MagazineCache t_magazine_cache;
+
+MemBlock::MagazineCache::~MagazineCache() {
+    Mutex::Lock lock(magazine_mutex());
+    for (Magazine* mag : mags) {
+        if (mag == nullptr) {
+            continue;
+        }
+        MemBlock* owner = mag->owner;
+        if (owner == nullptr) {
+            // 内存池已经销毁, 只剩下这个线程还引用着
+            delete mag;
+            continue;
+        }
+        // 缓存的对象还给全局队列, magazine留在内存池的链表上给之后的线程复用
+        uint32_t count = mag->count.load(std::memory_order_relaxed);
+        uint32_t pushed = owner->m_queue->push_bulk(mag->objs.get(), count);
+        while (pushed < count) {
+            owner->m_queue->push(mag->objs[pushed++]);
+        }
+        mag->count.store(0, std::memory_order_relaxed);
+        mag->in_use.store(false, std::memory_order_release);
+    }
+    mags.clear();
+}
+
+MemBlock::MemBlock(int block_size, int capacity, int align)
+    : MemBlock(block_size, capacity, align, memblock_elastic_t()) {
+}
+
+MemBlock::MemBlock(int block_size, int capacity, int align, const memblock_elastic_t& elastic, init_func init)
+    : m_block_size((block_size + align - 1) / align * align)
+    , m_align(align)
+    , m_capacity(0)
+    , m_elastic(elastic)
+    , m_init(init)
+    , m_id(s_memblock_id.fetch_add(1, std::memory_order_relaxed)) {
 
-    for (int i = 0; i < capacity; ++i, block_ptr += block_size) {
+    // 全局队列按最大容量创建, 扩充时不需要更换队列
+    m_queue.reset(new LockFreeRingQueue<uint8_t*>(std::max(capacity, elastic.max_capacity)));
+    int queue_cnt = (int)m_queue->capacity();
+    m_init_capacity = elastic.max_capacity > capacity ? std::min(capacity, queue_cnt) : queue_cnt;
+
+    m_block = alloc_arena((size_t)m_block_size * m_init_capacity);
+    TINYTCP_ASSERT2(m_block != nullptr, "MemBlock alloc arena error, size=" + std::to_string((size_t)m_block_size * m_init_capacity));
+    uint8_t *block_ptr = m_block.get();
+    for (int i = 0; i < m_init_capacity; ++i, block_ptr += m_block_size) {
+        if (m_init) {
+            m_init(block_ptr);
+        }
         m_queue->push(block_ptr);
     }
+    m_capacity.store(m_init_capacity, std::memory_order_relaxed);
+
+    if (m_elastic.max_capacity > m_init_capacity) {
+        m_elastic.max_capacity = std::min(m_elastic.max_capacity, queue_cnt);
+        if (m_elastic.chunk_capacity <= 0) {
+            m_elastic.chunk_capacity = m_init_capacity;
+        }
+        if (m_elastic.low_watermark <= 0) {
+            m_elastic.low_watermark = m_elastic.chunk_capacity / 4;
+        }
+        if (m_elastic.high_watermark <= m_elastic.low_watermark) {
+            m_elastic.high_watermark = m_elastic.low_watermark + m_elastic.chunk_capacity * 2;
+        }
+        int max_chunk_cnt = (m_elastic.max_capacity - m_init_capacity + m_elastic.chunk_capacity - 1) / m_elastic.chunk_capacity;
+        m_chunks.reserve(max_chunk_cnt);
+        m_shrink_buf.resize(m_queue->capacity());
+    }
+    else {
+        m_elastic.max_capacity = m_init_capacity;
+    }
+
+    m_mag_size = std::min(g_memblock_magazine_size->value(), (uint32_t)m_init_capacity / MEMBLOCK_MAGAZINE_RATIO);
+    if (m_mag_size < 2) {
+        m_mag_size = 0;
+    }
+}
+
+void MemBlock::ArenaDeleter::operator()(uint8_t* ptr) const noexcept {
+    if (map_size != 0) {
+        munmap(ptr, map_size);
+    }
+    else {
+        ::free(ptr);
+    }
+}
+
+MemBlock::arena_ptr MemBlock::alloc_arena(size_t size) {
+    size_t page_size = (size_t)sysconf(_SC_PAGESIZE);
+    bool prefault = g_memblock_prefault->value();
+    uint8_t* mem = nullptr;
+    size_t map_size = 0;
+
+    if (g_memblock_hugepage->value() && (size_t)m_align <= page_size) {
+        // 先用显式大页, 系统没有预留大页时退回到普通mmap + 透明大页
+        map_size = (size + MEMBLOCK_HUGEPAGE_SIZE - 1) / MEMBLOCK_HUGEPAGE_SIZE * MEMBLOCK_HUGEPAGE_SIZE;
+        int flags = MAP_PRIVATE | MAP_ANONYMOUS | (prefault ? MAP_POPULATE : 0);
+        void* ptr = mmap(nullptr, map_size, PROT_READ | PROT_WRITE, flags | MAP_HUGETLB, -1, 0);
+        if (ptr != MAP_FAILED) {
+            m_hugepage = true;
+        }
+        else {
+            TINYTCP_LOG_INFO(g_logger) << "MemBlock mmap MAP_HUGETLB failed: " << strerror(errno) << ", use madvise(MADV_HUGEPAGE)";
+            ptr = mmap(nullptr, map_size, PROT_READ | PROT_WRITE, flags, -1, 0);
+            if (ptr == MAP_FAILED) {
+                TINYTCP_LOG_ERROR(g_logger) << "MemBlock mmap error: " << strerror(errno) << ", size=" << map_size;
+                return arena_ptr(nullptr, ArenaDeleter{0});
+            }
+            m_hugepage = madvise(ptr, map_size, MADV_HUGEPAGE) == 0;
+        }
+        mem = (uint8_t*)ptr;
+    }
+    else {
+        void* ptr = nullptr;
+        int rt = posix_memalign(&ptr, m_align, size);
+        if (rt != 0 || ptr == nullptr) {
+            TINYTCP_LOG_ERROR(g_logger) << "MemBlock posix_memalign error, rt=" << rt << ", size=" << size;
+            return arena_ptr(nullptr, ArenaDeleter{0});
+        }
+        mem = (uint8_t*)ptr;
+        map_size = 0;
+    }
+    arena_ptr arena(mem, ArenaDeleter{map_size});
+
+    // MAP_POPULATE已经缺页过了, 其他情况每页写一个字节
+    if (prefault && map_size == 0) {
+        for (size_t offset = 0; offset < size; offset += page_size) {
+            mem[offset] = 0;
+        }
+    }
+    if (g_memblock_mlock->value()) {
+        m_locked = mlock(mem, map_size != 0 ? map_size : size) == 0;
+        if (!m_locked) {
+            TINYTCP_LOG_WARN(g_logger) << "MemBlock mlock error: " << strerror(errno) << ", size=" << size;
+        }
+    }
+    return arena;
+}
+
+bool MemBlock::grow() {
+    bool expected = false;
+    if (!m_resizing.compare_exchange_strong(expected, true, std::memory_order_acquire)) {
+        return false;
+    }
+
+    bool ok = false;
+    int capacity = m_capacity.load(std::memory_order_relaxed);
+    int cnt = std::min(m_elastic.chunk_capacity, m_elastic.max_capacity - capacity);
+    size_t bytes = (size_t)cnt * m_block_size;
+    if (cnt <= 0) {
+        // 达到上限
+    }
+    else if (s_grow_bytes.fetch_add(bytes, std::memory_order_relaxed) + bytes > g_memblock_grow_budget->value()) {
+        s_grow_bytes.fetch_sub(bytes, std::memory_order_relaxed);
+        TINYTCP_LOG_WARN(g_logger) << "MemBlock grow error, over budget, grow_bytes=" << s_grow_bytes.load()
+                                   << ", need=" << bytes;
+    }
+    else {
+        arena_ptr mem = alloc_arena(bytes);
+        if (mem == nullptr) {
+            s_grow_bytes.fetch_sub(bytes, std::memory_order_relaxed);
+        }
+        else {
+            uint8_t* block_ptr = mem.get();
+            for (int i = 0; i < cnt; ++i, block_ptr += m_block_size) {
+                if (m_init) {
+                    m_init(block_ptr);
+                }
+                m_queue->push(block_ptr);
+            }
+            m_chunks.push_back(chunk_t{std::move(mem), cnt});
+            m_chunk_cnt.fetch_add(1, std::memory_order_relaxed);
+            m_capacity.fetch_add(cnt, std::memory_order_relaxed);
+            m_grow_cnt.fetch_add(1, std::memory_order_relaxed);
+            TINYTCP_LOG_INFO(g_logger) << "MemBlock grow, block_size=" << m_block_size << ", cnt=" << cnt
+                                       << ", capacity=" << capacity + cnt;
+            ok = true;
+        }
+    }
+
+    m_resizing.store(false, std::memory_order_release);
+    return ok;
+}
+
+bool MemBlock::shrink() {
+    if (m_chunk_cnt.load(std::memory_order_relaxed) == 0) {
+        return false;
+    }
+    bool expected = false;
+    if (!m_resizing.compare_exchange_strong(expected, true, std::memory_order_acquire)) {
+        return false;
+    }
+
+    // 把全局队列中的空闲块全部取出来, 最后扩充的chunk中的块都在里面时才能归还
+    bool ok = false;
+    chunk_t& chunk = m_chunks.back();
+    // 空闲块不够一个chunk加低水位时肯定归还不了, 不用取空队列
+    if ((int)m_queue->size() < chunk.cnt + m_elastic.low_watermark) {
+        m_resizing.store(false, std::memory_order_release);
+        return false;
+    }
+    uint8_t* begin = chunk.mem.get();
+    uint8_t* end = begin + (size_t)chunk.cnt * m_block_size;
+    uint32_t n = m_queue->pop_bulk(m_shrink_buf.data(), (uint32_t)m_shrink_buf.size());
+    uint32_t in_chunk = 0;
+    for (uint32_t i = 0; i < n; ++i) {
+        if (m_shrink_buf[i] >= begin && m_shrink_buf[i] < end) {
+            ++in_chunk;
+        }
+    }
+    if ((int)in_chunk == chunk.cnt && (int)(n - in_chunk) >= m_elastic.low_watermark) {
+        uint32_t remain = 0;
+        for (uint32_t i = 0; i < n; ++i) {
+            if (m_shrink_buf[i] < begin || m_shrink_buf[i] >= end) {
+                m_shrink_buf[remain++] = m_shrink_buf[i];
+            }
+        }
+        n = remain;
+        size_t bytes = (size_t)chunk.cnt * m_block_size;
+        m_capacity.fetch_sub(chunk.cnt, std::memory_order_relaxed);
+        m_chunks.pop_back();
+        m_chunk_cnt.fetch_sub(1, std::memory_order_relaxed);
+        s_grow_bytes.fetch_sub(bytes, std::memory_order_relaxed);
+        m_shrink_cnt.fetch_add(1, std::memory_order_relaxed);
+        TINYTCP_LOG_INFO(g_logger) << "MemBlock shrink, block_size=" << m_block_size
+                                   << ", capacity=" << m_capacity.load(std::memory_order_relaxed);
+        ok = true;
+    }
+    m_queue->push_bulk(m_shrink_buf.data(), n);
+
+    m_resizing.store(false, std::memory_order_release);
+    return ok;
+}
+
+bool MemBlock::pop_slow(uint8_t** ptr) {
+    while (true) {
+        if (m_queue->pop(ptr)) {
+            return true;
+        }
+        if (!is_elastic()) {
+            return false;
+        }
+        // 其他线程正在扩缩容(归还时会暂时取空队列), 等它结束
+        if (m_resizing.load(std::memory_order_acquire)) {
+            std::this_thread::yield();
+            continue;
+        }
+        if (!grow()) {
+            if (m_queue->pop(ptr)) {
+                return true;
+            }
+            m_grow_fail.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+    }
+}
+
+size_t MemBlock::get_grow_bytes() {
+    return s_grow_bytes.load(std::memory_order_relaxed);
+}
+
+void MemBlock::get_elastic_stat(memblock_elastic_stat_t& stat) const {
+    stat.init_capacity = m_init_capacity;
+    stat.max_capacity  = m_elastic.max_capacity;
+    stat.chunk_cnt     = m_chunk_cnt.load(std::memory_order_relaxed);
+    stat.grow_cnt      = m_grow_cnt.load(std::memory_order_relaxed);
+    stat.shrink_cnt    = m_shrink_cnt.load(std::memory_order_relaxed);
+    stat.grow_fail     = m_grow_fail.load(std::memory_order_relaxed);
 }
 
 MemBlock::~MemBlock() {
+    for (auto& chunk : m_chunks) {
+        s_grow_bytes.fetch_sub((size_t)chunk.cnt * m_block_size, std::memory_order_relaxed);
+    }
+    // 还有线程在用的magazine交给线程退出时删除, 线程退出时不能再访问这个内存池
+    Mutex::Lock lock(magazine_mutex());
+    Magazine* mag = m_magazines.exchange(nullptr, std::memory_order_acquire);
+    while (mag != nullptr) {
+        Magazine* next = mag->next;
+        if (mag->in_use.load(std::memory_order_relaxed)) {
+            mag->owner = nullptr;
+        }
+        else {
+            delete mag;
+        }
+        mag = next;
+    }
+}
+
+MemBlock::Magazine* MemBlock::local_magazine() {
+    auto& mags = t_magazine_cache.mags;
+    if (TINYTCP_LICKLY(m_id < mags.size() && mags[m_id] != nullptr)) {
+        return mags[m_id];
+    }
+
+    if (mags.size() <= m_id) {
+        mags.resize(m_id + 1, nullptr);
+    }
+    Mutex::Lock lock(magazine_mutex());
+    // 优先复用已经退出的线程留下的magazine
+    Magazine* mag = m_magazines.load(std::memory_order_relaxed);
+    while (mag != nullptr && mag->in_use.load(std::memory_order_relaxed)) {
+        mag = mag->next;
+    }
+    if (mag != nullptr) {
+        mag->in_use.store(true, std::memory_order_relaxed);
+    }
+    else {
+        mag = new Magazine();
+        mag->owner = this;
+        mag->objs.reset(new uint8_t*[m_mag_size]);
+        mag->next = m_magazines.load(std::memory_order_relaxed);
+        m_magazines.store(mag, std::memory_order_release);
+    }
+    mags[m_id] = mag;
+    return mag;
+}
+
+void MemBlock::refill(Magazine* mag) {
+    // 补充到一半, 留一半空间给之后的释放
+    uint32_t count = mag->count.load(std::memory_order_relaxed);
+    uint32_t target = m_mag_size / 2;
+    if (count < target) {
+        count += m_queue->pop_bulk(&mag->objs[count], target - count);
+    }
+    maybe_grow();
+    if (count == 0 && pop_slow(&mag->objs[count])) {
+        ++count;
+    }
+    mag->count.store(count, std::memory_order_relaxed);
+}
+
+void MemBlock::spill(Magazine* mag) {
+    // 还回去一半, 留一半给之后的分配
+    uint32_t count = mag->count.load(std::memory_order_relaxed);
+    uint32_t target = m_mag_size / 2;
+    if (count > target) {
+        count -= m_queue->push_bulk(&mag->objs[target], count - target);
+    }
+    mag->count.store(count, std::memory_order_relaxed);
+}
 
+int MemBlock::size() const {
+    int size = m_queue->size();
+    // 链表只增不删, 不需要加锁
+    for (Magazine* mag = m_magazines.load(std::memory_order_acquire); mag != nullptr; mag = mag->next) {
+        size += mag->count.load(std::memory_order_relaxed);
+    }
+    return size;
+}
+
+void MemBlock::get_magazine_stat(memblock_magazine_stat_t& stat) const {
+    stat = memblock_magazine_stat_t();
+    for (Magazine* mag = m_magazines.load(std::memory_order_acquire); mag != nullptr; mag = mag->next) {
+        stat.alloc_hit  += mag->alloc_hit.load(std::memory_order_relaxed);
+        stat.alloc_miss += mag->alloc_miss.load(std::memory_order_relaxed);
+        stat.free_hit   += mag->free_hit.load(std::memory_order_relaxed);
+        stat.free_miss  += mag->free_miss.load(std::memory_order_relaxed);
+        stat.cached     += mag->count.load(std::memory_order_relaxed);
+        stat.magazine_cnt += mag->in_use.load(std::memory_order_relaxed) ? 1 : 0;
+    }
 }
 
 bool MemBlock::alloc(void** ptr, int timeout_ms) {
     if (timeout_ms < 0) {
         timeout_ms = -1;
     }
-    bool ok = m_queue->pop((uint8_t**)ptr);
-    return ok;
+    if (m_mag_size == 0) {
+        bool ok = m_queue->pop((uint8_t**)ptr) || pop_slow((uint8_t**)ptr);
+        maybe_grow();
+        return ok || (timeout_ms != 0 && m_queue->pop((uint8_t**)ptr, timeout_ms));
+    }
+
+    Magazine* mag = local_magazine();
+    uint32_t count = mag->count.load(std::memory_order_relaxed);
+    if (TINYTCP_UNLICKLY(count == 0)) {
+        mag->alloc_miss.store(mag->alloc_miss.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        refill(mag);
+        count = mag->count.load(std::memory_order_relaxed);
+        if (count == 0) {
+            // 没有空闲块了, 挂起等其他线程还回全局队列
+            return timeout_ms != 0 && m_queue->pop((uint8_t**)ptr, timeout_ms);
+        }
+    }
+    else {
+        mag->alloc_hit.store(mag->alloc_hit.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    }
+    *ptr = mag->objs[--count];
+    mag->count.store(count, std::memory_order_relaxed);
+    return true;
 }
 
 bool MemBlock::free(const void* ptr) {
-    bool ok = m_queue->push((uint8_t*)ptr);
-    return ok;
+    if (m_mag_size == 0) {
+        return m_queue->push((uint8_t*)ptr);
+    }
+
+    // 有线程在等空闲块, 直接还回全局队列唤醒它, 不缓存在本线程
+    if (TINYTCP_UNLICKLY(m_queue->has_pop_waiter())) {
+        return m_queue->push((uint8_t*)ptr);
+    }
+
+    Magazine* mag = local_magazine();
+    uint32_t count = mag->count.load(std::memory_order_relaxed);
+    if (TINYTCP_UNLICKLY(count == m_mag_size)) {
+        mag->free_miss.store(mag->free_miss.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        spill(mag);
+        count = mag->count.load(std::memory_order_relaxed);
+        if (count == m_mag_size) {
+            return false;
+        }
+    }
+    else {
+        mag->free_hit.store(mag->free_hit.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    }
+    mag->objs[count] = (uint8_t*)ptr;
+    mag->count.store(count + 1, std::memory_order_relaxed);
+    return true;
 }
 
+int MemBlock::alloc_bulk(void** ptrs, int n) {
+    if (n <= 0) {
+        return 0;
+    }
+    int cnt = 0;
+    if (m_mag_size != 0) {
+        Magazine* mag = local_magazine();
+        uint32_t count = mag->count.load(std::memory_order_relaxed);
+        while (cnt < n && count > 0) {
+            ptrs[cnt++] = mag->objs[--count];
+        }
+        mag->count.store(count, std::memory_order_relaxed);
+        if (cnt == n) {
+            mag->alloc_hit.store(mag->alloc_hit.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+            return cnt;
+        }
+        mag->alloc_miss.store(mag->alloc_miss.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    }
+    cnt += m_queue->pop_bulk((uint8_t**)ptrs + cnt, n - cnt);
+    maybe_grow();
+    while (cnt < n && pop_slow((uint8_t**)ptrs + cnt)) {
+        ++cnt;
+    }
+    return cnt;
+}
+
+int MemBlock::free_bulk(void* const* ptrs, int n) {
+    if (n <= 0) {
+        return 0;
+    }
+    int cnt = 0;
+    if (m_mag_size != 0) {
+        Magazine* mag = local_magazine();
+        uint32_t count = mag->count.load(std::memory_order_relaxed);
+        while (cnt < n && count < m_mag_size) {
+            mag->objs[count++] = (uint8_t*)ptrs[cnt++];
+        }
+        mag->count.store(count, std::memory_order_relaxed);
+        if (cnt == n) {
+            mag->free_hit.store(mag->free_hit.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+            return cnt;
+        }
+        mag->free_miss.store(mag->free_miss.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    }
+    cnt += m_queue->push_bulk((uint8_t* const*)ptrs + cnt, n - cnt);
+    return cnt;
+}
 
-} // namespace tinytcp
 
+} // namespace tinytcp
 
 
@@ -2,42 +2,173 @@
 
 /**
 * memory block，用无锁队列封装一个简单的内存池
+* 每个线程前面还有一个小的magazine(后进先出的空闲对象栈), 分配释放先走本线程的magazine,
+* 空了或满了才成批地和全局的无锁队列交换, 大部分操作不碰共享的cache line
+* 内存块所在的连续内存(arena)可以按配置使用大页, 启动时预先触发缺页并锁在内存中
+* 弹性内存池: 空闲块少于低水位时按chunk扩充; 归还不在释放路径上, 由定时器周期调用reclaim, 空闲块多于高水位时把整块空闲的chunk还回去
 */
 
 
+#include <atomic>
+#include <functional>
 #include <memory>
+#include <cstddef>
+#include <vector>
+#include <stdlib.h>
 #include "src/lock_free_ring_queue.h"
 
 namespace tinytcp {
 
+// magazine的命中情况, 用来调整magazine的大小
+struct memblock_magazine_stat_t {
+    uint64_t alloc_hit = 0;     // 直接从本线程magazine分配
+    uint64_t alloc_miss = 0;    // magazine空了, 去全局队列补充
+    uint64_t free_hit = 0;      // 直接放回本线程magazine
+    uint64_t free_miss = 0;     // magazine满了, 一批还给全局队列
+    uint32_t cached = 0;        // 所有magazine中缓存的空闲对象数
+    uint32_t magazine_cnt = 0;  // 正在使用的magazine数量(正在使用这个内存池的线程数)
+};
+
+// 弹性扩缩容参数, max_capacity不大于初始容量时内存池大小固定
+struct memblock_elastic_t {
+    int max_capacity = 0;     // 最多扩充到多少个内存块
+    int chunk_capacity = 0;   // 每次扩充多少个内存块, 0表示和初始容量一样
+    int low_watermark = 0;    // 全局队列中空闲块少于这个数时扩充, 0表示chunk_capacity / 4
+    int high_watermark = 0;   // 全局队列中空闲块多于这个数时尝试归还, 0表示low_watermark + chunk_capacity * 2
+};
+
+// 弹性内存池的情况
+struct memblock_elastic_stat_t {
+    int init_capacity = 0;    // 初始的内存块数量
+    int max_capacity = 0;     // 最多扩充到的内存块数量
+    uint32_t chunk_cnt = 0;   // 当前扩充出来的chunk数量
+    uint64_t grow_cnt = 0;    // 扩充的次数
+    uint64_t shrink_cnt = 0;  // 归还的次数
+    uint64_t grow_fail = 0;   // 达到上限或者超出内存预算, 扩充不了导致分配失败的次数
+};
+
 class MemBlock {
 public:
     using uptr = std::unique_ptr<MemBlock>;
     using  ptr = std::shared_ptr<MemBlock>;
+    // 每个内存块第一次加入内存池时调用, 扩充出来的内存块也会调用
+    using init_func = std::function<void(void* ptr)>;
 
-    MemBlock(int block_size, int capacity = 1024);
+    // align: 每个内存块的对齐大小, block_size会向上取整到align的整数倍
+    MemBlock(int block_size, int capacity = 1024, int align = alignof(std::max_align_t));
+    MemBlock(int block_size, int capacity, int align, const memblock_elastic_t& elastic, init_func init = nullptr);
 
     ~MemBlock();
 
     int block_size() const noexcept { return m_block_size; }
 
-    int size() const noexcept { return m_queue->size(); }
-
-    int capacity() const noexcept { return m_queue->capacity(); }
-
-    /** TODO
+    // 初始arena中第index个内存块的地址, 方便使用者在启动时按槽位初始化
+    uint8_t* block_at(int index) const noexcept { return m_block.get() + (size_t)index * m_block_size; }
+
+    // 空闲的内存块数量, 包括缓存在各个线程magazine中的
+    int size() const;
+
+    // 当前管理的内存块数量, 弹性内存池会随着扩缩容变化
+    int capacity() const noexcept { return m_capacity.load(std::memory_order_relaxed); }
+
+    bool is_elastic() const noexcept { return m_elastic.max_capacity > m_init_capacity; }
+    void get_elastic_stat(memblock_elastic_stat_t& stat) const;
+    // 最后扩充的chunk整块空闲时归还, 返回是否归还了
+    // 要把全局队列取空再放回去, 期间分配要等它结束, 不在分配释放的路径上调用
+    bool shrink();
+    // 全局队列中空闲块多于高水位时shrink, 由定时器周期调用, 每次最多归还一个chunk
+    bool reclaim() {
+        if (m_chunk_cnt.load(std::memory_order_relaxed) > 0 && (int)m_queue->size() > m_elastic.high_watermark) {
+            return shrink();
+        }
+        return false;
+    }
+    // 所有弹性内存池扩充出来的内存总量, 受tcp.memblock_grow_budget限制
+    static size_t get_grow_bytes();
+
+    // arena的情况: 是否是mmap出来的大页(MAP_HUGETLB或者透明大页), 是否mlock成功
+    bool is_hugepage() const noexcept { return m_hugepage; }
+    bool is_locked() const noexcept { return m_locked; }
+
+    // 每个线程的magazine最多缓存多少个对象, 0表示不使用magazine
+    uint32_t magazine_size() const noexcept { return m_mag_size; }
+    void get_magazine_stat(memblock_magazine_stat_t& stat) const;
+
+    /**
     * ms < 0  : 无限等待
     * ms = 0  : try pop
-    * ms > 0  : 加上超时处理
+    * ms > 0  : 最多等待ms毫秒
+    * 本线程magazine和全局队列都没有空闲块时才会挂起, 等其他线程归还
     */
     bool alloc(void** ptr, int timeout_ms);
 
     bool free(const void* ptr);
 
+    // 批量分配/释放, 先用本线程的magazine, 剩下的和全局队列一次交换
+    // alloc_bulk返回分配到的数量(可能少于n), free_bulk返回放回去的数量
+    int alloc_bulk(void** ptrs, int n);
+    int free_bulk(void* const* ptrs, int n);
+
+    struct Magazine;
+    struct MagazineCache;
+
 private:
+    // posix_memalign分配的用free释放, mmap出来的用munmap释放
+    struct ArenaDeleter {
+        size_t map_size;   // 0表示不是mmap出来的
+        void operator()(uint8_t* ptr) const noexcept;
+    };
+
+    using arena_ptr = std::unique_ptr<uint8_t, ArenaDeleter>;
+
+    // 分配放内存块的arena, 按配置使用大页, 预先缺页, mlock
+    arena_ptr alloc_arena(size_t size);
+    // 空闲块少于低水位时扩充一个chunk, 同一时间只有一个线程在扩缩容, 其他线程直接返回
+    bool grow();
+    void maybe_grow() {
+        if (is_elastic() && (int)m_queue->size() < m_elastic.low_watermark
+            && m_capacity.load(std::memory_order_relaxed) < m_elastic.max_capacity) {
+            grow();
+        }
+    }
+    // 全局队列取不到时, 如果正在扩缩容, 等它结束之后再取一次
+    bool pop_slow(uint8_t** ptr);
+
+    // 当前线程在这个内存池上的magazine, 第一次使用时创建
+    Magazine* local_magazine();
+    // 从全局队列补充/向全局队列归还一批对象
+    void refill(Magazine* mag);
+    void spill(Magazine* mag);
+
     int m_block_size;                  // 每个内存块的大小
-    std::unique_ptr<uint8_t> m_block;  // 内存块的首地址, 分配的内存块
+    int m_align;
+    std::atomic<int> m_capacity;       // 内存池中实际管理的内存块数量
+    arena_ptr m_block;                 // 内存块的首地址, 一次性分配的连续内存
+    bool m_hugepage = false;
+    bool m_locked = false;
     std::unique_ptr<LockFreeRingQueue<uint8_t *>> m_queue;
+
+    // 弹性扩缩容
+    struct chunk_t {
+        arena_ptr mem;
+        int cnt;
+    };
+    int m_init_capacity;
+    memblock_elastic_t m_elastic;
+    init_func m_init;
+    std::vector<chunk_t> m_chunks;            // 扩充出来的chunk, 预留了最大数量, 不会重新分配
+    std::vector<uint8_t*> m_shrink_buf;       // 归还时暂存全局队列中的空闲块
+    std::atomic<uint32_t> m_chunk_cnt{0};
+    std::atomic<bool> m_resizing{false};      // 正在扩缩容, 相当于try lock
+    std::atomic<uint64_t> m_grow_cnt{0};
+    std::atomic<uint64_t> m_shrink_cnt{0};
+    std::atomic<uint64_t> m_grow_fail{0};
+
+    uint32_t m_id;                     // 内存池的编号, 用来找到线程局部的magazine
+    uint32_t m_mag_size = 0;           // 每个magazine的容量
+    // 各个线程的magazine串成的链表, 只增不删, 统计时不加锁遍历
+    // 线程退出时magazine留在链表上, 之后的线程复用
+    std::atomic<Magazine*> m_magazines{nullptr};
 };
 
 
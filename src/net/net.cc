@@ -4,32 +4,101 @@
 #include "src/config.h"
 #include "src/macro.h"
 #include "src/log.h"
+#include "src/util.h"
 #include "magic_enum.h"
-#include <fcntl.h>
+#include <climits>
 
 
 namespace tinytcp {
 
 static tinytcp::Logger::ptr g_logger = TINYTCP_LOG_NAME("system");
 
+// 工作线程一次从网卡输入队列取出的包数
+#define NET_NETIF_IN_BURST 32
+
 static tinytcp::ConfigVar<uint32_t>::ptr g_tcp_msg_queue_size =
     tinytcp::Config::look_up("tcp.msg_queue_size", (uint32_t)1024, "tcp msg queue size");
 static tinytcp::ConfigVar<uint32_t>::ptr g_tcp_timer_msg_queue_size =
     tinytcp::Config::look_up("tcp.timer_msg_queue_size", (uint32_t)128, "tcp timer msg queue size");
+static tinytcp::ConfigVar<uint32_t>::ptr g_tcp_netif_in_budget =
+    tinytcp::Config::look_up("tcp.netif_in_budget", (uint32_t)64, "tcp netif in budget, 工作线程每轮从一个网卡最多处理的包数, 处理完一轮再看消息和其他网卡");
+static tinytcp::ConfigCache<uint32_t> g_tcp_netif_in_budget_cache(g_tcp_netif_in_budget);
+static tinytcp::ConfigVar<uint32_t>::ptr g_tcp_work_spin_us =
+    tinytcp::Config::look_up("tcp.work_spin_us", (uint32_t)50, "tcp work spin us, 工作线程处理完消息之后先自旋多少微秒再挂起, 0表示直接挂起");
+static tinytcp::ConfigCache<uint32_t> g_tcp_work_spin_us_cache(g_tcp_work_spin_us);
+static tinytcp::ConfigVar<uint32_t>::ptr g_tcp_work_ctrl_weight =
+    tinytcp::Config::look_up("tcp.work_ctrl_weight", (uint32_t)16, "tcp work ctrl weight, 工作线程每轮最多处理的控制消息(定时器回调等)数量, 先于收包处理");
+static tinytcp::ConfigCache<uint32_t> g_tcp_work_ctrl_weight_cache(g_tcp_work_ctrl_weight);
+static tinytcp::ConfigVar<uint32_t>::ptr g_tcp_work_data_weight =
+    tinytcp::Config::look_up("tcp.work_data_weight", (uint32_t)8, "tcp work data weight, 工作线程每轮最多处理的收包通知数量, 处理完再轮询一遍网卡");
+static tinytcp::ConfigCache<uint32_t> g_tcp_work_data_weight_cache(g_tcp_work_data_weight);
+static tinytcp::ConfigVar<uint32_t>::ptr g_tcp_work_thread_cnt =
+    tinytcp::Config::look_up("tcp.work_thread_cnt", (uint32_t)1, "tcp work thread cnt, 协议栈工作线程的数量, 收到的包按流的哈希分给各个工作线程");
+static tinytcp::ConfigVar<uint32_t>::ptr g_tcp_memblock_reclaim_ms =
+    tinytcp::Config::look_up("tcp.memblock_reclaim_ms", (uint32_t)1000, "tcp memblock reclaim ms, 第0个工作线程每隔多少毫秒检查一次弹性内存池, 归还扩充出来的空闲内存, 0表示不归还");
+
+// 当前线程是第几个工作线程, 属于哪个协议栈
+static thread_local uint32_t t_worker_id = 0;
+static thread_local const ProtocolStack* t_stack = nullptr;
 
 ProtocolStack::ProtocolStack() {
     TINYTCP_LOG_DEBUG(g_logger) << "g_tcp_msg_queue_size=" << g_tcp_msg_queue_size->value();
-    m_mem_block = std::make_unique<MemBlock>(sizeof(exmsg_t), g_tcp_msg_queue_size->value());
+    uint32_t worker_cnt = std::max(g_tcp_work_thread_cnt->value(), 1U);
+    // 消息内存池所有工作线程共用, 每个工作线程一个消息队列
+    m_mem_block = std::make_unique<MemBlock>(sizeof(exmsg_t), g_tcp_msg_queue_size->value() * worker_cnt);
     TINYTCP_ASSERT2(m_mem_block != nullptr, "m_mem_block init error");
-    m_msg_queue = std::make_unique<LockFreeRingQueue<exmsg_t*>>(g_tcp_msg_queue_size->value());
-    TINYTCP_ASSERT2(m_msg_queue != nullptr, "m_msg_queue init error");
+    // 控制通道的消息都来自定时器消息池, 和消息池一样大时不会满
+    for (uint32_t i = 0; i < worker_cnt; ++i) {
+        auto queue = std::make_unique<msg_queue_t>();
+        queue->lanes[NET_MSG_LANE_CTRL] = std::make_unique<LockFreeRingQueue<exmsg_t*>>(g_tcp_timer_msg_queue_size->value());
+        queue->lanes[NET_MSG_LANE_DATA] = std::make_unique<LockFreeRingQueue<exmsg_t*>>(g_tcp_msg_queue_size->value());
+        m_msg_queues.push_back(std::move(queue));
+    }
+    // 网卡按工作线程的数量创建输入队列, 要在消息队列之后创建
     m_network = std::make_unique<PcapNetWork>(this);
     TINYTCP_ASSERT2(m_network != nullptr, "m_network init error");
+    // 函数消息的内存池, 工作线程启动之后就可能用到
+    m_timer_mem_block = std::make_unique<MemBlock>(sizeof(exmsg_t), g_tcp_timer_msg_queue_size->value());
+    TINYTCP_ASSERT2(m_timer_mem_block != nullptr, "m_timer_mem_block init error");
 
     // 启动工作线程
-    m_work_thread = std::make_unique<Thread>(std::bind(&ProtocolStack::work_thread_func, this), "work_thread");
-    // 启动定时器线程
-    timer_thread_init();
+    for (uint32_t i = 0; i < worker_cnt; ++i) {
+        m_workers.push_back(std::make_unique<Worker>(this, i));
+    }
+    for (auto& worker : m_workers) {
+        worker->thread = std::make_unique<Thread>(std::bind(&ProtocolStack::work_thread_func, this, worker.get()),
+                                                  "work_thread_" + std::to_string(worker->id));
+    }
+    // 归还内存要取空池子的全局队列, 不放在释放路径上, 由定时器周期检查
+    uint32_t reclaim_ms = g_tcp_memblock_reclaim_ms->value();
+    if (reclaim_ms != 0 && add_timer(reclaim_ms, []() { PktMgr::get_instance()->reclaim(); }, true) == nullptr) {
+        TINYTCP_LOG_WARN(g_logger) << "add memblock reclaim timer error";
+    }
+}
+
+ProtocolStack::~ProtocolStack() {
+    m_stopping.store(true, std::memory_order_release);
+    for (auto& worker : m_workers) {
+        // 发一个空消息, 挂起的工作线程醒来之后看到退出标记
+        while ((int8_t)post_to_worker(worker->id, []() {}) < 0) {
+            std::this_thread::yield();
+        }
+        worker->thread->join();
+    }
+    exmsg_t* msg = nullptr;
+    for (auto& queue : m_msg_queues) {
+        for (auto& lane : queue->lanes) {
+            while (lane->pop(&msg, 0)) {
+                if (msg->type == exmsg_t::NET_EXMSG_TIMER_FUN) {
+                    release_timer_msg_block(msg);
+                }
+                else {
+                    release_msg_block(msg);
+                }
+            }
+        }
+    }
+    TINYTCP_LOG_INFO(g_logger) << "protocol stack stopped, worker_cnt=" << m_workers.size();
 }
 
 net_err_t ProtocolStack::init() {
@@ -41,133 +110,375 @@ net_err_t ProtocolStack::start() {
 }
 
 
-void ProtocolStack::work_thread_func() {
-    TINYTCP_LOG_INFO(g_logger) << "work thread begin";
+void ProtocolStack::work_thread_func(Worker* worker) {
+    TINYTCP_LOG_INFO(g_logger) << "work thread " << worker->id << " begin";
+    t_worker_id = worker->id;
+    t_stack = this;
+
+    // 只有一个核时自旋只会拖住生产者
+    bool can_spin = std::thread::hardware_concurrency() > 1;
+    bool polling = false;
+    while (!m_stopping.load(std::memory_order_acquire)) {
+        // 到期的定时器和控制消息先处理, 但每轮各自最多ctrl_weight个, 再多也不会饿死收包;
+        // 收包通知和网卡轮询每轮也有上限, 控制消息最多等一轮
+        uint32_t ctrl_weight = std::max(g_tcp_work_ctrl_weight_cache.value(), 1U);
+        uint32_t handled = run_timers(worker, ctrl_weight);
+        handled += drain_lane(worker, NET_MSG_LANE_CTRL, ctrl_weight);
+        handled += drain_lane(worker, NET_MSG_LANE_DATA, std::max(g_tcp_work_data_weight_cache.value(), 1U));
+        // 还有网卡没处理完时不能挂起
+        if (handled != 0 || polling) {
+            polling = poll_netifs(worker);
+            continue;
+        }
 
-    while (true) {
-        // 阻塞,取出消息
+        uint64_t next_timeout = worker->timers.get_next_time();
+        if (next_timeout == 0) {
+            continue;
+        }
+        // 负载高时新消息很快就到, 先自旋一小段时间, 省掉一次挂起和唤醒;
+        // 超时之后挂起在futex上, 不占CPU, 生产者只有看到有人挂起时才发起唤醒, 最多挂起到下一个定时器到期
         exmsg_t* msg = nullptr;
-        if (!m_msg_queue->pop(&msg)) {
+        if (can_spin && spin_pop_msg(worker, &msg)) {
+            worker->spin_hit.store(worker->spin_hit.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        }
+        else {
+            worker->park.store(worker->park.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+            int timeout_ms = next_timeout == ~0ULL ? -1 : (int)std::min(next_timeout, (uint64_t)INT_MAX);
+            if (!wait_pop_msg(worker, &msg, timeout_ms)) {
+                continue;
+            }
+        }
+        auto& lane_msgs = worker->lane_msgs[get_msg_lane(msg)];
+        lane_msgs.store(lane_msgs.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        handle_msg(msg);
+        polling = poll_netifs(worker);
+    }
+    TINYTCP_LOG_INFO(g_logger) << "work thread " << worker->id << " end";
+}
+
+uint32_t ProtocolStack::drain_lane(Worker* worker, net_msg_lane_t lane, uint32_t weight) {
+    LockFreeRingQueue<exmsg_t*>& queue = *m_msg_queues[worker->id]->lanes[lane];
+    uint32_t cnt = 0;
+    exmsg_t* msg = nullptr;
+    while (cnt < weight && queue.pop(&msg, 0)) {
+        handle_msg(msg);
+        ++cnt;
+    }
+    // 只有工作线程写, 不需要原子的加法
+    if (cnt != 0) {
+        auto& lane_msgs = worker->lane_msgs[lane];
+        lane_msgs.store(lane_msgs.load(std::memory_order_relaxed) + cnt, std::memory_order_relaxed);
+    }
+    if (cnt >= weight && !queue.is_empty()) {
+        auto& deferred = worker->lane_deferred[lane];
+        deferred.store(deferred.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    }
+    return cnt;
+}
+
+uint32_t ProtocolStack::run_timers(Worker* worker, uint32_t weight) {
+    auto& cbs = worker->expired_cbs;
+    // 上一批执行完了才推进时间轮
+    if (worker->expired_pos == cbs.size()) {
+        cbs.clear();
+        worker->expired_pos = 0;
+        if (!worker->timers.has_timer()) {
+            return 0;
+        }
+        worker->timers.list_expired_cb(cbs);
+    }
+    uint32_t cnt = 0;
+    while (cnt < weight && worker->expired_pos < cbs.size()) {
+        Timer::Callback cb = std::move(cbs[worker->expired_pos++]);
+        ++cnt;
+        if (!cb) {
             continue;
         }
+        try {
+            cb();
+        } catch (const std::exception& e) {
+            TINYTCP_LOG_ERROR(g_logger) << "Timer callback error: " << e.what();
+        }
+    }
+    if (cnt != 0) {
+        worker->timer_cbs.store(worker->timer_cbs.load(std::memory_order_relaxed) + cnt, std::memory_order_relaxed);
+    }
+    return cnt;
+}
 
-        TINYTCP_LOG_DEBUG(g_logger)
-            << "work thread recv msg=" << (uint64_t)msg
-            << " msg_type=" << magic_enum::enum_name(msg->type);
+void ProtocolStack::handle_msg(exmsg_t* msg) {
+    TINYTCP_LOG_DEBUG(g_logger)
+        << "work thread recv msg=" << (uint64_t)msg
+        << " msg_type=" << magic_enum::enum_name(msg->type);
 
-        switch (msg->type) {
-            case exmsg_t::NET_EXMSG_NETIF_IN: {
-                TINYTCP_LOG_DEBUG(g_logger) << "do netif in";
-                do_netif_in(msg);
-                break;
-            }
-            case exmsg_t::NET_EXMSG_TIMER_FUN: {
-                std::function<void()> func;
-                func.swap(msg->timer.func);
-                if (func) {
-                    try {
-                        func();
-                    } catch (const std::exception& e) {
-                        TINYTCP_LOG_ERROR(g_logger) << "Timer callback error: " << e.what();
-                    }
+    switch (msg->type) {
+        case exmsg_t::NET_EXMSG_NETIF_IN: {
+            TINYTCP_LOG_DEBUG(g_logger) << "do netif in";
+            do_netif_in(msg);
+            break;
+        }
+        case exmsg_t::NET_EXMSG_TIMER_FUN: {
+            Timer::Callback func = std::move(msg->timer.func);
+            if (func) {
+                try {
+                    func();
+                } catch (const std::exception& e) {
+                    TINYTCP_LOG_ERROR(g_logger) << "Timer callback error: " << e.what();
                 }
-                break;
             }
-            default:
-                break;
+            break;
         }
+        default:
+            break;
+    }
 
-        // 工作线程消费完之后把内存块放回去
-        if (msg->type == exmsg_t::NET_EXMSG_TIMER_FUN) {
-            release_timer_msg_block(msg);
-        }
-        else {
-            release_msg_block(msg);
-        }
+    // 工作线程消费完之后把内存块放回去
+    if (msg->type == exmsg_t::NET_EXMSG_TIMER_FUN) {
+        release_timer_msg_block(msg);
+    }
+    else {
+        release_msg_block(msg);
     }
 }
 
 net_err_t ProtocolStack::do_netif_in(exmsg_t* msg) {
     INetIF* netif = msg->netif.netif;
+    uint32_t queue = msg->netif.queue;
+    TINYTCP_ASSERT2(queue == t_worker_id, "netif in msg sent to wrong worker");
+    Worker* worker = m_workers[queue].get();
+    if (!netif->is_in_polling(queue)) {
+        netif->set_in_polling(true, queue);
+        worker->poll_list.push_back(netif);
+    }
+    return net_err_t::NET_ERR_OK;
+}
 
-    while (netif->get_in_queue_size() != 0) {
-        PktBuffer* buf = netif->get_buf_from_in_queue(0);
-        if (buf == nullptr) {
-            TINYTCP_LOG_ERROR(g_logger) << "do_netif_in get buf error!!!";
-            return net_err_t::NET_ERR_MEM;
-        }
-
-        net_err_t err = netif->link_in(buf);
-        if ((int8_t)err < 0) {
-            TINYTCP_LOG_WARN(g_logger) << "netif link in error:" << magic_enum::enum_name(err);
-            buf->free();
+net_err_t ProtocolStack::drain_netif(INetIF* netif, uint32_t timeout_ms) {
+    TINYTCP_ASSERT2(t_stack != this, "drain_netif can not be called in a work thread");
+    // 检查的状态: 还没执行, 正在执行, 还在引用, 已经不再引用, 调用者已经放弃(之后执行到也不再访问netif)
+    enum { CHECK_PENDING, CHECK_RUNNING, CHECK_BUSY, CHECK_IDLE, CHECK_ABANDONED };
+    uint64_t deadline = get_monotonic_ms() + timeout_ms;
+    for (uint32_t i = 0; i < m_workers.size(); ++i) {
+        int result = CHECK_BUSY;
+        while (result != CHECK_IDLE) {
+            // 工作线程退出之后检查不会再执行, 消息池一直满着也不能一直等
+            if (m_stopping.load(std::memory_order_acquire)) {
+                TINYTCP_LOG_WARN(g_logger) << "drain_netif " << netif->get_name() << " stopped, worker=" << i;
+                return net_err_t::NET_ERR_STATE;
+            }
+            if (get_monotonic_ms() >= deadline) {
+                TINYTCP_LOG_WARN(g_logger) << "drain_netif " << netif->get_name() << " timeout, worker=" << i;
+                return net_err_t::NET_ERR_TIMEOUT;
+            }
+            // 调用者超时返回之后检查还可能执行, 状态不能放在调用者的栈上
+            auto state = std::make_shared<std::atomic<int>>(CHECK_PENDING);
+            auto check = [this, netif, i, state]() {
+                int expected = CHECK_PENDING;
+                if (!state->compare_exchange_strong(expected, CHECK_RUNNING, std::memory_order_acq_rel)) {
+                    return;
+                }
+                // 工作线程是输入队列唯一的消费者, 剩下的包在这里释放
+                PktBuffer* bufs[NET_NETIF_IN_BURST];
+                uint32_t cnt = 0;
+                while ((cnt = netif->get_bufs_from_in_queue(bufs, NET_NETIF_IN_BURST, 0, i)) != 0) {
+                    for (uint32_t j = 0; j < cnt; ++j) {
+                        bufs[j]->free();
+                    }
+                }
+                // 还在轮询列表中的下一轮会移出去, 收包通知还在数据通道里的等处理完, 都再检查一次
+                bool idle = !netif->is_in_polling(i) && !netif->is_in_pending(i)
+                            && m_msg_queues[i]->lanes[NET_MSG_LANE_DATA]->is_empty();
+                state->store(idle ? CHECK_IDLE : CHECK_BUSY, std::memory_order_release);
+            };
+            if ((int8_t)post_to_worker(i, check) < 0) {
+                std::this_thread::yield();
+                continue;
+            }
+            while ((result = state->load(std::memory_order_acquire)) == CHECK_PENDING || result == CHECK_RUNNING) {
+                // 还没开始执行时可以放弃, 已经开始的等它执行完, 不会太久
+                if (result == CHECK_PENDING
+                        && (m_stopping.load(std::memory_order_acquire) || get_monotonic_ms() >= deadline)
+                        && state->compare_exchange_strong(result, CHECK_ABANDONED, std::memory_order_acq_rel)) {
+                    break;
+                }
+                std::this_thread::yield();
+            }
         }
-        // TINYTCP_LOG_INFO(g_logger) << "recv a packet";
-        // buf->fill(0x11, 6);
-        // err = netif->netif_out(ipaddr_t(), buf);
-        // if ((int8_t)err < 0) {
-        //     buf->free();
-        // }
+    }
+    return net_err_t::NET_ERR_OK;
+}
 
+net_err_t ProtocolStack::post_to_worker(uint32_t worker, Timer::Callback func) {
+    if (worker >= m_workers.size()) {
+        return net_err_t::NET_ERR_PARAM;
+    }
+    // 和定时器回调一样是一个函数消息
+    exmsg_t* msg = get_timer_msg_block();
+    if (msg == nullptr) {
+        return net_err_t::NET_ERR_MEM;
     }
+    msg->timer.func = std::move(func);
+    net_err_t err = push_msg(msg, 0, worker);
+    if ((int8_t)err < 0) {
+        release_timer_msg_block(msg);
+    }
+    return err;
+}
 
-    return net_err_t::NET_ERR_OK;
+bool ProtocolStack::in_worker(uint32_t worker) const {
+    return t_stack == this && t_worker_id == worker;
+}
+
+uint32_t ProtocolStack::get_current_worker() {
+    return t_worker_id;
 }
 
-void ProtocolStack::on_timer_inserted_at_front() {
-    tickle_event();
+TimerManager& ProtocolStack::get_timer_manager() {
+    TINYTCP_ASSERT2(t_stack == this, "timer must be used in a work thread of this protocol stack");
+    return m_workers[t_worker_id]->timers;
 }
 
-void ProtocolStack::tickle_event() {
-    eventfd_t value = 0xFF;
-    eventfd_write(m_event_fd, value);
+Timer::ptr ProtocolStack::add_timer(uint64_t ms, Timer::Callback cb, bool recurring) {
+    // 不在工作线程中时, 第0个工作线程的时间轮会把添加请求转过去
+    TimerManager& timers = t_stack == this ? m_workers[t_worker_id]->timers : m_workers[0]->timers;
+    return timers.add_timer(ms, std::move(cb), recurring);
 }
 
-void ProtocolStack::timer_thread_func() {
-    epoll_event* events = new epoll_event[64]();
-    std::shared_ptr<epoll_event> shared_events(events, [](epoll_event* ptr) {
-        delete[] ptr;
-    });
+Timer::ptr ProtocolStack::add_condition_timer(uint64_t ms, std::function<void()> cb,
+                                              std::weak_ptr<void> weak_cond,
+                                              bool recurring) {
+    TimerManager& timers = t_stack == this ? m_workers[t_worker_id]->timers : m_workers[0]->timers;
+    return timers.add_condition_timer(ms, std::move(cb), std::move(weak_cond), recurring);
+}
 
+bool ProtocolStack::try_pop_msg(Worker* worker, exmsg_t** msg) {
+    msg_queue_t& queue = *m_msg_queues[worker->id];
+    for (auto& lane : queue.lanes) {
+        if (lane->pop(msg, 0)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool ProtocolStack::spin_pop_msg(Worker* worker, exmsg_t** msg) {
+    uint32_t spin_us = g_tcp_work_spin_us_cache.value();
+    if (spin_us == 0) {
+        return false;
+    }
+    uint64_t deadline = get_current_us() + spin_us;
     while (true) {
-        uint64_t next_timeout = get_next_time();
-        int rt = 0;
-        do {
-            static const uint64_t MAX_TIMEOUT = 3000;
-            if (next_timeout != ~0ULL) {
-                next_timeout = std::min(next_timeout, MAX_TIMEOUT);
-            }
-            else {
-                next_timeout = MAX_TIMEOUT;
-            }
-            rt = epoll_wait(m_event_fd, events, 64, int(next_timeout));
-            if (rt < 0 && rt == EINTR) {
-            }
-            else {
-                break;
+        // 每自旋一批才看一次时间
+        for (int i = 0; i < 64; ++i) {
+            if (try_pop_msg(worker, msg)) {
+                return true;
             }
+            TINYTCP_CPU_RELAX();
+        }
+        if (get_current_us() >= deadline) {
+            return false;
+        }
+    }
+}
+
+bool ProtocolStack::wait_pop_msg(Worker* worker, exmsg_t** msg, int timeout_ms) {
+    FutexEvent& event = m_msg_queues[worker->id]->not_empty;
+    uint32_t seq = event.prepare_wait();
+    // 登记之后再检查一次所有通道, 避免检查和挂起之间的唤醒丢失
+    bool ok = try_pop_msg(worker, msg);
+    if (!ok) {
+        event.wait(seq, timeout_ms);
+        ok = try_pop_msg(worker, msg);
+    }
+    event.finish_wait();
+    return ok;
+}
+
+bool ProtocolStack::poll_netifs(Worker* worker) {
+    uint32_t budget = std::max(g_tcp_netif_in_budget_cache.value(), 1U);
+    // 每个网卡一轮, 新加入的和放回队尾的等下一遍
+    auto& poll_list = worker->poll_list;
+    size_t cnt = poll_list.size();
+    for (size_t i = 0; i < cnt; ++i) {
+        INetIF* netif = poll_list.front();
+        poll_list.pop_front();
+        // 用完预算的放回队尾; 取空之后清除通知标记, 期间又有包进来的也放回去
+        if (poll_netif(worker, netif, budget) || netif->clear_in_pending(worker->id)) {
+            poll_list.push_back(netif);
+        }
+        else {
+            netif->set_in_polling(false, worker->id);
+        }
+    }
+    return !poll_list.empty();
+}
 
-        } while (true);
+bool ProtocolStack::poll_netif(Worker* worker, INetIF* netif, uint32_t budget) {
+    // 一次从输入队列取出一批, 减少和收包线程交接的次数
+    PktBuffer* bufs[NET_NETIF_IN_BURST];
+    uint32_t total = 0;
+    while (total < budget) {
+        uint32_t cnt = netif->get_bufs_from_in_queue(bufs, std::min(budget - total, (uint32_t)NET_NETIF_IN_BURST), 0, worker->id);
+        if (cnt == 0) {
+            break;
+        }
+        netif->link_in_burst(bufs, cnt);
+        total += cnt;
+    }
+    bool exhausted = total >= budget && netif->get_in_queue_size(worker->id) != 0;
 
-        std::vector<std::function<void()>> cbs;
-        list_expired_cb(cbs);
-        for (auto& cb : cbs) {
-            // cb();
-            exmsg_t* timer_exmsg = get_timer_msg_block();
-            if (timer_exmsg == nullptr) {
-                TINYTCP_LOG_ERROR(g_logger) << "get timer msg block error";
-                continue;
-            }
-            timer_exmsg->type = exmsg_t::NET_EXMSG_TIMER_FUN;
-            timer_exmsg->timer = msg_timer_t(cb);
-            if ((int8_t)push_msg(timer_exmsg, -1) < 0) {
-                TINYTCP_LOG_ERROR(g_logger) << "push timer message failed";
-                release_timer_msg_block(timer_exmsg);
-            }
+    // 只有工作线程写, 不需要原子的加法
+    worker->poll_rounds.store(worker->poll_rounds.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    worker->poll_pkts.store(worker->poll_pkts.load(std::memory_order_relaxed) + total, std::memory_order_relaxed);
+    if (exhausted) {
+        worker->poll_budget_exhausted.store(worker->poll_budget_exhausted.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    }
+    if (total != 0) {
+        int bucket = std::min(31 - __builtin_clz(total), NET_POLL_HIST_SIZE - 1);
+        auto& hist = worker->poll_batch_hist[bucket];
+        hist.store(hist.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    }
+    return exhausted;
+}
+
+void ProtocolStack::get_poll_stat(net_poll_stat_t& stat) const {
+    stat = net_poll_stat_t();
+    for (uint32_t i = 0; i < m_workers.size(); ++i) {
+        net_poll_stat_t worker_stat;
+        get_poll_stat(i, worker_stat);
+        stat.rounds += worker_stat.rounds;
+        stat.pkts += worker_stat.pkts;
+        stat.budget_exhausted += worker_stat.budget_exhausted;
+        for (int j = 0; j < NET_POLL_HIST_SIZE; ++j) {
+            stat.batch_hist[j] += worker_stat.batch_hist[j];
+        }
+        stat.spin_hit += worker_stat.spin_hit;
+        stat.park += worker_stat.park;
+        stat.timers += worker_stat.timers;
+        for (int j = 0; j < NET_MSG_LANE_CNT; ++j) {
+            stat.lane_msgs[j] += worker_stat.lane_msgs[j];
+            stat.lane_deferred[j] += worker_stat.lane_deferred[j];
         }
     }
 }
 
+void ProtocolStack::get_poll_stat(uint32_t worker, net_poll_stat_t& stat) const {
+    const Worker& w = *m_workers[worker];
+    stat.rounds = w.poll_rounds.load(std::memory_order_relaxed);
+    stat.pkts = w.poll_pkts.load(std::memory_order_relaxed);
+    stat.budget_exhausted = w.poll_budget_exhausted.load(std::memory_order_relaxed);
+    for (int i = 0; i < NET_POLL_HIST_SIZE; ++i) {
+        stat.batch_hist[i] = w.poll_batch_hist[i].load(std::memory_order_relaxed);
+    }
+    stat.spin_hit = w.spin_hit.load(std::memory_order_relaxed);
+    stat.park = w.park.load(std::memory_order_relaxed);
+    stat.timers = w.timer_cbs.load(std::memory_order_relaxed);
+    for (int i = 0; i < NET_MSG_LANE_CNT; ++i) {
+        stat.lane_msgs[i] = w.lane_msgs[i].load(std::memory_order_relaxed);
+        stat.lane_deferred[i] = w.lane_deferred[i].load(std::memory_order_relaxed);
+    }
+}
+
 exmsg_t* ProtocolStack::get_timer_msg_block() {
     exmsg_t* ptr;
     if (!m_timer_mem_block->alloc((void**)&ptr, 0)) {
@@ -187,26 +498,5 @@ net_err_t ProtocolStack::release_timer_msg_block(exmsg_t* msg) {
 }
 
 
-void ProtocolStack::timer_thread_init() {
-    m_epoll_fd = epoll_create1(0);
-    TINYTCP_ASSERT2(m_epoll_fd != -1, "epoll_create1 error");
-    m_event_fd = eventfd(0, EFD_NONBLOCK);
-    TINYTCP_ASSERT2(m_event_fd != -1, "eventfd create error");
-    m_timer_mem_block = std::make_unique<MemBlock>(sizeof(exmsg_t), g_tcp_timer_msg_queue_size->value());
-    TINYTCP_ASSERT2(m_timer_mem_block != nullptr, "m_timer_mem_block init error");
-    m_timer_msg_queue = std::make_unique<LockFreeRingQueue<exmsg_t*>>(g_tcp_timer_msg_queue_size->value());
-    TINYTCP_ASSERT2(m_timer_msg_queue != nullptr, "m_timer_msg_queue init error");
-
-    epoll_event event;
-    event.events = EPOLLET | EPOLLIN;
-    int rt = fcntl(m_event_fd, F_SETFL, O_NONBLOCK);
-    TINYTCP_ASSERT(!rt);
-    rt = epoll_ctl(m_epoll_fd, EPOLL_CTL_ADD, m_event_fd, &event);
-    TINYTCP_ASSERT(!rt);
-
-    m_timer_thread = std::make_unique<Thread>(std::bind(&ProtocolStack::timer_thread_func, this), "timer_thread");
-    TINYTCP_ASSERT2(m_timer_thread != nullptr, "m_timer_thread create error");
-}
-
 } // namespace tinytcp
 
@@ -9,45 +9,142 @@
 #include "src/thread.h"
 #include "src/lock_free_ring_queue.h"
 #include "src/timer.h"
-#include <sys/epoll.h>
-#include <sys/eventfd.h>
+#include <atomic>
+#include <deque>
+#include <vector>
 
 
 namespace tinytcp {
 
-class ProtocolStack : public IProtocolStack, public TimerManager {
+// 每轮处理的包数按2的幂分桶: [1], [2, 3], [4, 7] ... 最后一个桶是 >= 2^(SIZE-1)
+#define NET_POLL_HIST_SIZE 8
+
+// drain_netif默认最多等多久
+#define NET_DRAIN_NETIF_TIMEOUT_MS 5000
+
+// 工作线程轮询网卡输入队列的统计, 用来调整每轮的预算
+struct net_poll_stat_t {
+    uint64_t rounds = 0;            // 处理了多少轮(一个网卡一次算一轮)
+    uint64_t pkts = 0;              // 处理的包数
+    uint64_t budget_exhausted = 0;  // 用完预算, 队列里还有包的轮数
+    uint64_t batch_hist[NET_POLL_HIST_SIZE] = {0};  // 每轮处理的包数分布
+    uint64_t spin_hit = 0;          // 消息队列空了之后, 自旋期间等到消息的次数
+    uint64_t park = 0;              // 自旋超时, 挂起等待的次数
+    uint64_t lane_msgs[NET_MSG_LANE_CNT] = {0};     // 每条通道处理的消息数
+    uint64_t lane_deferred[NET_MSG_LANE_CNT] = {0}; // 用完权重, 通道里还有消息留到下一轮的次数
+    uint64_t timers = 0;            // 执行的定时器回调数
+};
+
+// 协议栈分成tcp.work_thread_cnt个工作线程, 每个有自己的消息队列、定时器和轮询列表, 互相不共享状态
+// 收包时按流的哈希把包放到对应工作线程的输入队列(软件RSS), 一个流始终在同一个工作线程处理;
+// 工作线程之间只通过post_to_worker发消息, 不直接访问对方的数据
+class ProtocolStack : public IProtocolStack {
 
 public:
     ProtocolStack();
-    ~ProtocolStack() = default;
+    // 停止并等待所有工作线程退出, 没处理的消息放回内存池
+    ~ProtocolStack();
     net_err_t init()  override;
     net_err_t start() override;
 
     INetWork* get_network() const noexcept { return m_network.get(); }
 
-    void work_thread_func();
+    // 把有包的网卡加入轮询列表, 之后由poll_netifs处理
     net_err_t do_netif_in(exmsg_t* msg);
 
-    void on_timer_inserted_at_front() override;
+    // 等所有工作线程都不再引用netif之后返回: 输入队列中剩下的包释放掉, 不在轮询列表中, 也没有没处理的收包通知
+    // 调用之前要先停止往netif放包, 不能在工作线程中调用; 返回NET_ERR_OK之后就可以析构netif
+    // timeout_ms之内没等到返回NET_ERR_TIMEOUT, 协议栈正在停止返回NET_ERR_STATE, 这时工作线程可能还引用netif
+    net_err_t drain_netif(INetIF* netif, uint32_t timeout_ms = NET_DRAIN_NETIF_TIMEOUT_MS);
+
+    // 在worker工作线程中执行func, 不等待执行完成
+    net_err_t post_to_worker(uint32_t worker, Timer::Callback func) override;
+    // 当前线程是不是这个协议栈的第worker个工作线程
+    bool in_worker(uint32_t worker) const;
+    // 当前线程是第几个工作线程, 不是工作线程时返回0
+    static uint32_t get_current_worker();
+
+    // 当前工作线程的时间轮, 只能在工作线程中调用
+    TimerManager& get_timer_manager();
+    // 在工作线程中调用时, 定时器放在当前工作线程的时间轮上, 到期之后在同一个工作线程执行, 不加锁;
+    // 其他线程调用时通过控制通道交给第0个工作线程, 返回的Timer::ptr在任何线程都可以cancel/refresh/reset
+    Timer::ptr add_timer(uint64_t ms, Timer::Callback cb, bool recurring = false);
+    Timer::ptr add_condition_timer(uint64_t ms, std::function<void()> cb,
+                                   std::weak_ptr<void> weak_cond,
+                                   bool recurring = false);
+
+    // 所有工作线程的统计加在一起
+    void get_poll_stat(net_poll_stat_t& stat) const;
+    void get_poll_stat(uint32_t worker, net_poll_stat_t& stat) const;
 
 // 协议栈工作线程相关
+private:
+    // 工作线程的时间轮, 其他线程添加和操作定时器时通过post_to_worker转到这个工作线程
+    class WorkerTimerManager : public TimerManager {
+    public:
+        WorkerTimerManager(ProtocolStack* stack, uint32_t worker) : m_stack(stack), m_worker(worker) {}
+
+    protected:
+        bool in_owner_thread() const override { return m_stack->in_worker(m_worker); }
+        bool post(Timer::Callback cb) override {
+            return (int8_t)m_stack->post_to_worker(m_worker, std::move(cb)) >= 0;
+        }
+
+    private:
+        ProtocolStack* m_stack;
+        uint32_t m_worker;
+    };
+
+    struct Worker {
+        Worker(ProtocolStack* stack, uint32_t worker_id) : id(worker_id), timers(stack, worker_id) {}
+
+        uint32_t id = 0;
+        Thread::uptr thread;
+        std::deque<INetIF*> poll_list;   // 第id个输入队列有包的网卡, 只有这个工作线程访问
+        WorkerTimerManager timers;       // 这个工作线程的时间轮, 只有这个工作线程修改
+        std::vector<Timer::Callback> expired_cbs;  // 到期还没执行的回调, 复用内存
+        size_t expired_pos = 0;          // expired_cbs中下一个要执行的回调
+
+        // 轮询统计, 只有这个工作线程写
+        std::atomic<uint64_t> poll_rounds{0};
+        std::atomic<uint64_t> poll_pkts{0};
+        std::atomic<uint64_t> poll_budget_exhausted{0};
+        std::atomic<uint64_t> poll_batch_hist[NET_POLL_HIST_SIZE] = {};
+        std::atomic<uint64_t> spin_hit{0};
+        std::atomic<uint64_t> park{0};
+        std::atomic<uint64_t> lane_msgs[NET_MSG_LANE_CNT] = {};
+        std::atomic<uint64_t> lane_deferred[NET_MSG_LANE_CNT] = {};
+        std::atomic<uint64_t> timer_cbs{0};
+    };
+
+    void work_thread_func(Worker* worker);
+    // 从一条通道最多取weight个消息处理, 返回处理的数量
+    uint32_t drain_lane(Worker* worker, net_msg_lane_t lane, uint32_t weight);
+    // 推进时间轮, 最多执行weight个到期的回调, 没执行完的留到下一轮, 返回执行的数量
+    uint32_t run_timers(Worker* worker, uint32_t weight);
+    void handle_msg(exmsg_t* msg);
+    // 轮询列表中的每个网卡最多处理budget个包, 没处理完的放回队尾, 返回列表是否还有网卡
+    bool poll_netifs(Worker* worker);
+    // 处理一个网卡, 返回true表示用完了预算, 队列中还有包
+    bool poll_netif(Worker* worker, INetIF* netif, uint32_t budget);
+    // 按优先级从各条通道取一个消息
+    bool try_pop_msg(Worker* worker, exmsg_t** msg);
+    // 在tcp.work_spin_us时间内自旋等待消息
+    bool spin_pop_msg(Worker* worker, exmsg_t** msg);
+    // 挂起等待任意一条通道的消息, 最多等到下一个定时器到期
+    bool wait_pop_msg(Worker* worker, exmsg_t** msg, int timeout_ms);
+
 private:
     INetWork::uptr m_network;
-    Thread::uptr m_work_thread;
+    std::vector<std::unique_ptr<Worker>> m_workers;
+    std::atomic<bool> m_stopping{false};  // 析构时通知工作线程退出
 
-// 定时器相关
+// 函数消息相关, post_to_worker的消息从单独的内存池申请, 和收包通知互不影响
 public:
-    void timer_thread_init();
-    void timer_thread_func();
-    void tickle_event();
     exmsg_t* get_timer_msg_block();
     net_err_t release_timer_msg_block(exmsg_t* msg);
 private:
-    int m_epoll_fd;
-    int m_event_fd;
-    Thread::uptr m_timer_thread;
     MemBlock::uptr m_timer_mem_block = nullptr;
-    LockFreeRingQueue<exmsg_t*>::uptr m_timer_msg_queue = nullptr;
 
 };
 
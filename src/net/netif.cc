@@ -6,9 +6,12 @@
 #include "network.h"
 #include "link_layer.h"
 #include "protocol.h"
+#include "pktview.h"
+#include "flow_hash.h"
 #include "plat/sys_plat.h"
 #include "src/endiantool.h"
 #include <iomanip>
+#include <cstddef>
 
 
 namespace tinytcp {
@@ -19,6 +22,13 @@ static tinytcp::ConfigVar<uint32_t>::ptr g_netif_in_queue_size =
     tinytcp::Config::look_up("tcp.netif_in_queue_size", 1024U, "netif in queue size, 网卡输入队列的大小");
 static tinytcp::ConfigVar<uint32_t>::ptr g_netif_out_queue_size =
     tinytcp::Config::look_up("tcp.netif_out_queue_size", 1024U, "netif out queue size, 网卡输出队列的大小");
+// 输入队列从空变成非空时才发一个NETIF_IN消息, 关掉之后每个包发一个
+static tinytcp::ConfigVar<bool>::ptr g_netif_in_coalesce =
+    tinytcp::Config::look_up("tcp.netif_in_coalesce", true, "netif in coalesce, 合并网卡输入通知, 工作线程处理之前只发一个消息");
+static tinytcp::ConfigCache<bool> g_netif_in_coalesce_cache(g_netif_in_coalesce);
+// 每个输入队列只有收包线程写, 一个工作线程读; 输出队列只有一个工作线程时才是单生产者
+static tinytcp::ConfigVar<bool>::ptr g_netif_spsc_queue =
+    tinytcp::Config::look_up("tcp.netif_spsc_queue", true, "netif spsc queue, 网卡队列只有一个生产者和一个消费者时使用SPSC队列");
 
 std::ostream& operator<<(std::ostream& os, const netif_hwaddr_t& hwaddr) {
     for (uint8_t i = 0; i < hwaddr.len; ++i) {
@@ -33,14 +43,50 @@ std::ostream& operator<<(std::ostream& os, const netif_hwaddr_t& hwaddr) {
     return os;
 }
 
-INetIF::INetIF(INetWork* network, const char* name, void* ops_data)
+NetIFQueue::NetIFQueue(uint32_t size, bool spsc) {
+    if (spsc) {
+        m_spsc = std::make_unique<SpscRingQueue<PktBuffer*>>(size);
+    }
+    else {
+        m_mpmc = std::make_unique<LockFreeRingQueue<PktBuffer*>>(size);
+    }
+}
+
+uint32_t NetIFQueue::pop_burst(PktBuffer** bufs, uint32_t n, int timeout_ms) {
+    if (m_spsc) {
+        return m_spsc->pop_burst(bufs, n, timeout_ms);
+    }
+    uint32_t cnt = m_mpmc->pop_bulk(bufs, n);
+    if (cnt == 0U && n != 0U && timeout_ms != 0 && m_mpmc->pop(bufs, timeout_ms)) {
+        cnt = 1U + m_mpmc->pop_bulk(bufs + 1, n - 1U);
+    }
+    return cnt;
+}
+
+INetIF::INetIF(INetWork* network, const char* name, void* ops_data, bool in_multi_producer)
     : m_network(network)
     , m_state(NETIF_OPENED)
     , m_ops_data(ops_data) {
     set_name(name);
-    m_in_q = std::make_unique<LockFreeRingQueue<PktBuffer*>>(g_netif_in_queue_size->value());
-    TINYTCP_ASSERT2(m_in_q != nullptr, "m_in_q init error");
-    m_out_q = std::make_unique<LockFreeRingQueue<PktBuffer*>>(g_netif_out_queue_size->value());
+    init_queues(in_multi_producer);
+}
+
+void INetIF::init_queues(bool in_multi_producer) {
+    bool spsc = g_netif_spsc_queue->value();
+    uint32_t worker_cnt = 1;
+    if (m_network != nullptr && m_network->get_protocol_stack() != nullptr) {
+        worker_cnt = std::max(m_network->get_protocol_stack()->get_worker_cnt(), 1U);
+    }
+    m_in_qs.clear();
+    for (uint32_t i = 0; i < worker_cnt; ++i) {
+        auto in_q = std::make_unique<in_queue_t>();
+        // 只有一个工作线程时, 多个生产者也都是这个线程
+        in_q->queue = std::make_unique<NetIFQueue>(g_netif_in_queue_size->value(), spsc && !(in_multi_producer && worker_cnt > 1));
+        TINYTCP_ASSERT2(in_q->queue != nullptr, "m_in_qs init error");
+        m_in_qs.push_back(std::move(in_q));
+    }
+    // 多个工作线程都会往输出队列里放包
+    m_out_q = std::make_unique<NetIFQueue>(g_netif_out_queue_size->value(), spsc && worker_cnt == 1);
     TINYTCP_ASSERT2(m_out_q != nullptr, "m_out_q init error");
 }
 
@@ -61,7 +107,7 @@ void INetIF::debug_print() {
         << "\nmask=       " << m_netmask
         << "\ngateway=    " << m_gateway
         << "\nhwaddr=     " << m_hwaddr
-        << "\nin_q_size=  " << m_in_q->size()
+        << "\nin_q_size=  " << m_in_qs[0]->queue->size()
         << "\nhout_q_size=" << m_out_q->size()
         << "\n\n";
 }
@@ -103,26 +149,27 @@ void INetIF::set_name(const char* name) {
 
 void INetIF::clear_in_queue() {
     PktBuffer* pktbuf;
-    while (!m_in_q->is_empty()) {
-        m_in_q->pop(&pktbuf);
-        pktbuf->free();
+    for (auto& in_q : m_in_qs) {
+        while (in_q->queue->pop(&pktbuf, 0)) {
+            pktbuf->free();
+        }
     }
 }
 
 void INetIF::clear_out_queue() {
     PktBuffer* pktbuf;
     while (!m_out_q->is_empty()) {
-        m_out_q->pop(&pktbuf);
+        m_out_q->pop(&pktbuf, 0);
         pktbuf->free();
     }
 }
 
-PktBuffer* INetIF::get_buf_from_in_queue(int timeout_ms) {
+PktBuffer* INetIF::get_buf_from_in_queue(int timeout_ms, uint32_t queue) {
     PktBuffer* buf;
     if (timeout_ms < 0) {
         timeout_ms = -1;
     }
-    bool ok = m_in_q->pop(&buf, timeout_ms);
+    bool ok = m_in_qs[queue]->queue->pop(&buf, timeout_ms);
     if (ok) {
         buf->reset_access();
         return buf;
@@ -131,14 +178,64 @@ PktBuffer* INetIF::get_buf_from_in_queue(int timeout_ms) {
 }
 
 net_err_t INetIF::put_buf_to_in_queue(PktBuffer* buf, int timeout_ms) {
-    bool ok = m_in_q->push(buf, timeout_ms);
+    // 只有一个工作线程时不用算哈希
+    uint32_t queue = 0;
+    if (m_in_qs.size() > 1) {
+        queue = flow_hash_to_queue(rx_flow_hash(buf), (uint32_t)m_in_qs.size());
+    }
+    in_queue_t& in_q = *m_in_qs[queue];
+    bool ok = in_q.queue->push(buf, timeout_ms);
     if (ok) {
-        m_network->exmsg_netif_in(this);
+        if (!g_netif_in_coalesce_cache.value()) {
+            m_network->exmsg_netif_in(this, queue);
+        }
+        // 工作线程还没处理上一次的通知, 它会把这个包一起取走
+        // 用exchange和clear_in_pending配对, 保证工作线程清除标记之后一定能看到这个包
+        else if (!in_q.pending.exchange(true, std::memory_order_acq_rel)) {
+            if ((int8_t)m_network->exmsg_netif_in(this, queue) < 0) {
+                // 消息没发出去, 下一个包再试
+                in_q.pending.store(false, std::memory_order_release);
+            }
+        }
         return net_err_t::NET_ERR_OK;
     }
     return net_err_t::NET_ERR_FULL;
 }
 
+void INetIF::link_in_burst(PktBuffer** bufs, uint32_t n) {
+    // 包头大概率不在cache中, 分三遍预取 数据包描述符 -> 数据块描述符 -> 包头,
+    // 每一遍要读的指针在上一遍已经发出了预取, 处理前面的包时后面的已经在路上了
+    for (uint32_t i = 0; i < n; ++i) {
+        __builtin_prefetch(bufs[i]);
+    }
+    for (uint32_t i = 0; i < n; ++i) {
+        __builtin_prefetch(bufs[i]->get_first_blk());
+    }
+    for (uint32_t i = 0; i < n; ++i) {
+        PktBlock* blk = bufs[i]->get_first_blk();
+        if (blk != nullptr) {
+            __builtin_prefetch(blk->get_data());
+        }
+    }
+    for (uint32_t i = 0; i < n; ++i) {
+        net_err_t err = link_in(bufs[i]);
+        if ((int8_t)err < 0) {
+            TINYTCP_LOG_WARN(g_logger) << "netif link in error:" << magic_enum::enum_name(err);
+            bufs[i]->free();
+        }
+    }
+}
+
+bool INetIF::clear_in_pending(uint32_t queue) {
+    in_queue_t& in_q = *m_in_qs[queue];
+    in_q.pending.exchange(false, std::memory_order_acq_rel);
+    if (in_q.queue->is_empty()) {
+        return false;
+    }
+    // 清除之前收包线程又放进来了包, 如果它还没发新的通知, 就由当前线程接着处理
+    return !in_q.pending.exchange(true, std::memory_order_acq_rel);
+}
+
 PktBuffer* INetIF::get_buf_from_out_queue(int timeout_ms) {
     PktBuffer* buf;
     if (timeout_ms < 0) {
@@ -152,6 +249,22 @@ PktBuffer* INetIF::get_buf_from_out_queue(int timeout_ms) {
     return nullptr;
 }
 
+uint32_t INetIF::get_bufs_from_in_queue(PktBuffer** bufs, uint32_t n, int timeout_ms, uint32_t queue) {
+    uint32_t cnt = m_in_qs[queue]->queue->pop_burst(bufs, n, timeout_ms);
+    for (uint32_t i = 0; i < cnt; ++i) {
+        bufs[i]->reset_access();
+    }
+    return cnt;
+}
+
+uint32_t INetIF::get_bufs_from_out_queue(PktBuffer** bufs, uint32_t n, int timeout_ms) {
+    uint32_t cnt = m_out_q->pop_burst(bufs, n, timeout_ms);
+    for (uint32_t i = 0; i < cnt; ++i) {
+        bufs[i]->reset_access();
+    }
+    return cnt;
+}
+
 net_err_t INetIF::put_buf_to_out_queue(PktBuffer* buf, int timeout_ms) {
     bool ok = m_out_q->push(buf, timeout_ms);
     if (ok) {
@@ -180,9 +293,34 @@ net_err_t INetIF::netif_out(const ipaddr_t& ipaddr, PktBuffer* buf) {
     return net_err_t::NET_ERR_OK;
 }
 
-LoopNet::LoopNet(INetWork* network, const char* name, void* ops_data)
-    : INetIF(network, name, ops_data) {
+net_err_t INetIF::netif_in(PktBuffer* buf) {
+    // 输入队列满了直接丢包, 不能阻塞收包线程
+    net_err_t err = put_buf_to_in_queue(buf, 0);
+    if ((int8_t)err < 0) {
+        buf->free();
+    }
+    return err;
+}
 
+net_err_t INetIF::loopback_in(PktBuffer* buf) {
+    IProtocolStack* stack = m_network != nullptr ? m_network->get_protocol_stack() : nullptr;
+    if (stack == nullptr) {
+        return net_err_t::NET_ERR_STATE;
+    }
+    uint32_t worker = 0;
+    if (m_in_qs.size() > 1) {
+        worker = flow_hash_to_queue(rx_flow_hash(buf), (uint32_t)m_in_qs.size());
+    }
+    return stack->post_to_worker(worker, [this, buf]() {
+        PktBuffer* pkt = buf;
+        pkt->reset_access();
+        link_in_burst(&pkt, 1);
+    });
+}
+
+LoopNet::LoopNet(INetWork* network, const char* name, void* ops_data)
+    : INetIF(network, name, ops_data, true) {
+    // 环回的包由各个工作线程发出, 再放回输入队列
 }
 LoopNet::~LoopNet() {
 
@@ -210,6 +348,10 @@ net_err_t LoopNet::close() {
     return net_err_t::NET_ERR_OK;
 }
 
+uint32_t LoopNet::rx_flow_hash(const PktBuffer* buf) {
+    return ipv4_flow_hash(PktView(buf));
+}
+
 // 环回接口只用把接收到的数据重新放到输入队列即可
 net_err_t LoopNet::send() {
     PktBuffer* buf = get_buf_from_out_queue(0);
@@ -269,7 +411,7 @@ net_err_t EtherNet::send() {
     // return m_network->exmsg_netif_out(this);
 }
 
-static net_err_t is_pkt_ok(ether_pkt_t* frame, int total_size) {
+static net_err_t is_pkt_ok(int total_size) {
     if (total_size > (sizeof(ether_hdr_t) + ETHER_MTU)) {
         TINYTCP_LOG_WARN(g_logger) << "frame size too big, size=" << total_size;
         return net_err_t::NET_ERR_SIZE;
@@ -291,16 +433,22 @@ void EtherNet::link_close() {
 }
 
 net_err_t EtherNet::link_in(PktBuffer* buf) {
-    buf->set_cont_header(sizeof(ether_hdr_t));
-    ether_pkt_t* pkt = (ether_pkt_t*)buf->get_data();
-    net_err_t err = is_pkt_ok(pkt, buf->get_capacity());
+    net_err_t err = is_pkt_ok(buf->get_capacity());
     if ((int8_t)err < 0) {
         TINYTCP_LOG_WARN(g_logger) << "ether pkt error";
         return err;
     }
 
-    // debug_print_ether_pkt(*pkt, buf->get_capacity());
-    switch (net_to_host(pkt->hdr.protocol)) {
+    // 只读解析包头, 不修改数据包的读写状态, 也不搬移数据
+    PktView view(buf);
+    uint16_t protocol = 0;
+    // 包头不完整时丢掉, 由调用者释放
+    if (!view.read_be16(offsetof(ether_hdr_t, protocol), protocol)) {
+        TINYTCP_LOG_WARN(g_logger) << "ether pkt truncated, size=" << buf->get_capacity();
+        return net_err_t::NET_ERR_SIZE;
+    }
+    // debug_print_ether_pkt(*(ether_pkt_t*)view.span(0, sizeof(ether_hdr_t)), buf->get_capacity());
+    switch (protocol) {
         case NET_PROTOCOL_ARP: {
             TINYTCP_LOG_DEBUG(g_logger) << "get arp pkt";
             break;
@@ -318,6 +466,15 @@ net_err_t EtherNet::link_in(PktBuffer* buf) {
     return net_err_t::NET_ERR_OK;
 }
 
+uint32_t EtherNet::rx_flow_hash(const PktBuffer* buf) {
+    PktView view(buf);
+    uint16_t protocol = 0;
+    if (!view.read_be16(offsetof(ether_hdr_t, protocol), protocol) || protocol != NET_PROTOCOL_IPv4) {
+        return 0;
+    }
+    return ipv4_flow_hash(view.advance(sizeof(ether_hdr_t)));
+}
+
 net_err_t EtherNet::link_out(const ipaddr_t& ip, PktBuffer* buf) {
     if (m_ipaddr == ip) {
         net_err_t err = ether_raw_out(NET_PROTOCOL_ARP, ether_broadcast_addr(), buf);
@@ -381,7 +538,8 @@ net_err_t EtherNet::ether_raw_out(uint16_t protocol, const uint8_t* dest, PktBuf
     // test
 
     if (memcmp(m_hwaddr.addr, dest, ETHER_HWA_SIZE) == 0) {
-        return put_buf_to_in_queue(buf, 0);
+        // 在工作线程中发出, 不能放进收包线程独占的输入队列
+        return loopback_in(buf);
     }
     else {
         err = put_buf_to_out_queue(buf, 0);
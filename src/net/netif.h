@@ -4,9 +4,11 @@
 #include "net_err.h"
 #include "pktbuf.h"
 #include "src/lock_free_ring_queue.h"
+#include "src/spsc_ring_queue.h"
 #include "src/thread.h"
 #include "arp.h"
 #include <string.h>
+#include <vector>
 
 namespace tinytcp {
 
@@ -58,6 +60,36 @@ enum netif_type_t {
 
 class INetWork;
 
+// 网卡的输入/输出队列
+// 只有一个生产者线程和一个消费者线程时用SPSC队列, 交接一个包只是一次store; 否则用MPMC队列
+class NetIFQueue : Noncopyable {
+public:
+    using uptr = std::unique_ptr<NetIFQueue>;
+
+    NetIFQueue(uint32_t size, bool spsc);
+
+    bool is_spsc() const noexcept { return m_spsc != nullptr; }
+
+    bool push(PktBuffer* buf, int timeout_ms) {
+        return m_spsc ? m_spsc->push(buf, timeout_ms) : m_mpmc->push(buf, timeout_ms);
+    }
+    bool pop(PktBuffer** buf, int timeout_ms) {
+        return m_spsc ? m_spsc->pop(buf, timeout_ms) : m_mpmc->pop(buf, timeout_ms);
+    }
+    uint32_t push_burst(PktBuffer* const* bufs, uint32_t n) {
+        return m_spsc ? m_spsc->push_burst(bufs, n) : m_mpmc->push_bulk(bufs, n);
+    }
+    // 等待时只要有一个包就返回
+    uint32_t pop_burst(PktBuffer** bufs, uint32_t n, int timeout_ms);
+
+    uint32_t size() const noexcept { return m_spsc ? m_spsc->size() : m_mpmc->size(); }
+    bool is_empty() const noexcept { return size() == 0U; }
+
+private:
+    SpscRingQueue<PktBuffer*>::uptr m_spsc;
+    LockFreeRingQueue<PktBuffer*>::uptr m_mpmc;
+};
+
 // network interface, 不同的网卡协议有不同的实现
 class INetIF {
 
@@ -70,7 +102,8 @@ public:
 
 public:
 
-    INetIF(INetWork* network, const char* name, void* ops_data = nullptr);
+    // in_multi_producer: 输入队列有多个生产者(比如环回接口由各个工作线程放包), 不能用单生产者队列
+    INetIF(INetWork* network, const char* name, void* ops_data = nullptr, bool in_multi_producer = false);
     virtual ~INetIF();
 
     const char* get_name() const noexcept { return m_name; } 
@@ -94,21 +127,44 @@ public:
     void clear_out_queue();
 
     // 操作网卡队列
-    PktBuffer* get_buf_from_in_queue(int timeout_ms = -1);
+    // 输入队列每个工作线程一个, queue是队列的下标, 也就是处理它的工作线程
+    PktBuffer* get_buf_from_in_queue(int timeout_ms = -1, uint32_t queue = 0);
+    // 按流的哈希放入对应的输入队列, 同一个流的包总是由同一个工作线程处理
     net_err_t put_buf_to_in_queue(PktBuffer* buf, int timeout_ms = -1);
     PktBuffer* get_buf_from_out_queue(int timeout_ms = -1);
     net_err_t put_buf_to_out_queue(PktBuffer* buf, int timeout_ms = -1);
-    uint32_t get_in_queue_size() const noexcept { return m_in_q->size(); }
+    // 一次取出最多n个包, 返回取到的数量
+    uint32_t get_bufs_from_in_queue(PktBuffer** bufs, uint32_t n, int timeout_ms = 0, uint32_t queue = 0);
+    uint32_t get_bufs_from_out_queue(PktBuffer** bufs, uint32_t n, int timeout_ms = 0);
+    uint32_t get_in_queue_cnt() const noexcept { return (uint32_t)m_in_qs.size(); }
+    uint32_t get_in_queue_size(uint32_t queue = 0) const noexcept { return m_in_qs[queue]->queue->size(); }
+    // 工作线程取空输入队列之后调用, 清除通知标记, 返回true表示期间又有包进来, 需要接着处理
+    bool clear_in_pending(uint32_t queue = 0);
+    // 是否已经给工作线程发过收包通知, 还没处理完
+    bool is_in_pending(uint32_t queue = 0) const noexcept { return m_in_qs[queue]->pending.load(std::memory_order_acquire); }
+    // 是否在工作线程的轮询列表中, 只有对应的工作线程访问
+    bool is_in_polling(uint32_t queue = 0) const noexcept { return m_in_qs[queue]->polling; }
+    void set_in_polling(bool polling, uint32_t queue = 0) noexcept { m_in_qs[queue]->polling = polling; }
     uint32_t get_out_queue_size() const noexcept { return m_out_q->size(); }
 
     // 数据链路层操作
     virtual net_err_t link_open() { return net_err_t::NET_ERR_OK; }
     virtual void link_close() {}
     virtual net_err_t link_in(PktBuffer* buf) { return net_err_t::NET_ERR_OK; }
+    // 一次处理一批包, 先预取所有包头再逐个link_in, 处理失败的包在这里释放
+    virtual void link_in_burst(PktBuffer** bufs, uint32_t n);
     virtual net_err_t link_out(const ipaddr_t& ip, PktBuffer* buf) { return net_err_t::NET_ERR_OK; }
+    // 数据包所属流的哈希, 用来选输入队列; 不能解析的包返回0, 都交给第一个工作线程
+    virtual uint32_t rx_flow_hash(const PktBuffer* buf) { return 0; }
 
     // 把数据包发送给指定地址
     net_err_t netif_out(const ipaddr_t& ipaddr, PktBuffer* buf);
+    // 工作线程发给本网卡自己的包, 通过消息交给处理这个流的工作线程link_in
+    // 输入队列可能是收包线程独占的单生产者队列, 其他线程不能放; 失败时不释放数据包
+    net_err_t loopback_in(PktBuffer* buf);
+    // 收包线程把数据包交给协议栈, 失败时释放数据包
+    // 放入处理这个流的工作线程的输入队列, 由工作线程link_in
+    net_err_t netif_in(PktBuffer* buf);
 
     void debug_print();
 
@@ -118,6 +174,10 @@ public:
     virtual net_err_t close();
     virtual net_err_t send() { return net_err_t::NET_ERR_OK; }
 
+protected:
+    // 按工作线程的数量创建队列, in_multi_producer表示输入队列有多个生产者
+    void init_queues(bool in_multi_producer);
+
 protected:
     Thread::uptr m_recv_thread = nullptr;
     Thread::uptr m_send_thread = nullptr;
@@ -137,8 +197,16 @@ protected:
 
     NETIF_STATE m_state;
 
-    LockFreeRingQueue<PktBuffer*>::uptr m_in_q;
-    LockFreeRingQueue<PktBuffer*>::uptr m_out_q;
+    // 一个工作线程的输入队列和通知状态
+    struct in_queue_t {
+        NetIFQueue::uptr queue;
+        // 已经给工作线程发过NETIF_IN消息, 还没处理完; 单独一条cache line, 收包线程每个包都会访问
+        alignas(64) std::atomic<bool> pending{false};
+        bool polling = false;
+    };
+
+    std::vector<std::unique_ptr<in_queue_t>> m_in_qs;
+    NetIFQueue::uptr m_out_q;
 };
 
 net_err_t ipaddr_from_str(ipaddr_t& dest, const char* str);
@@ -152,6 +220,9 @@ public:
     net_err_t close() override;
     net_err_t send() override;
 
+    // 环回的包从IPv4包头开始
+    uint32_t rx_flow_hash(const PktBuffer* buf) override;
+
 private:
 
 };
@@ -169,6 +240,7 @@ public:
     void link_close() override;
     net_err_t link_in(PktBuffer* buf) override;
     net_err_t link_out(const ipaddr_t& ip, PktBuffer* buf) override;
+    uint32_t rx_flow_hash(const PktBuffer* buf) override;
 
     net_err_t ether_raw_out(uint16_t protocol, const uint8_t* dest, PktBuffer* buf);
     net_err_t make_arp_request(const ipaddr_t& dest);
@@ -3,13 +3,26 @@
 #include "src/log.h"
 #include "macro.h"
 #include "plat/sys_plat.h"
+#include "src/config.h"
+#include <errno.h>
+#include <string.h>
+#include <sys/uio.h>
+#include <vector>
 
 namespace tinytcp {
 
+// 一个数据包最多导出多少个iovec, 超过时退回到拷贝发送
+#define PCAP_SEND_IOV_MAX 64
+// 发包线程一次从输出队列取出的包数
+#define PCAP_SEND_BURST 32
+
 std::map<std::string, INetWork::NetIFFactoryFunc> INetWork::s_netif_factory_registry;
 
 static tinytcp::Logger::ptr g_logger = TINYTCP_LOG_NAME("system");
 
+static tinytcp::ConfigVar<bool>::ptr g_pcap_send_writev =
+    tinytcp::Config::look_up("tcp.pcap_send_writev", true, "pcap send writev, 发送时把数据块直接writev到pcap的socket上, 不拷贝数据");
+
 INetWork::INetWork(IProtocolStack* protocal_stack)
     : m_protocal_stack(protocal_stack) {
 
@@ -43,7 +56,7 @@ std::list<INetIF*>::iterator INetWork::find_netif_by_name(const std::string& nam
     return m_netif_list.end();
 }
 
-net_err_t INetWork::exmsg_netif_in(INetIF* netif) {
+net_err_t INetWork::exmsg_netif_in(INetIF* netif, uint32_t queue) {
     TINYTCP_LOG_DEBUG(g_logger) << "exmsg netif in";
     exmsg_t* msg = m_protocal_stack->get_msg_block();
     if (msg == nullptr) {
@@ -52,11 +65,12 @@ net_err_t INetWork::exmsg_netif_in(INetIF* netif) {
     }
     static uint32_t id = 0U;
     msg->type = exmsg_t::EXMSGTYPE::NET_EXMSG_NETIF_IN;
-    msg->netif = msg_netif_t(netif);
+    msg->netif = msg_netif_t(netif, queue);
     // msg->data.emplace<msg_netif_t>(netif);
     // msg->data = msg_netif_t(netif);
 
-    net_err_t err = msg_send(msg, 0);
+    // 输入队列和工作线程一一对应
+    net_err_t err = msg_send(msg, 0, queue);
     if ((int)err < 0) {
         TINYTCP_LOG_WARN(g_logger) << "msg_send error, msg_queue is full";
         m_protocal_stack->release_msg_block(msg);
@@ -119,10 +133,8 @@ INetIF* INetWork::netif_open(const char* dev_name, void* ops_data) {
     return inetif_ptr;
 }
 
-net_err_t INetWork::msg_send(exmsg_t* msg, int32_t timeout_ms) {
-    m_protocal_stack->push_msg(msg, timeout_ms);
-
-    return net_err_t::NET_ERR_OK;
+net_err_t INetWork::msg_send(exmsg_t* msg, int32_t timeout_ms, uint32_t worker) {
+    return m_protocal_stack->push_msg(msg, timeout_ms, worker);
 }
 
 
@@ -234,17 +246,19 @@ void PcapNetWork::recv_func(void* arg) {
             TINYTCP_LOG_WARN(g_logger) << "get_pktbuffer == nullptr";
             continue;
         }
-        bool ok = buf->alloc(pkthdr->len);
+        // 帧放在预留的headroom之后并且整帧连续, link_in解析包头时不需要再搬移数据
+        bool ok = buf->alloc_rx(pkthdr->len);
         if (!ok) {
             TINYTCP_LOG_WARN(g_logger) << "buf alloc error";
+            buf->free();
             continue;
         }
         buf->reset_access();
         buf->write(pkt_data, pkthdr->len);
 
-        if ((int8_t)netif->put_buf_to_in_queue(buf) < 0) {
-            TINYTCP_LOG_WARN(g_logger) << "put buf error";
-            buf->free();
+        // 放入输入队列, 失败时数据包已经被释放
+        if ((int8_t)netif->netif_in(buf) < 0) {
+            TINYTCP_LOG_WARN(g_logger) << "netif in error";
             continue;
         }
     }
@@ -252,31 +266,64 @@ void PcapNetWork::recv_func(void* arg) {
     TINYTCP_LOG_ERROR(g_logger) << "PcapNetWork recv end";
 }
 
+// 发送一个数据包, 优先把数据块直接writev到pcap底层的socket上, 不能用或者writev失败时拷贝到连续内存再pcap_inject
+// socket不支持writev(EINVAL, EOPNOTSUPP)时把fd置为-1, 这个网卡之后都走pcap_inject
+static net_err_t pcap_send_buf(pcap_t* pcap, int& fd, PktBuffer* buf, std::vector<uint8_t>& linear_buf) {
+    uint32_t total_size = buf->get_capacity();
+    if (fd >= 0) {
+        struct iovec iov[PCAP_SEND_IOV_MAX];
+        int iov_cnt = buf->get_iovec(iov, PCAP_SEND_IOV_MAX);
+        if (iov_cnt > 0) {
+            ssize_t n = writev(fd, iov, iov_cnt);
+            if (n >= 0) {
+                TINYTCP_LOG_DEBUG(g_logger) << "writev send successfully, size=" << n << ", iov_cnt=" << iov_cnt;
+                return net_err_t::NET_ERR_OK;
+            }
+            int err = errno;
+            TINYTCP_LOG_WARN(g_logger) << "writev error: " << strerror(err) << ", send size=" << total_size << ", use pcap_inject";
+            if (err == EINVAL || err == EOPNOTSUPP) {
+                TINYTCP_LOG_WARN(g_logger) << "writev not supported on fd=" << fd << ", disable writev";
+                fd = -1;
+            }
+        }
+    }
+
+    if (linear_buf.size() < total_size) {
+        linear_buf.resize(total_size);
+    }
+    buf->reset_access();
+    buf->read(linear_buf.data(), total_size);
+    if (pcap_inject(pcap, linear_buf.data(), total_size) == -1) {
+        TINYTCP_LOG_ERROR(g_logger) << "pcap_inject error: " << pcap_geterr(pcap) << ", send size=" << total_size;
+        return net_err_t::NET_ERR_IO;
+    }
+    TINYTCP_LOG_DEBUG(g_logger) << "pcap_inject send successfully, data=" << std::make_pair(std::string((const char*)linear_buf.data(), total_size), true);
+    return net_err_t::NET_ERR_OK;
+}
+
 void PcapNetWork::send_func(void* arg) {
     TINYTCP_LOG_INFO(g_logger) << "PcapNetWork send begin";
     INetIF* netif = static_cast<INetIF*>(arg);
     pcap_t* pcap = (pcap_t*)netif->get_ops_data();
-    auto pktmgr = PktMgr::get_instance();
 
-    // 以太网协议, 数据缓冲区:1500, 目的地址:6, 源地址:6, 类型:2 
-    static uint8_t rw_buffer[1500 + 6 + 6 + 2]; // 最后还有4个字节的校验位，网卡会自动填充, 代码中不用管
+    // linux上pcap底层是绑定到网卡的AF_PACKET socket, pcap_inject也只是对它send, 这里直接writev
+    int fd = g_pcap_send_writev->value() ? pcap_get_selectable_fd(pcap) : -1;
+    TINYTCP_LOG_INFO(g_logger) << "PcapNetWork send fd=" << fd << (fd < 0 ? ", use pcap_inject" : ", use writev");
+    // 退回到拷贝发送时用的连续内存, 按需扩大, 不限制帧长
+    // 最后还有4个字节的校验位，网卡会自动填充, 代码中不用管
+    std::vector<uint8_t> linear_buf(ETHER_MTU + sizeof(ether_hdr_t));
+    PktBuffer* bufs[PCAP_SEND_BURST];
+    uint64_t dropped = 0;
     while (true) {
-        PktBuffer* buf = netif->get_buf_from_out_queue(0);
-        if (buf == nullptr) {
-            continue;
-        }
-
-        uint32_t total_size = buf->get_capacity();
-        buf->reset_access();
-        memset(rw_buffer, 0, sizeof(rw_buffer));
-        buf->read(rw_buffer, total_size);
-        buf->free();
-
-        if (pcap_inject(pcap, rw_buffer, total_size) == -1) {
-            TINYTCP_LOG_ERROR(g_logger) << "pcap_inject error: " << pcap_geterr(pcap) << ", send size=" << total_size;
-        }
-        else {
-            TINYTCP_LOG_DEBUG(g_logger) << "pcap_inject send successfully, data=" << std::make_pair(std::string((const char*)rw_buffer, total_size), true);
+        // 没有要发送的包时挂起, 有包入队时被唤醒, 一次取出一批
+        uint32_t cnt = netif->get_bufs_from_out_queue(bufs, PCAP_SEND_BURST, -1);
+        for (uint32_t i = 0; i < cnt; ++i) {
+            if ((int8_t)pcap_send_buf(pcap, fd, bufs[i], linear_buf) < 0) {
+                ++dropped;
+                TINYTCP_LOG_WARN(g_logger) << "netif " << netif->get_name() << " send error, drop pkt, size="
+                                           << bufs[i]->get_capacity() << ", dropped=" << dropped;
+            }
+            bufs[i]->free();
         }
     }
 }
@@ -25,9 +25,9 @@ public:
 
 public:
     // 把接收到的数据放入协议栈的消息队列中，并设置等待时间
-    net_err_t msg_send(exmsg_t* msg, int32_t timeout_ms);
-    // 接收网卡数据
-    net_err_t exmsg_netif_in(INetIF* netif);
+    net_err_t msg_send(exmsg_t* msg, int32_t timeout_ms, uint32_t worker = 0);
+    // 接收网卡数据, 通知网卡第queue个输入队列所属的工作线程
+    net_err_t exmsg_netif_in(INetIF* netif, uint32_t queue = 0);
     // 把数据从网卡中发出, 具体调用哪个库就交给子类去实现
     virtual net_err_t exmsg_netif_out(INetIF* netif) = 0;
 
@@ -38,6 +38,7 @@ public:
     net_err_t set_deactive(INetIF* netif);
 
     void set_default(INetIF* netif) noexcept { m_default_netif = netif; }
+    IProtocolStack* get_protocol_stack() const noexcept { return m_protocal_stack; }
 
     PktBuffer* get_buf_from_in_queue(NetListIt netif_it, int timeout_ms = -1);
     net_err_t put_buf_to_in_queue(NetListIt netif_it, PktBuffer* buf, int timeout_ms = -1);
@@ -2,39 +2,62 @@
 #include "src/config.h"
 #include "src/macro.h"
 #include <algorithm>
+#include <tuple>
 
 namespace tinytcp {
 
 static tinytcp::Logger::ptr g_logger = TINYTCP_LOG_NAME("system");
 
-static tinytcp::ConfigVar<uint32_t>::ptr g_pktbuf_blk_size =
-    tinytcp::Config::look_up("tcp.pktbuf_blk_size", 1024U, "tcp pktbuf block size, 单个数据块的内存空间大小");
-static tinytcp::ConfigVar<uint32_t>::ptr g_pktbuf_blk_cnt =
-    tinytcp::Config::look_up("tcp.pktbuf_blk_cnt", 1024U, "tcp pktbuf block cnt, 协议栈中数据块的数量");
+// 数据块按大小分成几个等级: 小包(ARP, 纯ACK), 一个MTU的以太网帧, 巨型帧
+static tinytcp::ConfigVar<std::vector<uint32_t> >::ptr g_pktbuf_blk_sizes =
+    tinytcp::Config::look_up("tcp.pktbuf_blk_sizes", std::vector<uint32_t>{256U, 2048U, 9216U},
+                             "tcp pktbuf block sizes, 每个尺寸等级中单个数据块的内存空间大小");
+static tinytcp::ConfigVar<std::vector<uint32_t> >::ptr g_pktbuf_blk_cnts =
+    tinytcp::Config::look_up("tcp.pktbuf_blk_cnts", std::vector<uint32_t>{1024U, 1024U, 64U},
+                             "tcp pktbuf block cnts, 每个尺寸等级中数据块的数量, 和blk_sizes一一对应");
+// 池子不够用时按块扩充, 最多扩到max_cnts, 长度和blk_sizes对不上时不扩充
+static tinytcp::ConfigVar<std::vector<uint32_t> >::ptr g_pktbuf_blk_max_cnts =
+    tinytcp::Config::look_up("tcp.pktbuf_blk_max_cnts", std::vector<uint32_t>{4096U, 4096U, 256U},
+                             "tcp pktbuf block max cnts, 每个尺寸等级中数据块最多能扩充到的数量, 和blk_sizes一一对应");
+static tinytcp::ConfigVar<uint32_t>::ptr g_pktbuf_desc_cnt =
+    tinytcp::Config::look_up("tcp.pktbuf_desc_cnt", 1024U, "tcp pktbuf desc cnt, 共享payload时使用的数据块描述符数量");
 static tinytcp::ConfigVar<uint32_t>::ptr g_pktbuf_buf_cnt =
-    tinytcp::Config::look_up("tcp.pktbuf_blk_cnt", 1024U, "tcp pktbuf buffer cnt, 协议栈中数据包的数量");
+    tinytcp::Config::look_up("tcp.pktbuf_buf_cnt", 1024U, "tcp pktbuf buffer cnt, 协议栈中数据包的数量");
+static tinytcp::ConfigVar<uint32_t>::ptr g_pktbuf_buf_max_cnt =
+    tinytcp::Config::look_up("tcp.pktbuf_buf_max_cnt", 4096U, "tcp pktbuf buffer max cnt, 数据包池子最多能扩充到的数量");
+static tinytcp::ConfigVar<uint32_t>::ptr g_pktbuf_rx_headroom =
+    tinytcp::Config::look_up("tcp.pktbuf_rx_headroom", 64U, "tcp pktbuf rx headroom, 收包时帧前面预留的空间");
+static tinytcp::ConfigVar<uint32_t>::ptr g_pktbuf_tx_headroom =
+    tinytcp::Config::look_up("tcp.pktbuf_tx_headroom", 128U, "tcp pktbuf tx headroom, 组包时给以太网/IP/TCP包头预留的空间");
+// 每次收发包都会读取, 缓存起来避免每次都拿配置的读写锁
+static tinytcp::ConfigCache<uint32_t> g_pktbuf_rx_headroom_cache(g_pktbuf_rx_headroom);
+static tinytcp::ConfigCache<uint32_t> g_pktbuf_tx_headroom_cache(g_pktbuf_tx_headroom);
 
 
+// 描述符只占一条cache line, 描述符池和payload前面都不浪费空间
+static_assert(PktBlock::header_size() == PKTBUF_CACHE_LINE_SIZE, "PktBlock should fit in one cache line");
+
 PktBlock::PktBlock() {
 }
 
-void PktBlock::init() {
-    m_payload = new uint8_t[g_pktbuf_blk_size->value()];
-    TINYTCP_ASSERT2(m_payload != nullptr, "pktbuf block payload new error");
+void PktBlock::init(uint32_t capacity, uint8_t blk_class) {
+    m_capacity = capacity;
+    m_class = blk_class;
+    m_payload = (uint8_t*)this + header_size();
+    reset();
 }
 
 void PktBlock::reset() {
+    m_ref.store(1, std::memory_order_relaxed);
+    m_owner = this;
     m_data = m_payload;
     m_size = 0;
-}
-
-
-PktBlock::~PktBlock() {
-    delete[] m_payload;
+    m_next = nullptr;
+    m_prev = nullptr;
 }
 
 uint64_t const PktBlock::get_last_size() const noexcept {
-    uint64_t last_size = (uint64_t)(m_payload + g_pktbuf_blk_size->value() - (m_data + m_size));
+    uint64_t last_size = (uint64_t)(m_payload + m_capacity - (m_data + m_size));
     return last_size;
 }
 
@@ -55,117 +78,326 @@ void PktBuffer::reset() {
 }
 
 uint8_t* PktBuffer::get_data() {
-    if (m_blk_list.empty()) {
+    if (m_first == nullptr) {
         return nullptr;
     }
-    return m_blk_list.front()->get_data();
+    return m_first->get_data();
 }
 
 void PktBuffer::reset_access() {
     m_pos = 0;
-    m_cur_blk = m_blk_list.end();
+    m_cur_blk = m_first;
     m_blk_offset = nullptr;
-    if (!m_blk_list.empty()) {
-        m_cur_blk = m_blk_list.begin();
-        m_blk_offset = (*m_cur_blk)->get_data();
+    if (m_cur_blk != nullptr) {
+        m_blk_offset = m_cur_blk->get_data();
     }
 }
 
 PktBuffer::~PktBuffer() {
     // 把资源交还给管理器
+    release_chain(m_first);
+}
+
+void PktBuffer::link_front(PktBlock* first, PktBlock* last, uint32_t cnt) {
+    first->m_prev = nullptr;
+    last->m_next = m_first;
+    if (m_first != nullptr) {
+        m_first->m_prev = last;
+    }
+    else {
+        m_last = last;
+    }
+    m_first = first;
+    m_blk_cnt += cnt;
+}
+
+void PktBuffer::link_back(PktBlock* first, PktBlock* last, uint32_t cnt) {
+    last->m_next = nullptr;
+    first->m_prev = m_last;
+    if (m_last != nullptr) {
+        m_last->m_next = first;
+    }
+    else {
+        m_first = first;
+    }
+    m_last = last;
+    m_blk_cnt += cnt;
+}
+
+void PktBuffer::unlink(PktBlock* blk) {
+    if (blk->m_prev != nullptr) {
+        blk->m_prev->m_next = blk->m_next;
+    }
+    else {
+        m_first = blk->m_next;
+    }
+    if (blk->m_next != nullptr) {
+        blk->m_next->m_prev = blk->m_prev;
+    }
+    else {
+        m_last = blk->m_prev;
+    }
+    blk->m_next = nullptr;
+    blk->m_prev = nullptr;
+    --m_blk_cnt;
+}
+
+void PktBuffer::replace(PktBlock* blk, PktBlock* new_blk) {
+    new_blk->m_prev = blk->m_prev;
+    new_blk->m_next = blk->m_next;
+    if (blk->m_prev != nullptr) {
+        blk->m_prev->m_next = new_blk;
+    }
+    else {
+        m_first = new_blk;
+    }
+    if (blk->m_next != nullptr) {
+        blk->m_next->m_prev = new_blk;
+    }
+    else {
+        m_last = new_blk;
+    }
+    blk->m_next = nullptr;
+    blk->m_prev = nullptr;
+    if (m_cur_blk == blk) {
+        m_blk_offset = new_blk->get_data() + (m_blk_offset - blk->get_data());
+        m_cur_blk = new_blk;
+    }
+}
+
+PktBlock* PktBuffer::unshare_blk(PktBlock* blk) {
+    if (!blk->is_shared()) {
+        return blk;
+    }
+
     auto pktmgr = PktMgr::get_instance();
-    for (auto& blk : m_blk_list) {
-        pktmgr->release_pktblock(blk);
+    PktBlock* new_blk = pktmgr->get_pktblock(blk->get_capacity());
+    if (new_blk == nullptr || new_blk->get_capacity() < blk->get_size()) {
+        TINYTCP_LOG_WARN(g_logger) << "unshare blk error, no free blk";
+        if (new_blk != nullptr) {
+            pktmgr->release_pktblock(new_blk);
+        }
+        return nullptr;
+    }
+    // 尽量保持数据在payload中的偏移, 这样headroom/tailroom不会变
+    uint32_t offset = (uint32_t)(blk->get_data() - blk->get_payload());
+    if (offset + blk->get_size() > new_blk->get_capacity()) {
+        offset = new_blk->get_capacity() - blk->get_size();
+    }
+    new_blk->set_data(new_blk->get_payload() + offset);
+    new_blk->set_size(blk->get_size());
+    memcpy(new_blk->get_data(), blk->get_data(), blk->get_size());
+
+    replace(blk, new_blk);
+    pktmgr->release_pktblock(blk);
+    return new_blk;
+}
+
+bool PktBuffer::cur_blk_writable() {
+    if (TINYTCP_LICKLY(!m_cur_blk->is_shared())) {
+        return true;
+    }
+    return unshare_blk(m_cur_blk) != nullptr;
+}
+
+void PktBuffer::release_chain(PktBlock* first) {
+    if (first != nullptr) {
+        PktMgr::get_instance()->release_pktblock_chain(first);
     }
 }
 
 bool PktBuffer::alloc(uint32_t size, bool alloc_front, bool insert_front) {
-    std::vector<PktBlock*> blk_list; // 先把分配出来的指针存起来，方便出问题后销毁
-    uint32_t _size = size;
-    m_capacity += _size;
-    m_ref = 1;
+    // 先在局部串成一条链，出问题时整条链直接还回去，不需要额外的容器
+    PktBlock* chain_first = nullptr;
+    PktBlock* chain_last = nullptr;
+    uint32_t chain_cnt = 0;
     auto pktmgr = PktMgr::get_instance();
-    PktBlock* first_block = nullptr;
-    while (size) {
-        PktBlock* blk = pktmgr->get_pktblock();
+    m_ref = 1;
+    if (size == 0) {
+        reset_access();
+        return true;
+    }
+
+    // 比最大等级还大的包需要多个最大等级的块, 这部分成批从池子里取
+    PktBlock* bulk[PKTBUF_BULK_MAX];
+    uint32_t bulk_cnt = 0;
+    uint32_t bulk_pos = 0;
+    uint32_t max_size = pktmgr->get_max_blk_size();
+
+    uint32_t remain = size;
+    while (remain) {
+        if (bulk_pos == bulk_cnt && remain / max_size > 1) {
+            bulk_cnt = pktmgr->get_pktblock_bulk(max_size, bulk, std::min(remain / max_size, (uint32_t)PKTBUF_BULK_MAX));
+            bulk_pos = 0;
+        }
+        // 每次按剩余大小选最合适的等级, 常见的帧一个数据块就能装下
+        PktBlock* blk = bulk_pos < bulk_cnt ? bulk[bulk_pos++] : pktmgr->get_pktblock(remain);
         if (blk == nullptr) {
             TINYTCP_LOG_WARN(g_logger) << "PktBuffer::alloc error, no free buf";
-            for (auto& one_blk : blk_list) {
-                pktmgr->release_pktblock(one_blk);
-            }
-            m_capacity -= _size;
+            release_chain(chain_first);
             return false;
         }
-        blk_list.push_back(blk);
 
-        uint32_t cur_size = std::min(size, g_pktbuf_blk_size->value());
+        uint32_t cur_size = std::min(remain, blk->get_capacity());
         blk->set_size(cur_size);
         if (alloc_front) {
-            first_block = blk;
-            // 头插法时的数据地址位置是不一样的
-            blk->set_data(blk->get_payload() + g_pktbuf_blk_size->value() - cur_size);
+            // 头插法时的数据地址位置是不一样的, 最后分配的(最小的)块放在最前面, 前面留出空间方便加包头
+            blk->set_data(blk->get_payload() + blk->get_capacity() - cur_size);
+            blk->m_next = chain_first;
+            if (chain_first != nullptr) {
+                chain_first->m_prev = blk;
+            }
+            else {
+                chain_last = blk;
+            }
+            chain_first = blk;
         }
         else {
-            if (first_block == nullptr) {
-                first_block = blk;
-            }
             blk->set_data(blk->get_payload());
+            blk->m_prev = chain_last;
+            if (chain_last != nullptr) {
+                chain_last->m_next = blk;
+            }
+            else {
+                chain_first = blk;
+            }
+            chain_last = blk;
         }
-        size -= cur_size;
+        ++chain_cnt;
+        remain -= cur_size;
     }
 
-    // 分配出来的链表，根据insert_front判断放到m_blk_list哪里
+    // 分配出来的链，根据insert_front判断放到数据包的哪里
     if (insert_front) {
-        if (alloc_front) {
-            for (auto it = blk_list.begin(); it != blk_list.end(); ++it) {
-                m_blk_list.push_front(*it);
-            }
-        }
-        else {
-            for (auto it = blk_list.rbegin(); it != blk_list.rend(); ++it) {
-                m_blk_list.push_front(*it);
-            }
-        }
+        link_front(chain_first, chain_last, chain_cnt);
     }
     else {
-        if (alloc_front) {
-            for (auto it = blk_list.rbegin(); it != blk_list.rend(); ++it) {
-                m_blk_list.push_back(*it);
-            }
-        }
-        else {
-            for (auto it = blk_list.begin(); it != blk_list.end(); ++it) {
-                m_blk_list.push_back(*it);
-            }
+        link_back(chain_first, chain_last, chain_cnt);
+    }
+    m_capacity += size;
+
+    reset_access();
+    return true;
+}
+
+PktBuffer* PktBuffer::clone() {
+    auto pktmgr = PktMgr::get_instance();
+    PktBuffer* buf = pktmgr->get_pktbuffer();
+    if (buf == nullptr) {
+        TINYTCP_LOG_WARN(g_logger) << "clone error, no free buf";
+        return nullptr;
+    }
+
+    for (PktBlock* blk = m_first; blk != nullptr; blk = blk->m_next) {
+        PktBlock* ref_blk = pktmgr->get_ref_pktblock(blk);
+        if (ref_blk == nullptr) {
+            TINYTCP_LOG_WARN(g_logger) << "clone error, no free desc";
+            buf->free();
+            return nullptr;
         }
+        buf->link_back(ref_blk, ref_blk, 1);
     }
+    buf->m_capacity = m_capacity;
+    buf->reset_access();
+    return buf;
+}
 
+bool PktBuffer::alloc_with_room(uint32_t size, uint32_t headroom, uint32_t tailroom) {
+    auto pktmgr = PktMgr::get_instance();
+    m_ref = 1;
+    if (size == 0) {
+        reset_access();
+        return true;
+    }
+
+    PktBlock* blk = pktmgr->get_pktblock(headroom + size + tailroom);
+    if (blk == nullptr) {
+        TINYTCP_LOG_WARN(g_logger) << "PktBuffer::alloc_with_room error, no free buf";
+        return false;
+    }
+    // 拿到的块可能比要求的小(最合适的等级用完了), 优先保证headroom, 放不下的数据接到后面的块中
+    if (headroom >= blk->get_capacity()) {
+        headroom = 0;
+    }
+    uint32_t cur_size = std::min(size, blk->get_capacity() - headroom);
+    blk->set_data(blk->get_payload() + headroom);
+    blk->set_size(cur_size);
+
+    link_back(blk, blk, 1);
+    m_capacity += cur_size;
+    if (cur_size < size && !alloc(size - cur_size, false, false)) {
+        unlink(blk);
+        m_capacity -= cur_size;
+        pktmgr->release_pktblock(blk);
+        return false;
+    }
+
+    reset_access();
+    return true;
+}
+
+bool PktBuffer::alloc_rx(uint32_t size) {
+    return alloc_with_room(size, g_pktbuf_rx_headroom_cache.value());
+}
+
+bool PktBuffer::alloc_tx(uint32_t size, uint32_t tailroom) {
+    return alloc_with_room(size, g_pktbuf_tx_headroom_cache.value(), tailroom);
+}
+
+bool PktBuffer::attach_ext(uint8_t* data, uint32_t size, const pktblk_ext_t* ext) {
+    if (data == nullptr || size == 0 || ext == nullptr || ext->free_func == nullptr) {
+        TINYTCP_LOG_ERROR(g_logger) << "attach ext error param";
+        return false;
+    }
+    PktBlock* blk = PktMgr::get_instance()->get_ext_pktblock(data, size, ext);
+    if (blk == nullptr) {
+        TINYTCP_LOG_WARN(g_logger) << "attach ext error, no free desc";
+        return false;
+    }
+    link_back(blk, blk, 1);
+    m_capacity += size;
     reset_access();
     return true;
 }
 
+uint32_t PktBuffer::get_headroom() const noexcept {
+    if (m_first == nullptr) {
+        return 0;
+    }
+    return (uint32_t)(m_first->get_data() - m_first->get_payload());
+}
+
+uint32_t PktBuffer::get_tailroom() const noexcept {
+    if (m_last == nullptr) {
+        return 0;
+    }
+    return (uint32_t)m_last->get_last_size();
+}
+
 bool PktBuffer::free() {
     if ((--m_ref) == 0) {
         auto pktmgr = PktMgr::get_instance();
-        while (!m_blk_list.empty()) {
-            auto blk = m_blk_list.front();
-            m_blk_list.pop_front();
-            pktmgr->release_pktblock(blk);
-        }
-        pktmgr->release_pktbuffer(this);
+        release_chain(m_first);
+        m_first = nullptr;
+        m_last = nullptr;
+        m_blk_cnt = 0;
+        m_cur_blk = nullptr;
         m_capacity = 0;
+        // 放回内存池之后可能马上被其他线程分配出去, 不能再访问
+        pktmgr->release_pktbuffer(this);
     }
     return true;
 }
 
 net_err_t PktBuffer::alloc_header(uint32_t size, bool is_cont) {
-    if (m_blk_list.size() == 0) {
-        TINYTCP_LOG_ERROR(g_logger) << "add header error, m_blk_list is empty";
+    if (m_first == nullptr) {
+        TINYTCP_LOG_ERROR(g_logger) << "add header error, blk chain is empty";
         return net_err_t::NET_ERR_EMPTY;
     }
 
-    auto first_block = m_blk_list.front();
-    uint64_t pre_size  = (uint64_t)(first_block->get_data() - first_block->get_payload());
+    auto first_block = m_first;
+    // payload被共享时, 前面的空间别的数据包也可能在用, 不能原地加包头
+    uint64_t pre_size  = first_block->is_shared() ? 0 : (uint64_t)(first_block->get_data() - first_block->get_payload());
     // 剩下的空间足够分配
     if (pre_size >= size) {
         first_block->set_data(first_block->get_data() - size);
@@ -176,23 +408,28 @@ net_err_t PktBuffer::alloc_header(uint32_t size, bool is_cont) {
         auto pktmgr = PktMgr::get_instance();
         // 需要连续的空间
         if (is_cont) {
-            if (size > g_pktbuf_blk_size->value()) {
-                TINYTCP_LOG_ERROR(g_logger) << "header_size(" << size << ") > g_pktbuf_blk_size(" << g_pktbuf_blk_size->value() << ")";
+            if (size > pktmgr->get_max_blk_size()) {
+                TINYTCP_LOG_ERROR(g_logger) << "header_size(" << size << ") > max_blk_size(" << pktmgr->get_max_blk_size() << ")";
                 return net_err_t::NET_ERR_SIZE;
             }
-            auto blk = pktmgr->get_pktblock();
-            m_blk_list.push_front(blk);
+            auto blk = pktmgr->get_pktblock(size);
             if (blk == nullptr) {
                 TINYTCP_LOG_ERROR(g_logger) << "get_pktblock error, no free mem";
                 return net_err_t::NET_ERR_NONE;
             }
-            blk->set_data(blk->get_payload() + g_pktbuf_blk_size->value() - size);
+            if (blk->get_capacity() < size) {
+                // 能装下包头的等级都用完了
+                TINYTCP_LOG_ERROR(g_logger) << "get_pktblock error, no free blk for header_size(" << size << ")";
+                pktmgr->release_pktblock(blk);
+                return net_err_t::NET_ERR_MEM;
+            }
+            blk->set_data(blk->get_payload() + blk->get_capacity() - size);
             blk->set_size(size);
+            link_front(blk, blk, 1);
             m_capacity += size;
         }
         else {
-            uint64_t pre_size = (uint64_t)(first_block->get_data() - first_block->get_payload());
-            first_block->set_data(first_block->get_payload());
+            first_block->set_data(first_block->get_data() - pre_size);
             first_block->set_size(first_block->get_size() + pre_size);
             m_capacity += pre_size;
             bool ok = alloc(size - pre_size, true, true);
@@ -207,11 +444,11 @@ net_err_t PktBuffer::alloc_header(uint32_t size, bool is_cont) {
 }
 
 net_err_t PktBuffer::remove_header(uint32_t size) {
-    TINYTCP_ASSERT2(m_blk_list.size() != 0U, "remove_header error: m_blk_list is empty");
+    TINYTCP_ASSERT2(m_first != nullptr, "remove_header error: blk chain is empty");
 
     auto pktmgr = PktMgr::get_instance();
-    while (size) {
-        auto blk = m_blk_list.front();
+    while (size && m_first != nullptr) {
+        auto blk = m_first;
         if (size < blk->get_size()) {
             auto data = blk->get_data();
             blk->set_data(data + size);
@@ -223,7 +460,7 @@ net_err_t PktBuffer::remove_header(uint32_t size) {
         uint32_t cur_size = blk->get_size();
         m_capacity -= cur_size;
         size -= cur_size;
-        m_blk_list.pop_front();
+        unlink(blk);
         pktmgr->release_pktblock(blk);
     }
 
@@ -243,11 +480,13 @@ net_err_t PktBuffer::resize(uint32_t size) {
         return net_err_t::NET_ERR_OK;
     }
     else if (size > m_capacity) { // 扩充
-        auto tail_blk = m_blk_list.back();
-        uint64_t last_size = tail_blk->get_last_size();
-        if (last_size >= size) {
-            tail_blk->set_size(tail_blk->get_size() + size);
-            m_capacity += size;
+        auto tail_blk = m_last;
+        uint32_t need_size = size - m_capacity;
+        // payload被共享时, 后面的空间别的数据包也可能在用, 不能原地扩充
+        uint64_t last_size = tail_blk->is_shared() ? 0 : tail_blk->get_last_size();
+        if (last_size >= need_size) {
+            tail_blk->set_size(tail_blk->get_size() + need_size);
+            m_capacity += need_size;
         }
         else {
             tail_blk->set_size(tail_blk->get_size() + last_size);
@@ -265,24 +504,24 @@ net_err_t PktBuffer::resize(uint32_t size) {
             free();
             return net_err_t::NET_ERR_OK;
         }
-        auto pktmgr = PktMgr::get_instance();
         uint32_t total_size = 0U;
-        auto it = m_blk_list.begin();
-        for (; it != m_blk_list.end(); ++it) {
-            total_size += (*it)->get_size();
+        PktBlock* tail_blk = m_first;
+        for (; tail_blk != nullptr; tail_blk = tail_blk->m_next) {
+            total_size += tail_blk->get_size();
             if (total_size >= size) {
                 break;
             }
         }
-        auto tail_blk = *it;
-        // 删除后面的节点
-        ++it;
-        while (it != m_blk_list.end()) {
-            m_capacity -= (*it)->get_size();
-            it = m_blk_list.erase(it);
-            pktmgr->release_pktblock(*it);
+        // 删除后面的节点, 整段从链上摘下来再归还
+        PktBlock* it = tail_blk->m_next;
+        while (it != nullptr) {
+            m_capacity -= it->get_size();
+            --m_blk_cnt;
+            it = it->m_next;
         }
-        TINYTCP_ASSERT2(tail_blk->get_payload() == m_blk_list.back()->get_payload(), "tail != m_blk_list.back()");
+        release_chain(tail_blk->m_next);
+        tail_blk->m_next = nullptr;
+        m_last = tail_blk;
         // 计算剩下的size
         uint32_t pre_list_size = m_capacity - tail_blk->get_size();
         tail_blk->set_size(size - pre_list_size);
@@ -294,36 +533,110 @@ net_err_t PktBuffer::resize(uint32_t size) {
 
 net_err_t PktBuffer::merge_buf(PktBuffer* buf) {
     auto pktmgr = PktMgr::get_instance();
-    m_blk_list.splice(m_blk_list.end(), buf->m_blk_list);
+    if (buf->m_first != nullptr) {
+        link_back(buf->m_first, buf->m_last, buf->m_blk_cnt);
+    }
     m_capacity += buf->m_capacity;
+    buf->m_first = nullptr;
+    buf->m_last = nullptr;
+    buf->m_blk_cnt = 0;
+    buf->m_capacity = 0;
     pktmgr->release_pktbuffer(buf);
     return net_err_t::NET_ERR_OK;
 }
 
+PktBuffer* PktBuffer::split(uint32_t offset) {
+    if (offset > m_capacity) {
+        TINYTCP_LOG_ERROR(g_logger) << "split offset(" << offset << ") > m_capacity(" << m_capacity << ")";
+        return nullptr;
+    }
+    auto pktmgr = PktMgr::get_instance();
+    PktBuffer* buf = pktmgr->get_pktbuffer();
+    if (buf == nullptr) {
+        TINYTCP_LOG_WARN(g_logger) << "split error, no free buf";
+        return nullptr;
+    }
+
+    // 找到offset所在的块, 以及块前面一共有多少数据
+    PktBlock* blk = m_first;
+    uint32_t blk_idx = 0;
+    uint32_t pre_size = 0;
+    while (blk != nullptr && pre_size + blk->get_size() <= offset) {
+        pre_size += blk->get_size();
+        blk = blk->m_next;
+        ++blk_idx;
+    }
+
+    PktBlock* ref_blk = nullptr;
+    uint32_t cut = offset - pre_size;
+    if (blk != nullptr && cut > 0) {
+        // offset落在块中间, 新数据包用一个引用块持有后半段数据
+        ref_blk = pktmgr->get_ref_pktblock(blk);
+        if (ref_blk == nullptr) {
+            TINYTCP_LOG_WARN(g_logger) << "split error, no free desc";
+            pktmgr->release_pktbuffer(buf);
+            return nullptr;
+        }
+        ref_blk->set_data(blk->get_data() + cut);
+        ref_blk->set_size(blk->get_size() - cut);
+        blk->set_size(cut);
+        blk = blk->m_next;
+        ++blk_idx;
+    }
+
+    // [blk, m_last]整段从当前数据包摘下来挂到新数据包上
+    if (blk != nullptr) {
+        PktBlock* last = m_last;
+        uint32_t move_cnt = m_blk_cnt - blk_idx;
+        if (blk->m_prev != nullptr) {
+            blk->m_prev->m_next = nullptr;
+        }
+        else {
+            m_first = nullptr;
+        }
+        m_last = blk->m_prev;
+        m_blk_cnt = blk_idx;
+        buf->link_back(blk, last, move_cnt);
+    }
+    if (ref_blk != nullptr) {
+        buf->link_front(ref_blk, ref_blk, 1);
+    }
+
+    buf->m_capacity = m_capacity - offset;
+    m_capacity = offset;
+    reset_access();
+    buf->reset_access();
+    return buf;
+}
+
 net_err_t PktBuffer::set_cont_header(uint32_t size) {
     if (size > m_capacity) {
         TINYTCP_LOG_ERROR(g_logger) << "size(" << size << ") > m_capacity(" << m_capacity << ")";
         return net_err_t::NET_ERR_SIZE;
     }
-    if (size > g_pktbuf_blk_size->value()) {
-        TINYTCP_LOG_ERROR(g_logger) << "size(" << size << ") > g_pktbuf_blk_size(" << g_pktbuf_blk_size->value() << ")";
+    PktBlock* first_blk = m_first;
+    if (size > first_blk->get_capacity()) {
+        TINYTCP_LOG_ERROR(g_logger) << "size(" << size << ") > blk capacity(" << first_blk->get_capacity() << ")";
         return net_err_t::NET_ERR_SIZE;
     }
-    PktBlock* first_blk = m_blk_list.front();
     uint32_t first_size = first_blk->get_size();
     if (size <= first_size) {
         return net_err_t::NET_ERR_OK;
     }
+    // 要把后面的数据搬到第一个块, 先保证第一个块是私有的
+    first_blk = unshare_blk(first_blk);
+    if (first_blk == nullptr) {
+        return net_err_t::NET_ERR_MEM;
+    }
     auto pktmgr = PktMgr::get_instance();
 
     memmove(first_blk->get_payload(), first_blk->get_data(), first_size);
     first_blk->set_data(first_blk->get_payload());
     uint8_t* ptr = first_blk->get_payload() + first_size;
     uint32_t remain_size = size - first_size;
-    auto it = m_blk_list.begin();
-    ++it; // 把第一个块的数据移好位置之后,从第二个继续移动
-    while (remain_size && it != m_blk_list.end()) {
-        PktBlock* now_blk = *it;
+    // 把第一个块的数据移好位置之后,从第二个继续移动
+    PktBlock* now_blk = first_blk->m_next;
+    while (remain_size && now_blk != nullptr) {
         uint32_t cur_size = std::min(remain_size, now_blk->get_size());
         remain_size -= cur_size;
         memcpy(ptr, now_blk->get_data(), cur_size);
@@ -331,10 +644,12 @@ net_err_t PktBuffer::set_cont_header(uint32_t size) {
         first_blk->set_size(first_blk->get_size() + cur_size);
         now_blk->set_data(now_blk->get_data() + cur_size);
         now_blk->set_size(now_blk->get_size() - cur_size);
+        PktBlock* next_blk = now_blk->m_next;
         if (now_blk->get_size() == 0U) {
-            it = m_blk_list.erase(it);
+            unlink(now_blk);
             pktmgr->release_pktblock(now_blk);
         }
+        now_blk = next_blk;
     }
     return net_err_t::NET_ERR_OK;
 }
@@ -351,8 +666,8 @@ net_err_t PktBuffer::seek(uint32_t offset) {
 
     uint32_t move_bytes = 0;
     if (offset < m_pos) {
-        m_cur_blk = m_blk_list.begin();
-        m_blk_offset = (*m_cur_blk)->get_data();
+        m_cur_blk = m_first;
+        m_blk_offset = m_cur_blk->get_data();
         m_pos = 0;
         move_bytes = offset;
     }
@@ -381,6 +696,9 @@ net_err_t PktBuffer::copy(PktBuffer* src, uint32_t size) {
         uint32_t src_remain = src->cur_blk_remain_size();
         uint32_t copy_size = std::min(dest_remain, src_remain);
         copy_size = std::min(size, copy_size);
+        if (!cur_blk_writable()) {
+            return net_err_t::NET_ERR_MEM;
+        }
         memcpy(m_blk_offset, src->get_blk_offset(), copy_size);
         move_forward(copy_size);
         src->move_forward(copy_size);
@@ -405,6 +723,9 @@ net_err_t PktBuffer::fill(uint8_t v, uint32_t size) {
     while (size) {
         uint32_t blk_size = cur_blk_remain_size();
         uint32_t fill_size = std::min(size, blk_size);
+        if (!cur_blk_writable()) {
+            return net_err_t::NET_ERR_MEM;
+        }
         memset(m_blk_offset, v, fill_size);
         move_forward(fill_size);
         size -= fill_size;
@@ -413,23 +734,39 @@ net_err_t PktBuffer::fill(uint8_t v, uint32_t size) {
     return net_err_t::NET_ERR_OK;
 }
 
+int PktBuffer::get_iovec(struct iovec* iov, uint32_t max_cnt) const {
+    uint32_t cnt = 0;
+    for (PktBlock* blk = m_first; blk != nullptr; blk = blk->m_next) {
+        if (blk->get_size() == 0) {
+            continue;
+        }
+        if (cnt >= max_cnt) {
+            return -1;
+        }
+        iov[cnt].iov_base = blk->get_data();
+        iov[cnt].iov_len = blk->get_size();
+        ++cnt;
+    }
+    return (int)cnt;
+}
+
 uint32_t PktBuffer::cur_blk_remain_size() {
-    if (m_cur_blk == m_blk_list.end()) {
+    if (m_cur_blk == nullptr) {
         return 0;
     }
-    return (uint32_t)((*m_cur_blk)->get_data() + (*m_cur_blk)->get_size() - m_blk_offset);
+    return (uint32_t)(m_cur_blk->get_data() + m_cur_blk->get_size() - m_blk_offset);
 }
 
 void PktBuffer::move_forward(uint32_t size) {
-    PktBlock* cur_blk = *m_cur_blk;
+    PktBlock* cur_blk = m_cur_blk;
     // 不用担心m_pos和接下来的m_blk_offset对不上,在调用时size不会超过cur_blk
     m_pos += size;
     m_blk_offset += size;
 
     if (m_blk_offset >= cur_blk->get_data() + cur_blk->get_size()) {
-        ++m_cur_blk;
-        if (m_cur_blk != m_blk_list.end()) {
-            m_blk_offset = (*m_cur_blk)->get_data();
+        m_cur_blk = cur_blk->m_next;
+        if (m_cur_blk != nullptr) {
+            m_blk_offset = m_cur_blk->get_data();
         }
         else {
             m_blk_offset = nullptr;
@@ -452,6 +789,9 @@ net_err_t PktBuffer::write(const uint8_t* src, uint32_t size) {
     while (size) {
         uint32_t blk_size = cur_blk_remain_size();
         uint32_t copy_size = std::min(size, blk_size);
+        if (!cur_blk_writable()) {
+            return net_err_t::NET_ERR_MEM;
+        }
         memcpy(m_blk_offset, src, copy_size);
         move_forward(copy_size);
         src += copy_size;
@@ -488,10 +828,10 @@ net_err_t PktBuffer::read(uint8_t* dest, uint32_t size) {
 void PktBuffer::debug_print() {
 
     uint64_t total_size = 0;
-    for (auto& blk : m_blk_list) {
+    for (PktBlock* blk = m_first; blk != nullptr; blk = blk->m_next) {
         uint64_t pre_size  = (uint64_t)(blk->get_data() - blk->get_payload());
         uint64_t use_size  = blk->get_size();
-        uint64_t last_size = (uint64_t)(blk->get_payload() + g_pktbuf_blk_size->value() - (blk->get_data() + use_size));
+        uint64_t last_size = blk->get_last_size();
         TINYTCP_LOG_DEBUG(g_logger) << "pre_size=" << pre_size << ", use_size=" << use_size << ", last_size=" << last_size;
         total_size += use_size;
     }
@@ -505,44 +845,254 @@ void PktBuffer::debug_print() {
 }
 
 PktManager::PktManager() {
-    m_pkt_blk = std::make_unique<MemBlock>(sizeof(PktBlock), g_pktbuf_blk_cnt->value());
-    m_pkt_buf = std::make_unique<MemBlock>(sizeof(PktBuffer), g_pktbuf_buf_cnt->value());
-    TINYTCP_LOG_INFO(g_logger) << "m_pkt_blk size=" << m_pkt_blk->size() << " m_pkt_buf size=" << m_pkt_buf->size();
-    auto blk_cnt = g_pktbuf_blk_cnt->value();
-    for (int i = 0; i < blk_cnt; ++i) {
-        PktBlock* blk;
-        bool ok = m_pkt_blk->alloc((void**)&blk, 0);
-        TINYTCP_ASSERT2(ok, "m_pkt_blk->alloc error");
-        // 内存池中的blk，还有一个m_payload缓存区需要提前分配, 用init函数初始化一下
-        blk->init();
-        ok = m_pkt_blk->free(blk);
-        TINYTCP_ASSERT2(ok, "m_pkt_blk->free error, size=" + std::to_string(m_pkt_blk->size()));
-    }
-    auto buf_cnt = g_pktbuf_buf_cnt->value();
-    for (int i = 0; i < buf_cnt; ++i) {
-        PktBuffer* buf;
-        bool ok = m_pkt_buf->alloc((void**)&buf, 0);
-        TINYTCP_ASSERT2(ok, "m_pkt_buf->alloc error");
-        new (buf) PktBuffer();
-        ok = m_pkt_buf->free(buf);
-        TINYTCP_ASSERT2(ok, "m_pkt_buf->free error, size=" + std::to_string(m_pkt_buf->size()));
-    }
-}
-
-PktBlock* PktManager::get_pktblock() {
+    std::vector<uint32_t> blk_sizes = g_pktbuf_blk_sizes->value();
+    std::vector<uint32_t> blk_cnts = g_pktbuf_blk_cnts->value();
+    std::vector<uint32_t> blk_max_cnts = g_pktbuf_blk_max_cnts->value();
+    if (blk_max_cnts.size() != blk_sizes.size()) {
+        TINYTCP_LOG_WARN(g_logger) << "tcp.pktbuf_blk_max_cnts size mismatch, pktbuf blk pools will not grow";
+        blk_max_cnts = blk_cnts;
+    }
+    TINYTCP_ASSERT2(!blk_sizes.empty() && blk_sizes.size() == blk_cnts.size(),
+                    "tcp.pktbuf_blk_sizes and tcp.pktbuf_blk_cnts must be non-empty and the same length");
+    TINYTCP_ASSERT2(blk_sizes.size() <= UINT8_MAX, "too many pktbuf block classes");
+
+    // 按数据块大小从小到大排序, 方便best fit
+    std::vector<std::tuple<uint32_t, uint32_t, uint32_t> > classes;
+    for (size_t i = 0; i < blk_sizes.size(); ++i) {
+        classes.emplace_back(blk_sizes[i], blk_cnts[i], blk_max_cnts[i]);
+    }
+    std::sort(classes.begin(), classes.end());
+
+    m_classes = std::vector<pktblk_class_t>(classes.size());
+    for (size_t i = 0; i < classes.size(); ++i) {
+        pktblk_class_t& blk_class = m_classes[i];
+        blk_class.blk_size = std::get<0>(classes[i]);
+        uint32_t blk_size = blk_class.blk_size;
+        uint8_t class_idx = (uint8_t)i;
+        memblock_elastic_t elastic;
+        elastic.max_capacity = (int)std::get<2>(classes[i]);
+        // 数据块的描述符和payload放在同一个按cache line对齐的内存槽中, 启动和每次扩充都只有一次大块分配
+        blk_class.pool = std::make_unique<MemBlock>(PktBlock::slot_size(blk_size), std::get<1>(classes[i]), PKTBUF_CACHE_LINE_SIZE,
+                                                    elastic, [blk_size, class_idx](void* ptr) {
+            PktBlock* blk = new (ptr) PktBlock();
+            blk->init(blk_size, class_idx);
+        });
+        TINYTCP_LOG_INFO(g_logger) << "pktbuf blk class " << i << ": blk_size=" << blk_class.blk_size
+                                   << " cnt=" << blk_class.pool->size() << " max_cnt=" << std::get<2>(classes[i]);
+    }
+
+    // 共享payload用的描述符, 没有payload, 只占一条cache line
+    m_pkt_desc = std::make_unique<MemBlock>(PktBlock::slot_size(0), g_pktbuf_desc_cnt->value(), PKTBUF_CACHE_LINE_SIZE,
+                                            memblock_elastic_t(), [](void* ptr) {
+        PktBlock* blk = new (ptr) PktBlock();
+        blk->init(0, PKTBLK_CLASS_DESC);
+    });
+    TINYTCP_LOG_INFO(g_logger) << "m_pkt_desc size=" << m_pkt_desc->size();
+
+    memblock_elastic_t buf_elastic;
+    buf_elastic.max_capacity = (int)g_pktbuf_buf_max_cnt->value();
+    m_pkt_buf = std::make_unique<MemBlock>(sizeof(PktBuffer), g_pktbuf_buf_cnt->value(), alignof(std::max_align_t), buf_elastic, [](void* ptr) {
+        new (ptr) PktBuffer();
+    });
+    TINYTCP_LOG_INFO(g_logger) << "m_pkt_buf size=" << m_pkt_buf->size();
+}
+
+uint32_t PktManager::best_fit_class(uint32_t size) const noexcept {
+    uint32_t cnt = (uint32_t)m_classes.size();
+    for (uint32_t i = 0; i < cnt; ++i) {
+        if (m_classes[i].blk_size >= size) {
+            return i;
+        }
+    }
+    return cnt - 1;
+}
+
+PktBlock* PktManager::get_pktblock_from_class(uint32_t blk_class) {
     PktBlock* ptr;
-    if (!m_pkt_blk->alloc((void**)&ptr, 0)) {
+    if (!m_classes[blk_class].pool->alloc((void**)&ptr, 0)) {
         return nullptr;
     }
     ptr->reset();
     return ptr;
 }
 
+PktBlock* PktManager::get_pktblock(uint32_t size) {
+    uint32_t best = best_fit_class(size);
+    PktBlock* ptr = get_pktblock_from_class(best);
+    if (TINYTCP_LICKLY(ptr != nullptr)) {
+        return ptr;
+    }
+
+    // 最合适的等级用完了, 先找更大的, 再找更小的(调用方会把数据拆到多个块中)
+    uint32_t cnt = (uint32_t)m_classes.size();
+    for (uint32_t i = best + 1; i < cnt && ptr == nullptr; ++i) {
+        ptr = get_pktblock_from_class(i);
+    }
+    for (uint32_t i = best; i > 0 && ptr == nullptr; --i) {
+        ptr = get_pktblock_from_class(i - 1);
+    }
+
+    if (ptr != nullptr) {
+        m_classes[best].fallback.fetch_add(1, std::memory_order_relaxed);
+    }
+    else {
+        m_classes[best].fail.fetch_add(1, std::memory_order_relaxed);
+    }
+    return ptr;
+}
+
+PktBlock* PktManager::get_ref_pktblock(PktBlock* blk) {
+    PktBlock* ptr;
+    if (!m_pkt_desc->alloc((void**)&ptr, 0)) {
+        return nullptr;
+    }
+    PktBlock* owner = blk->m_owner;
+    owner->m_ref.fetch_add(1, std::memory_order_relaxed);
+    ptr->m_owner = owner;
+    ptr->m_payload = owner->m_payload;
+    ptr->m_capacity = owner->m_capacity;
+    ptr->m_data = blk->m_data;
+    ptr->m_size = blk->m_size;
+    ptr->m_next = nullptr;
+    ptr->m_prev = nullptr;
+    return ptr;
+}
+
+PktBlock* PktManager::get_ext_pktblock(uint8_t* data, uint32_t size, const pktblk_ext_t* ext) {
+    PktBlock* ptr;
+    if (!m_pkt_desc->alloc((void**)&ptr, 0)) {
+        return nullptr;
+    }
+    ptr->reset();
+    ptr->m_class = PKTBLK_CLASS_EXT;
+    ptr->m_ext = ext;
+    ptr->m_payload = data;
+    ptr->m_capacity = size;
+    ptr->m_data = data;
+    ptr->m_size = size;
+    return ptr;
+}
+
+uint32_t PktManager::get_pktblock_bulk(uint32_t size, PktBlock** blks, uint32_t n) {
+    uint32_t best = best_fit_class(size);
+    uint32_t cnt = (uint32_t)m_classes[best].pool->alloc_bulk((void**)blks, (int)n);
+    for (uint32_t i = 0; i < cnt; ++i) {
+        blks[i]->reset();
+    }
+    return cnt;
+}
+
+PktBlock* PktManager::drop_pktblock_ref(PktBlock* ptr) {
+    PktBlock* owner = ptr->m_owner;
+    if (ptr->get_class() == PKTBLK_CLASS_DESC) {
+        m_pkt_desc->free(ptr);
+    }
+    // 最后一个引用释放时, payload所在的块才还给池子
+    if (owner->m_ref.fetch_sub(1, std::memory_order_acq_rel) != 1) {
+        return nullptr;
+    }
+    if (owner->get_class() == PKTBLK_CLASS_EXT) {
+        const pktblk_ext_t* ext = owner->m_ext;
+        uint8_t* data = owner->m_payload;
+        uint32_t size = owner->m_capacity;
+        owner->m_class = PKTBLK_CLASS_DESC;
+        owner->m_ext = nullptr;
+        m_pkt_desc->free(owner);
+        ext->free_func(ext->arg, data, size);
+        return nullptr;
+    }
+    return owner;
+}
+
 net_err_t PktManager::release_pktblock(PktBlock* ptr) {
-    m_pkt_blk->free(ptr);
+    PktBlock* owner = drop_pktblock_ref(ptr);
+    if (owner != nullptr) {
+        m_classes[owner->get_class()].pool->free(owner);
+    }
+    return net_err_t::NET_ERR_OK;
+}
+
+net_err_t PktManager::release_pktblock_chain(PktBlock* first) {
+    // 链上连续的同一等级的块攒成一批再还, 一个数据包的块通常都是同一等级
+    PktBlock* batch[PKTBUF_BULK_MAX];
+    uint32_t batch_cnt = 0;
+    uint8_t batch_class = 0;
+    while (first != nullptr) {
+        PktBlock* next = first->m_next;
+        PktBlock* owner = drop_pktblock_ref(first);
+        if (owner != nullptr) {
+            if (batch_cnt == PKTBUF_BULK_MAX || (batch_cnt > 0 && owner->get_class() != batch_class)) {
+                m_classes[batch_class].pool->free_bulk((void* const*)batch, (int)batch_cnt);
+                batch_cnt = 0;
+            }
+            batch_class = owner->get_class();
+            batch[batch_cnt++] = owner;
+        }
+        first = next;
+    }
+    if (batch_cnt > 0) {
+        m_classes[batch_class].pool->free_bulk((void* const*)batch, (int)batch_cnt);
+    }
     return net_err_t::NET_ERR_OK;
 }
 
+uint32_t PktManager::get_blk_list_size() const {
+    uint32_t size = 0;
+    for (auto& blk_class : m_classes) {
+        size += blk_class.pool->size();
+    }
+    return size;
+}
+
+void PktManager::get_class_stats(std::vector<pktblk_class_stat_t>& stats) const {
+    stats.clear();
+    for (auto& blk_class : m_classes) {
+        pktblk_class_stat_t stat;
+        stat.blk_size = blk_class.blk_size;
+        stat.capacity = blk_class.pool->capacity();
+        stat.free     = blk_class.pool->size();
+        stat.used     = stat.capacity > stat.free ? stat.capacity - stat.free : 0;
+        stat.fallback = blk_class.fallback.load(std::memory_order_relaxed);
+        stat.fail     = blk_class.fail.load(std::memory_order_relaxed);
+        blk_class.pool->get_magazine_stat(stat.magazine);
+        blk_class.pool->get_elastic_stat(stat.elastic);
+        stats.push_back(stat);
+    }
+}
+
+uint32_t PktManager::reclaim() {
+    uint32_t cnt = 0;
+    for (auto& blk_class : m_classes) {
+        cnt += blk_class.pool->reclaim() ? 1 : 0;
+    }
+    cnt += m_pkt_buf->reclaim() ? 1 : 0;
+    return cnt;
+}
+
+void PktManager::debug_print() const {
+    std::vector<pktblk_class_stat_t> stats;
+    get_class_stats(stats);
+    for (auto& stat : stats) {
+        TINYTCP_LOG_DEBUG(g_logger)
+            << "blk_size=" << stat.blk_size
+            << ", capacity=" << stat.capacity
+            << ", free=" << stat.free
+            << ", used=" << stat.used
+            << ", fallback=" << stat.fallback
+            << ", fail=" << stat.fail
+            << ", magazine_alloc_hit=" << stat.magazine.alloc_hit
+            << ", magazine_alloc_miss=" << stat.magazine.alloc_miss
+            << ", magazine_free_hit=" << stat.magazine.free_hit
+            << ", magazine_free_miss=" << stat.magazine.free_miss
+            << ", magazine_cached=" << stat.magazine.cached
+            << ", max_capacity=" << stat.elastic.max_capacity
+            << ", grow=" << stat.elastic.grow_cnt
+            << ", shrink=" << stat.elastic.shrink_cnt
+            << ", grow_fail=" << stat.elastic.grow_fail;
+    }
+    TINYTCP_LOG_DEBUG(g_logger) << "buf free=" << m_pkt_buf->size() << ", buf capacity=" << m_pkt_buf->capacity();
+}
+
 PktBuffer* PktManager::get_pktbuffer() {
     PktBuffer* ptr;
     if (!m_pkt_buf->alloc((void**)&ptr, 0)) {
@@ -1,36 +1,86 @@
 // 数据包, 数据包由数据块组成
 
 #pragma once
-#include <list>
+#include <atomic>
+#include <vector>
 #include <inttypes.h>
+#include <sys/uio.h>
 #include "src/singleton.h"
 #include "src/net/memblock.h"
 #include "src/net/net_err.h"
 
 namespace tinytcp {
 
-// 数据块
+#define PKTBUF_CACHE_LINE_SIZE 64
+// 只有描述符没有payload的数据块, 引用其他数据块的payload
+#define PKTBLK_CLASS_DESC      0xFF
+// 只有描述符的数据块, payload是外部的内存(抓包环形缓冲区, 共享内存等), 最后一个引用释放时交还给外部
+#define PKTBLK_CLASS_EXT       0xFE
+// 批量分配/释放数据块时一次最多处理的块数
+#define PKTBUF_BULK_MAX        16
+
+// 外部内存的归还方式, 由内存的提供方持有, 生命周期要覆盖所有引用它的数据块
+struct pktblk_ext_t {
+    // data, size: 挂载时传入的内存
+    void (*free_func)(void* arg, uint8_t* data, uint32_t size);
+    void* arg;
+};
+
+// 数据块, 描述符和payload在同一个内存槽里: [PktBlock | padding | payload]
+// payload可以被多个数据包共享: 共享方持有一个只有描述符的数据块, m_owner指向payload真正所在的块,
+// 由owner上的引用计数决定payload什么时候还给池子
 class PktBlock {
 public:
     PktBlock();
-    ~PktBlock();
-
-    void init();
+    ~PktBlock() = default;
+
+    // 描述符占用的空间, 向上取整到cache line, payload从下一条cache line开始
+    static constexpr uint32_t header_size() noexcept {
+        return (sizeof(PktBlock) + PKTBUF_CACHE_LINE_SIZE - 1) / PKTBUF_CACHE_LINE_SIZE * PKTBUF_CACHE_LINE_SIZE;
+    }
+    // 一个内存槽的总大小
+    static constexpr uint32_t slot_size(uint32_t capacity) noexcept {
+        return header_size() + (capacity + PKTBUF_CACHE_LINE_SIZE - 1) / PKTBUF_CACHE_LINE_SIZE * PKTBUF_CACHE_LINE_SIZE;
+    }
+
+    // capacity: payload的大小, payload就是紧跟在描述符后面的内存
+    // blk_class: 数据块属于PktManager中的哪一个尺寸等级, 释放时归还到对应的池子
+    void init(uint32_t capacity, uint8_t blk_class);
     void reset();
 
+    uint8_t const get_class() const noexcept { return m_class; }
+    uint32_t const get_capacity() const noexcept { return m_capacity; }
     uint32_t const get_size() const noexcept { return m_size; }
     uint8_t* const get_data() const noexcept { return m_data; }
     uint8_t* const get_payload() const noexcept { return m_payload; }
     uint64_t const get_last_size() const noexcept;
+    PktBlock* get_owner() const noexcept { return m_owner; }
+    // payload是否被多个数据块引用, 共享的payload不能直接修改
+    bool is_shared() const noexcept { return m_owner->m_ref.load(std::memory_order_acquire) > 1; }
 
 
     void set_size(uint32_t size) noexcept { m_size = size; }
     void set_data(uint8_t* ptr) noexcept { m_data = ptr; }
 
+    PktBlock* get_next() const noexcept { return m_next; }
+    PktBlock* get_prev() const noexcept { return m_prev; }
+
 private:
-    uint32_t m_size;    // 数据块里的数据大小
+    friend class PktBuffer;
+    friend class PktManager;
+
+    std::atomic<uint32_t> m_ref{1};  // payload的引用计数, 只在owner上有意义
+    uint32_t m_capacity = 0;    // 数据块payload的大小
+    uint32_t m_size = 0;        // 数据块里的数据大小
+    uint8_t m_class = 0;        // 数据块所在的尺寸等级
+    PktBlock* m_owner = this;        // payload所在的数据块
+    const pktblk_ext_t* m_ext = nullptr; // 外部内存的归还方式, 只有PKTBLK_CLASS_EXT的块使用
     uint8_t* m_data = nullptr;    // 数据在内存空间中的起始位置
     uint8_t* m_payload = nullptr; // 数据块中的内存空间
+
+    // 侵入式链表指针, 数据块直接串成链, 组包/拆包都不需要额外分配链表节点
+    PktBlock* m_next = nullptr;
+    PktBlock* m_prev = nullptr;
 };
 
 
@@ -46,14 +96,32 @@ public:
 
     // 分配多少字节的空间
     bool alloc(uint32_t size, bool alloc_front = true, bool insert_front = false);
+    // 零拷贝复制: 新的数据包和当前数据包共享所有数据块的payload, 写入或加包头时再复制(写时复制)
+    PktBuffer* clone();
+    // 预留头部和尾部空间的分配方式(类似skb_reserve), 在空的数据包上调用,
+    // 数据从第一个块的headroom偏移处开始且尽量放在一个块中,
+    // 之后alloc_header在headroom中原地加包头, resize在tailroom中原地扩充, 都不需要分配新块或搬移数据
+    bool alloc_with_room(uint32_t size, uint32_t headroom, uint32_t tailroom = 0);
+    // 收包用: 帧放在tcp.pktbuf_rx_headroom之后, 整帧连续
+    bool alloc_rx(uint32_t size);
+    // 上层组包用: 预留tcp.pktbuf_tx_headroom给下层协议头, tailroom给最小帧填充
+    bool alloc_tx(uint32_t size, uint32_t tailroom = 0);
+    // 把外部内存[data, data + size)挂到数据包尾部, 不拷贝数据
+    // 最后一个引用它的数据块释放时调用ext->free_func把内存交还给外部
+    bool attach_ext(uint8_t* data, uint32_t size, const pktblk_ext_t* ext);
     bool free();
 
-    const std::list<PktBlock*>& get_list() const noexcept { return m_blk_list; }
+    PktBlock* get_first_blk() const noexcept { return m_first; }
+    PktBlock* get_last_blk() const noexcept { return m_last; }
+    uint32_t get_blk_cnt() const noexcept { return m_blk_cnt; }
     const uint8_t* get_blk_offset() const noexcept { return m_blk_offset; }
     uint32_t get_capacity() const noexcept { return m_capacity; }
     uint32_t total_blk_remain() const noexcept { return m_capacity - m_pos; }
+    // 第一个块数据前面的空闲空间, 最后一个块数据后面的空闲空间
+    uint32_t get_headroom() const noexcept;
+    uint32_t get_tailroom() const noexcept;
     uint32_t get_pos() const noexcept { return m_pos; }
-    std::list<PktBlock*>::iterator get_cur_blk() const noexcept { return m_cur_blk; }
+    PktBlock* get_cur_blk() const noexcept { return m_cur_blk; }
     uint8_t* get_data();
     void add_ref() noexcept { ++m_ref; }
 
@@ -62,7 +130,10 @@ public:
     net_err_t remove_header(uint32_t size);
     net_err_t resize(uint32_t size);
     net_err_t merge_buf(PktBuffer* buf);
-    // 调整包头，调成连续的
+    // 在offset处切开, 返回[offset, capacity)部分组成的新数据包, 当前数据包只保留[0, offset)
+    // 只遍历到offset所在的块, 之后的块直接挂到新数据包上, 边界块通过引用共享payload, 不拷贝数据
+    PktBuffer* split(uint32_t offset);
+    // 调整包头，调成连续的, 之后第一个块是私有的, 可以通过get_data()直接修改包头
     net_err_t set_cont_header(uint32_t size);
 
     // 读写
@@ -74,6 +145,10 @@ public:
     // 填充数据包
     net_err_t fill(uint8_t v, uint32_t size);
 
+    // 把数据块导出成iovec数组(不拷贝数据), 给writev/sendmsg直接发送
+    // 返回填充的iovec数量, 块数超过max_cnt时返回-1
+    int get_iovec(struct iovec* iov, uint32_t max_cnt) const;
+
     // 当前指向块的剩余大小
     uint32_t cur_blk_remain_size();
 
@@ -84,15 +159,31 @@ public:
     // 调试打印
     void debug_print();
 
+private:
+    // 数据块链表操作, [first, last]是已经串好的一段链
+    void link_front(PktBlock* first, PktBlock* last, uint32_t cnt);
+    void link_back(PktBlock* first, PktBlock* last, uint32_t cnt);
+    void unlink(PktBlock* blk);
+    // 用new_blk替换链上的blk
+    void replace(PktBlock* blk, PktBlock* new_blk);
+    // blk的payload被共享时, 复制出一个私有的块替换它, 返回可写的块, 失败返回nullptr
+    PktBlock* unshare_blk(PktBlock* blk);
+    // 写入当前块之前调用, 保证当前块是私有的
+    bool cur_blk_writable();
+    // 把一段链上的数据块全部还给管理器
+    static void release_chain(PktBlock* first);
+
 private:
     uint32_t m_capacity; // 数据包总的容量大小
 
     // 头插法插入数据块，方便后续加入包头
-    std::list<PktBlock*> m_blk_list;
+    PktBlock* m_first = nullptr;
+    PktBlock* m_last = nullptr;
+    uint32_t m_blk_cnt = 0;
 
     // 读写相关
     int32_t m_pos;
-    std::list<PktBlock*>::iterator m_cur_blk;
+    PktBlock* m_cur_blk = nullptr;
     uint8_t* m_blk_offset;
 
     std::atomic_int m_ref;
@@ -102,23 +193,73 @@ private:
 };
 
 
+// 每个尺寸等级的占用情况
+struct pktblk_class_stat_t {
+    uint32_t blk_size;    // 数据块payload大小
+    uint32_t capacity;    // 池子中数据块总数
+    uint32_t free;        // 空闲数据块数
+    uint32_t used;        // 正在使用的数据块数
+    uint64_t fallback;    // 最合适的等级没有空闲块, 改用其他等级的次数
+    uint64_t fail;        // 所有等级都分配失败的次数
+    memblock_magazine_stat_t magazine;  // 各线程magazine的命中情况
+    memblock_elastic_stat_t elastic;    // 池子扩缩容情况
+};
+
 class PktManager {
 
 public:
     PktManager();
     ~PktManager() = default;
 
-    PktBlock* get_pktblock();
+    // 按照size选择最合适的尺寸等级(能装下size的最小等级), 该等级用完时再去其他等级找
+    PktBlock* get_pktblock(uint32_t size);
+    // 获取一个引用blk的payload的数据块(只有描述符), 数据和blk一致
+    PktBlock* get_ref_pktblock(PktBlock* blk);
+    // 获取一个payload是外部内存的数据块(只有描述符), 数据就是整块外部内存
+    PktBlock* get_ext_pktblock(uint8_t* data, uint32_t size, const pktblk_ext_t* ext);
+    // 批量获取n个同一等级(size的最合适等级)的数据块, 和池子只交换一次, 返回获取到的数量
+    uint32_t get_pktblock_bulk(uint32_t size, PktBlock** blks, uint32_t n);
+    // 释放数据块, payload的引用计数归零时才真正还给池子
     net_err_t release_pktblock(PktBlock* ptr);
+    // 释放从first开始的整条链, 同一等级的数据块成批还给池子
+    net_err_t release_pktblock_chain(PktBlock* first);
 
     PktBuffer* get_pktbuffer();
     net_err_t release_pktbuffer(PktBuffer* ptr);
 
-    uint32_t get_blk_list_size() const { return m_pkt_blk->size(); }
+    // 尺寸等级, 按数据块大小从小到大排列, 启动时从配置中读取, 之后不再改变
+    uint32_t get_class_cnt() const noexcept { return (uint32_t)m_classes.size(); }
+    uint32_t get_class_blk_size(uint32_t blk_class) const noexcept { return m_classes[blk_class].blk_size; }
+    uint32_t get_min_blk_size() const noexcept { return m_classes.front().blk_size; }
+    uint32_t get_max_blk_size() const noexcept { return m_classes.back().blk_size; }
+    // 能装下size的最小等级, 都装不下时返回最大的等级
+    uint32_t best_fit_class(uint32_t size) const noexcept;
+
+    void get_class_stats(std::vector<pktblk_class_stat_t>& stats) const;
+    // 弹性池子空闲太多时归还扩充出来的内存, 由协议栈的定时器周期调用, 返回归还的chunk数
+    uint32_t reclaim();
+
+    uint32_t get_blk_list_size() const;
     uint32_t get_buf_list_size() const { return m_pkt_buf->size(); }
+    uint32_t get_desc_list_size() const { return m_pkt_desc->size(); }
+
+    void debug_print() const;
+
+private:
+    PktBlock* get_pktblock_from_class(uint32_t blk_class);
+    // 释放一个引用, 描述符和外部内存在这里直接处理, 返回需要还给尺寸等级池子的块, 没有时返回nullptr
+    PktBlock* drop_pktblock_ref(PktBlock* ptr);
 
 private:
-    MemBlock::uptr m_pkt_blk;
+    struct pktblk_class_t {
+        uint32_t blk_size;
+        MemBlock::uptr pool;
+        std::atomic<uint64_t> fallback{0};
+        std::atomic<uint64_t> fail{0};
+    };
+
+    std::vector<pktblk_class_t> m_classes;
+    MemBlock::uptr m_pkt_desc;   // 只有描述符的数据块, 用于共享payload和挂载外部内存
     MemBlock::uptr m_pkt_buf;
 
 };
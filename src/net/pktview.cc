@@ -0,0 +1,87 @@
+#include "pktview.h"
+#include <string.h>
+
+namespace tinytcp {
+
+PktView::PktView(const PktBuffer* buf)
+    : PktView(buf, 0, buf->get_capacity()) {
+}
+
+PktView::PktView(const PktBuffer* buf, uint32_t offset, uint32_t size) {
+    if ((uint64_t)offset + size > buf->get_capacity()) {
+        return;
+    }
+    *this = PktView(buf->get_first_blk(), 0, buf->get_capacity()).sub(offset, size);
+}
+
+const PktBlock* PktView::locate(uint32_t offset, uint32_t& blk_off) const {
+    const PktBlock* blk = m_blk;
+    blk_off = m_blk_off + offset;
+    while (blk != nullptr && blk_off >= blk->get_size()) {
+        blk_off -= blk->get_size();
+        blk = blk->get_next();
+    }
+    return blk;
+}
+
+PktView PktView::sub(uint32_t offset, uint32_t size) const {
+    if ((uint64_t)offset + size > m_size || size == 0) {
+        return PktView();
+    }
+    uint32_t blk_off;
+    const PktBlock* blk = locate(offset, blk_off);
+    return PktView(blk, blk_off, size);
+}
+
+const uint8_t* PktView::span(uint32_t offset, uint32_t size) const {
+    if ((uint64_t)offset + size > m_size || size == 0) {
+        return nullptr;
+    }
+    uint32_t blk_off;
+    const PktBlock* blk = locate(offset, blk_off);
+    if (blk_off + size > blk->get_size()) {
+        return nullptr;
+    }
+    return blk->get_data() + blk_off;
+}
+
+bool PktView::peek(uint32_t offset, void* dest, uint32_t size) const {
+    if ((uint64_t)offset + size > m_size) {
+        return false;
+    }
+    if (size == 0) {
+        return true;
+    }
+    uint32_t blk_off;
+    const PktBlock* blk = locate(offset, blk_off);
+    uint8_t* ptr = (uint8_t*)dest;
+    while (size) {
+        uint32_t copy_size = std::min(size, blk->get_size() - blk_off);
+        memcpy(ptr, blk->get_data() + blk_off, copy_size);
+        ptr += copy_size;
+        size -= copy_size;
+        blk = blk->get_next();
+        blk_off = 0;
+    }
+    return true;
+}
+
+bool PktView::read_be16(uint32_t offset, uint16_t& out) const {
+    uint16_t v;
+    if (!peek(offset, v)) {
+        return false;
+    }
+    out = net_to_host(v);
+    return true;
+}
+
+bool PktView::read_be32(uint32_t offset, uint32_t& out) const {
+    uint32_t v;
+    if (!peek(offset, v)) {
+        return false;
+    }
+    out = net_to_host(v);
+    return true;
+}
+
+} // namespace tinytcp
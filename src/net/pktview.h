@@ -0,0 +1,61 @@
+#pragma once
+
+/**
+* 数据包的只读视图, 值类型, 自己记录位置, 不修改PktBuffer的读写状态
+* 多个使用者(抓包, 协议栈)可以同时解析同一个数据包, 各层之间也不需要reset_access和重新seek
+* 视图只在数据包的块链不变时有效, 数据包被修改(加减包头, resize, free等)之后要重新创建
+*/
+
+#include <inttypes.h>
+#include <type_traits>
+#include "src/net/pktbuf.h"
+#include "src/endiantool.h"
+
+namespace tinytcp {
+
+class PktView {
+public:
+    PktView() = default;
+    // 整个数据包
+    explicit PktView(const PktBuffer* buf);
+    // 数据包中[offset, offset + size)的部分, 超出数据包时视图为空
+    PktView(const PktBuffer* buf, uint32_t offset, uint32_t size);
+
+    uint32_t size() const noexcept { return m_size; }
+    bool empty() const noexcept { return m_size == 0; }
+
+    // 视图中[offset, offset + size)的子视图, 越界时返回空视图
+    PktView sub(uint32_t offset, uint32_t size) const;
+    // 去掉前面size个字节, 用于逐层剥包头
+    PktView advance(uint32_t size) const { return sub(size, size <= m_size ? m_size - size : 0); }
+
+    // [offset, offset + size)在同一个块中时直接返回数据指针, 否则返回nullptr
+    const uint8_t* span(uint32_t offset, uint32_t size) const;
+    // 拷贝[offset, offset + size)到dest, 可以跨块
+    bool peek(uint32_t offset, void* dest, uint32_t size) const;
+
+    // 按类型读取, 跨块时逐块拷贝; 超出视图范围时返回false, out不变
+    template<class T>
+    bool peek(uint32_t offset, T& out) const {
+        static_assert(std::is_trivially_copyable<T>::value, "PktView::peek needs a trivially copyable type");
+        return peek(offset, &out, sizeof(T));
+    }
+
+    // 读取网络字节序的整数, 转成主机字节序
+    bool read_be16(uint32_t offset, uint16_t& out) const;
+    bool read_be32(uint32_t offset, uint32_t& out) const;
+
+private:
+    PktView(const PktBlock* blk, uint32_t blk_off, uint32_t size)
+        : m_blk(blk), m_blk_off(blk_off), m_size(size) {}
+
+    // 找到视图中offset所在的块和块内偏移, 只从视图起点往后走
+    const PktBlock* locate(uint32_t offset, uint32_t& blk_off) const;
+
+private:
+    const PktBlock* m_blk = nullptr;  // 视图起点所在的块
+    uint32_t m_blk_off = 0;           // 视图起点在块数据中的偏移
+    uint32_t m_size = 0;              // 视图的大小
+};
+
+} // namespace tinytcp
@@ -16,11 +16,17 @@ net_err_t IProtocolStack::release_msg_block(exmsg_t* msg) {
     return net_err_t::NET_ERR_OK;
 }
 
-net_err_t IProtocolStack::push_msg(exmsg_t* msg, uint32_t timeout_ms) {
-    bool ok = m_msg_queue->push(msg, timeout_ms);
+net_err_t IProtocolStack::push_msg(exmsg_t* msg, uint32_t timeout_ms, uint32_t worker) {
+    if (worker >= m_msg_queues.size()) {
+        return net_err_t::NET_ERR_PARAM;
+    }
+    msg_queue_t& queue = *m_msg_queues[worker];
+    bool ok = queue.lanes[get_msg_lane(msg)]->push(msg, timeout_ms);
     if (!ok) {
         return net_err_t::NET_ERR_MEM;
     }
+    // 工作线程挂起在所有通道共用的事件上, 没有挂起时不做系统调用
+    queue.not_empty.notify_all();
     return net_err_t::NET_ERR_OK;
 }
 
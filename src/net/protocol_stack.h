@@ -2,9 +2,18 @@
 #include "net_err.h"
 #include "exmsg.h"
 #include "memblock.h"
+#include "src/lock_free_ring_queue.h"
+#include <vector>
 
 namespace tinytcp {
 
+// 每个工作线程的消息队列按优先级分成几条通道, 工作线程按权重从各条通道取消息
+enum net_msg_lane_t {
+    NET_MSG_LANE_CTRL = 0,  // 定时器回调、跨工作线程的函数等控制消息, 优先处理
+    NET_MSG_LANE_DATA,      // 网卡收包通知
+    NET_MSG_LANE_CNT,
+};
+
 class IProtocolStack {
 
 public:
@@ -17,12 +26,29 @@ public:
     // 内存池操作，获取和释放消息的内存
     exmsg_t* get_msg_block();
     net_err_t release_msg_block(exmsg_t* msg);
-    // 操作协议栈的消息队列
-    net_err_t push_msg(exmsg_t* msg, uint32_t timeout_ms);
+    // 操作协议栈的消息队列, 每个工作线程一个, worker指定发给哪个工作线程, 按消息类型放到对应的通道
+    net_err_t push_msg(exmsg_t* msg, uint32_t timeout_ms, uint32_t worker = 0);
     net_err_t pop_msg();
+    // 在worker工作线程中执行func, 不等待执行完成; 消息走控制通道
+    virtual net_err_t post_to_worker(uint32_t worker, Timer::Callback func) = 0;
+    // 工作线程的数量, 网卡按这个数量创建输入队列
+    uint32_t get_worker_cnt() const noexcept { return (uint32_t)m_msg_queues.size(); }
+
+    static net_msg_lane_t get_msg_lane(const exmsg_t* msg) noexcept {
+        return msg->type == exmsg_t::NET_EXMSG_NETIF_IN ? NET_MSG_LANE_DATA : NET_MSG_LANE_CTRL;
+    }
+
+protected:
+    // 一个工作线程的消息队列, 每条通道一个无锁队列, 所有通道共用一个唤醒事件,
+    // 工作线程空闲时只挂起在not_empty上, 任意一条通道来了消息都会被唤醒
+    struct msg_queue_t {
+        LockFreeRingQueue<exmsg_t*>::uptr lanes[NET_MSG_LANE_CNT];
+        alignas(64) FutexEvent not_empty;
+    };
+
 protected:
     MemBlock::uptr m_mem_block = nullptr;
-    LockFreeRingQueue<exmsg_t*>::uptr m_msg_queue = nullptr;
+    std::vector<std::unique_ptr<msg_queue_t>> m_msg_queues;
 };
 
 } // namespace tinytcp
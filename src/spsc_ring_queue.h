@@ -0,0 +1,207 @@
+#pragma once
+
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <stdexcept>
+
+#include "mutex.h"
+#include "noncopyable.h"
+
+namespace tinytcp {
+
+// 无等待的单生产者单消费者环形队列
+// 生产者只写m_tail, 消费者只写m_head, 双方各自缓存对方的位置, 缓存不够用时才去读对方的cache line
+// 入队/出队没有CAS, 一次交接就是一次release store, 加上通知对端之前的一次全屏障
+template <typename T>
+class SpscRingQueue : Noncopyable {
+public:
+    using  ptr = std::shared_ptr<SpscRingQueue<T>>;
+    using uptr = std::unique_ptr<SpscRingQueue<T>>;
+
+    // size向上取整到2的幂, 所有槽位都可以放元素
+    explicit SpscRingQueue(uint32_t size);
+
+    ~SpscRingQueue() = default;
+
+    /**
+    * 只能在唯一的生产者/消费者线程中调用
+    * ms < 0  : 无限等待
+    * ms = 0  : try push/pop
+    * ms > 0  : 最多等待ms毫秒
+    */
+    bool push(const T& data, int timeout_ms = 0);
+
+    bool pop(T* data, int timeout_ms = 0);
+
+    // 批量入队/出队, 返回实际处理的数量, 一批只发布一次位置
+    // pop_burst等待时只要有一个元素就返回
+    uint32_t push_burst(const T* data, uint32_t n);
+
+    uint32_t pop_burst(T* data, uint32_t n, int timeout_ms = 0);
+
+    bool is_empty() const noexcept { return size() == 0U; }
+
+    bool is_full() const noexcept { return size() >= m_size; }
+
+    // 并发修改时只是一个近似值
+    uint32_t size() const noexcept;
+
+    uint32_t capacity() const noexcept { return m_size; }
+
+    // 是否有消费者挂起在pop上
+    bool has_pop_waiter() const noexcept { return m_not_empty.has_waiter(); }
+
+private:
+    uint32_t try_push(const T* data, uint32_t n);
+
+    uint32_t try_pop(T* data, uint32_t n);
+
+    // try_op返回0时挂起在event上, 直到try_op成功或者超时
+    template <typename F>
+    static uint32_t wait_for(FutexEvent& event, int timeout_ms, F&& try_op);
+
+private:
+    // 消费者的cache line: 读位置和缓存的写位置
+    alignas(64) std::atomic<uint32_t> m_head;
+    uint32_t m_tail_cache;
+    // 生产者的cache line: 写位置和缓存的读位置
+    alignas(64) std::atomic<uint32_t> m_tail;
+    uint32_t m_head_cache;
+    alignas(64) const uint32_t m_size;
+    const uint32_t m_mask;
+    std::unique_ptr<T[]> m_queue;
+    alignas(64) FutexEvent m_not_empty;  // 等待队列非空的消费者
+    alignas(64) FutexEvent m_not_full;   // 等待队列不满的生产者
+};
+
+template <typename T>
+SpscRingQueue<T>::SpscRingQueue(uint32_t size)
+    : m_head(0U),
+      m_tail_cache(0U),
+      m_tail(0U),
+      m_head_cache(0U),
+      m_size(size <= 1U ? 1U : 1U << (32 - __builtin_clz(size - 1U))),
+      m_mask(m_size - 1U),
+      m_queue(std::make_unique<T[]>(m_size)) {
+    if (size == 0U) {
+        throw std::out_of_range("Queue size must be greater than 0");
+    }
+}
+
+template <typename T>
+bool SpscRingQueue<T>::push(const T& data, int timeout_ms) {
+    if (try_push(&data, 1U) != 0U) {
+        return true;
+    }
+    if (timeout_ms == 0) {
+        return false;
+    }
+    return wait_for(m_not_full, timeout_ms, [this, &data]() { return try_push(&data, 1U); }) != 0U;
+}
+
+template <typename T>
+bool SpscRingQueue<T>::pop(T* data, int timeout_ms) {
+    if (data == nullptr) {
+        throw std::invalid_argument("Null pointer passed to Dequeue");
+    }
+    return pop_burst(data, 1U, timeout_ms) != 0U;
+}
+
+template <typename T>
+uint32_t SpscRingQueue<T>::push_burst(const T* data, uint32_t n) {
+    return try_push(data, n);
+}
+
+template <typename T>
+uint32_t SpscRingQueue<T>::pop_burst(T* data, uint32_t n, int timeout_ms) {
+    if (data == nullptr) {
+        throw std::invalid_argument("Null pointer passed to Dequeue");
+    }
+    uint32_t cnt = try_pop(data, n);
+    if (cnt != 0U || timeout_ms == 0 || n == 0U) {
+        return cnt;
+    }
+    return wait_for(m_not_empty, timeout_ms, [this, data, n]() { return try_pop(data, n); });
+}
+
+template <typename T>
+template <typename F>
+uint32_t SpscRingQueue<T>::wait_for(FutexEvent& event, int timeout_ms, F&& try_op) {
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout_ms);
+    while (true) {
+        uint32_t seq = event.prepare_wait();
+        // 登记之后再检查一次, 避免检查和挂起之间对端的唤醒丢失
+        uint32_t cnt = try_op();
+        if (cnt != 0U) {
+            event.finish_wait();
+            return cnt;
+        }
+        int wait_ms = -1;
+        if (timeout_ms > 0) {
+            auto remain = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now());
+            if (remain.count() <= 0) {
+                event.finish_wait();
+                return 0U;
+            }
+            wait_ms = (int)remain.count();
+        }
+        event.wait(seq, wait_ms);
+        event.finish_wait();
+    }
+}
+
+template <typename T>
+uint32_t SpscRingQueue<T>::try_push(const T* data, uint32_t n) {
+    uint32_t tail = m_tail.load(std::memory_order_relaxed);
+    uint32_t free_cnt = m_size - (tail - m_head_cache);
+    if (free_cnt < n) {
+        // 缓存的读位置不够用了, 才去读消费者的cache line
+        m_head_cache = m_head.load(std::memory_order_acquire);
+        free_cnt = m_size - (tail - m_head_cache);
+    }
+    uint32_t cnt = std::min(n, free_cnt);
+    if (cnt == 0U) {
+        return 0U;
+    }
+    for (uint32_t i = 0; i < cnt; ++i) {
+        m_queue[(tail + i) & m_mask] = data[i];
+    }
+    m_tail.store(tail + cnt, std::memory_order_release);
+    // 和prepare_wait中的屏障配对: 要么等待方登记之后能看到新的m_tail, 要么这里能看到等待方
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    m_not_empty.notify_all();
+    return cnt;
+}
+
+template <typename T>
+uint32_t SpscRingQueue<T>::try_pop(T* data, uint32_t n) {
+    uint32_t head = m_head.load(std::memory_order_relaxed);
+    uint32_t ready = m_tail_cache - head;
+    if (ready < n) {
+        m_tail_cache = m_tail.load(std::memory_order_acquire);
+        ready = m_tail_cache - head;
+    }
+    uint32_t cnt = std::min(n, ready);
+    if (cnt == 0U) {
+        return 0U;
+    }
+    for (uint32_t i = 0; i < cnt; ++i) {
+        data[i] = m_queue[(head + i) & m_mask];
+    }
+    m_head.store(head + cnt, std::memory_order_release);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    m_not_full.notify_all();
+    return cnt;
+}
+
+template <typename T>
+uint32_t SpscRingQueue<T>::size() const noexcept {
+    uint32_t head = m_head.load(std::memory_order_acquire);
+    uint32_t tail = m_tail.load(std::memory_order_acquire);
+    return std::min(tail - head, m_size);
+}
+
+}  // namespace tinytcp
@@ -1,208 +1,345 @@
+
 #include "timer.h"
 #include "util.h"
+#include <algorithm>
 
 
 namespace tinytcp {
 
-bool Timer::Comparator::operator()(const Timer::ptr& lhs, const Timer::ptr& rhs) const {
-    if (!lhs && !rhs) {
-        return false;
-    }
-    if (!lhs) {
-        return true;
-    }
-    if (!rhs) {
-        return false;
-    }
-    if (lhs->m_next < rhs->m_next) {
-        return true;
-    }
-    if (rhs->m_next < lhs->m_next) {
-        return false;
-    }
-    return lhs.get() < rhs.get();
-}
-
-Timer::Timer(uint64_t ms, std::function<void()> cb, bool recurring, TimerManager* manager)
+Timer::Timer(uint64_t ms, Callback cb, bool recurring, TimerManager* manager)
     : m_recurring(recurring)
     , m_ms(ms)
-    , m_cb(cb)
+    , m_cb(std::move(cb))
     , m_manager(manager) {
-    m_next = tinytcp::get_current_ms() + m_ms;
-}
-
-Timer::Timer(uint64_t next)
-    : m_next(next) {
-
 }
 
 bool Timer::cancel() {
-    TimerManager::RWMutexType::WriteLock lock(m_manager->m_mutex);
-    if (m_cb) {
-        m_cb = nullptr;
-        auto it = m_manager->m_timers.find(shared_from_this());
-        m_manager->m_timers.erase(it);
+    TimerManager* manager = m_manager;
+    if (manager != nullptr && !manager->in_owner_thread()) {
+        // 先标记取消, 所在的线程到期时看到标记就不再执行, 再让它摘下来
+        if (m_cancelled.exchange(true, std::memory_order_acq_rel)) {
+            return false;
+        }
+        Timer::ptr self = shared_from_this();
+        if (!manager->post([self]() { self->detach(); })) {
+            // 消息池满了或者所在的线程已经退出, 不能一直挂在时间轮上拿着回调, 留给所在的线程下一次推进时摘
+            manager->defer_detach(std::move(self));
+        }
         return true;
     }
-    return false;
+    // 不在时间轮上说明一次性定时器已经到期
+    if (m_cancelled.load(std::memory_order_relaxed) || manager == nullptr || !is_linked()) {
+        return false;
+    }
+    m_cancelled.store(true, std::memory_order_relaxed);
+    detach();
+    return true;
+}
+
+void Timer::detach() {
+    if (m_manager != nullptr && is_linked()) {
+        Timer::ptr self = m_manager->unlink(this);
+    }
+    m_cb = nullptr;
 }
 
 bool Timer::refresh() {
-    // 不能直接重置时间，因为是放在set中管理的，里面是按照m_next排序的，直接更改会影响set的结构
-    TimerManager::RWMutexType::WriteLock lock(m_manager->m_mutex);
-    if (!m_cb) {
-        return false;
+    TimerManager* manager = m_manager;
+    if (manager != nullptr && !manager->in_owner_thread()) {
+        if (m_cancelled.load(std::memory_order_acquire)) {
+            return false;
+        }
+        Timer::ptr self = shared_from_this();
+        return manager->post([self]() { self->refresh(); });
     }
-    auto it = m_manager->m_timers.find(shared_from_this());
-    if (it == m_manager->m_timers.end()) {
+    if (m_cancelled.load(std::memory_order_relaxed) || manager == nullptr || !is_linked()) {
         return false;
     }
-    m_manager->m_timers.erase(it);
-    m_next = tinytcp::get_current_ms() + m_ms;
-    m_manager->m_timers.insert(shared_from_this());
+    // 摘下来改完时间再挂到新的槽位上, 不申请内存
+    Timer::ptr self = manager->unlink(this);
+    m_next = manager->get_now_ms() + m_ms;
+    manager->link(std::move(self));
     return true;
 }
 
+void Timer::run_recurring() {
+    // 已经取消, 或者上一次到期的回调还在执行
+    if (m_cancelled.load(std::memory_order_relaxed) || !m_cb) {
+        return;
+    }
+    Callback cb = std::move(m_cb);
+    try {
+        cb();
+    } catch (...) {
+        if (!m_cancelled.load(std::memory_order_relaxed)) {
+            m_cb = std::move(cb);
+        }
+        throw;
+    }
+    if (!m_cancelled.load(std::memory_order_relaxed)) {
+        m_cb = std::move(cb);
+    }
+}
+
 bool Timer::reset(uint64_t ms, bool from_now) {
+    TimerManager* manager = m_manager;
+    if (manager != nullptr && !manager->in_owner_thread()) {
+        if (m_cancelled.load(std::memory_order_acquire)) {
+            return false;
+        }
+        Timer::ptr self = shared_from_this();
+        return manager->post([self, ms, from_now]() { self->reset(ms, from_now); });
+    }
     if (ms == m_ms && !from_now) {
         return true;
     }
-    TimerManager::RWMutexType::WriteLock lock(m_manager->m_mutex);
-    if (!m_cb) {
-        return false;
-    }
-    auto it = m_manager->m_timers.find(shared_from_this());
-    if (it == m_manager->m_timers.end()) {
+    if (m_cancelled.load(std::memory_order_relaxed) || manager == nullptr || !is_linked()) {
         return false;
     }
-    m_manager->m_timers.erase(it);
+    Timer::ptr self = manager->unlink(this);
     uint64_t start = 0;
     if (from_now) {
-        start = tinytcp::get_current_ms();
+        start = manager->get_now_ms();
     }
     else {
         start = m_next - m_ms;
     }
     m_ms = ms;
     m_next = start + m_ms;
-    m_manager->add_timer(shared_from_this(), lock);
+    manager->link(std::move(self));
     return true;
 }
 
 
 TimerManager::TimerManager() {
-    m_previous_time = tinytcp::get_current_ms();
+    for (auto& level : m_slots) {
+        for (auto& head : level) {
+            head.prev = &head;
+            head.next = &head;
+        }
+    }
 }
 
 TimerManager::~TimerManager() {
+    // 断开定时器对自己的引用, 调用者还拿着的Timer::ptr之后cancel/refresh/reset都返回false
+    for (auto& level : m_slots) {
+        for (auto& head : level) {
+            while (head.next != &head) {
+                Timer* timer = static_cast<Timer*>(head.next);
+                timer->m_manager = nullptr;
+                unlink(timer);
+            }
+        }
+    }
+}
 
+uint64_t TimerManager::get_now_ms() const {
+    return tinytcp::get_monotonic_ms();
 }
 
-Timer::ptr TimerManager::add_timer(uint64_t ms, std::function<void()> cb, bool recurring) {
-    Timer::ptr timer(new Timer(ms, cb, recurring, this));
-    RWMutexType::WriteLock lock(m_mutex);
-    add_timer(timer, lock);
+Timer::ptr TimerManager::add_timer(uint64_t ms, Timer::Callback cb, bool recurring) {
+    Timer::ptr timer(new Timer(ms, std::move(cb), recurring, this));
+    if (!in_owner_thread()) {
+        // 时间轮只在所在的线程修改, 挂上去之前取消的不再挂
+        if (!post([timer]() {
+                if (!timer->m_cancelled.load(std::memory_order_acquire) && timer->m_manager != nullptr) {
+                    timer->m_manager->start(timer);
+                }
+            })) {
+            return nullptr;
+        }
+        return timer;
+    }
+    start(timer);
     return timer;
 }
 
-static void on_timer(std::weak_ptr<void> weak_cond, std::function<void()> cb) {
-    // 检查weak_ptr指向的资源有没有被释放掉, 没有的情况下才执行回调函数
-    std::shared_ptr<void> tmp = weak_cond.lock();
-    if (tmp) {
-        cb();
+void TimerManager::start(Timer::ptr timer) {
+    uint64_t now_ms = get_now_ms();
+    timer->m_next = now_ms + timer->m_ms;
+    // 时间轮空着的时候可以直接拨到当前时间, 省掉之后推进空槽位; 构造时还不能调用虚函数取时间, 第一个定时器在这里对齐
+    if (m_timer_cnt == 0) {
+        m_current = std::max(m_current, now_ms);
     }
+    link(std::move(timer));
 }
 
 Timer::ptr TimerManager::add_condition_timer(uint64_t ms, std::function<void()> cb,
                                 std::weak_ptr<void> weak_cond,
                                 bool recurring) {
-    return add_timer(ms, std::bind(&on_timer, weak_cond, cb), recurring);
+    return add_timer(ms, [weak_cond, cb]() {
+        // 检查weak_ptr指向的资源有没有被释放掉, 没有的情况下才执行回调函数
+        std::shared_ptr<void> tmp = weak_cond.lock();
+        if (tmp) {
+            cb();
+        }
+    }, recurring);
 }
 
 uint64_t TimerManager::get_next_time() {
-    RWMutexType::ReadLock lock(m_mutex);
-    m_tickled = false;
-    if (m_timers.empty()) {
+    if (m_timer_cnt == 0) {
         return ~0ULL; // 返回一个极大值
     }
-    const Timer::ptr& next = *m_timers.begin();
-    uint64_t now_ms = tinytcp::get_current_ms();
-    if (now_ms >= next->m_next) {
+    uint64_t now_ms = get_now_ms();
+    uint64_t tick = next_pending_tick();
+    if (now_ms >= tick) {
         return 0;
     }
-    return next->m_next - now_ms;
+    return tick - now_ms;
 }
 
-
-void TimerManager::list_expired_cb(std::vector<std::function<void()> >& cbs) {
-    uint64_t now_ms = tinytcp::get_current_ms();
-    std::vector<Timer::ptr> expired;
-    {
-        RWMutexType::ReadLock lock(m_mutex);
-        if (m_timers.empty()) {
-            return ;
-        }
+void TimerManager::list_expired_cb(std::vector<Timer::Callback>& cbs) {
+    if (m_has_deferred.load(std::memory_order_acquire)) {
+        detach_deferred();
     }
-    RWMutexType::WriteLock lock(m_mutex);
-    if (m_timers.empty()) {
+    uint64_t now_ms = get_now_ms();
+    if (now_ms < m_current) {
         return ;
     }
-
-    bool roll_over = detect_clock_roll_over(now_ms);
-    if (!roll_over && ((*m_timers.begin())->m_next > now_ms)) {
-        return ;
+    advance(now_ms, cbs);
+    // 所有到期的都取出来之后再放回去, 周期为0的定时器不会在这一轮重复到期
+    for (auto& timer : m_expired) {
+        timer->m_next = now_ms + timer->m_ms;
+        link(std::move(timer));
     }
+    m_expired.clear();
+}
 
-    Timer::ptr now_timer(new Timer(now_ms));
-    auto it = roll_over ? m_timers.end() : m_timers.lower_bound(now_timer);
-    while (it != m_timers.end() && (*it)->m_next == now_ms) {
-        ++it;
-    }
-    expired.insert(expired.begin(), m_timers.begin(), it);
-    m_timers.erase(m_timers.begin(), it);
-    cbs.reserve(expired.size());
-    for (auto& timer : expired) {
-        cbs.push_back(timer->m_cb);
-        if (timer->m_recurring) {
-            timer->m_next = now_ms + timer->m_ms;
-            m_timers.insert(timer);
-        }
-        else {
-            timer->m_cb = nullptr;
-        }
+void TimerManager::link(Timer::ptr timer) {
+    // 已经过了到期时间的放到下一个要处理的槽位
+    uint64_t expires = std::max(timer->m_next, m_current);
+    uint64_t delta = expires - m_current;
+    uint32_t level = delta == 0 ? 0 : (63 - __builtin_clzll(delta)) / TIMER_WHEEL_BITS;
+    if (level >= TIMER_WHEEL_LEVELS) {
+        // 超出范围的先放在最高层的最后, 转下来的时候按真正的到期时间重新放
+        level = TIMER_WHEEL_LEVELS - 1;
+        expires = m_current + (1ULL << (TIMER_WHEEL_BITS * TIMER_WHEEL_LEVELS)) - 1;
     }
+    uint32_t index = (expires >> (TIMER_WHEEL_BITS * level)) & TIMER_WHEEL_MASK;
+
+    TimerNode& head = m_slots[level][index];
+    Timer* node = timer.get();
+    node->prev = head.prev;
+    node->next = &head;
+    head.prev->next = node;
+    head.prev = node;
+    node->m_slot = level * TIMER_WHEEL_SLOTS + index;
+    node->m_self = std::move(timer);
+    m_bitmap[level] |= 1ULL << index;
+    ++m_timer_cnt;
 }
 
-void TimerManager::add_timer(Timer::ptr val, RWMutexType::WriteLock& lock) {
-    auto it = m_timers.insert(val).first;
-    bool at_front = (it == m_timers.begin() && !m_tickled);
-    if (at_front) {
-        m_tickled = true;
+Timer::ptr TimerManager::unlink(Timer* timer) {
+    timer->prev->next = timer->next;
+    timer->next->prev = timer->prev;
+    timer->prev = nullptr;
+    timer->next = nullptr;
+    uint32_t level = timer->m_slot / TIMER_WHEEL_SLOTS;
+    uint32_t index = timer->m_slot & TIMER_WHEEL_MASK;
+    TimerNode& head = m_slots[level][index];
+    if (head.next == &head) {
+        m_bitmap[level] &= ~(1ULL << index);
     }
-    lock.unlock();
-    if (at_front) {
-        on_timer_inserted_at_front();
-    }   
+    --m_timer_cnt;
+    return std::move(timer->m_self);
 }
 
-bool TimerManager::detect_clock_roll_over(uint64_t now_ms) {
-    bool roll_over = false;
-    if (now_ms < m_previous_time && 
-        now_ms < (m_previous_time - 60 * 60 * 1000)) {
-        roll_over = true;
-    }
-    m_previous_time = now_ms;
-    return roll_over;
+void TimerManager::defer_detach(Timer::ptr timer) {
+    Mutex::Lock lock(m_deferred_mutex);
+    m_deferred.push_back(std::move(timer));
+    m_has_deferred.store(true, std::memory_order_release);
 }
 
-bool TimerManager::has_timer() {
-    RWMutexType::ReadLock lock(m_mutex);
-    return !m_timers.empty();
+void TimerManager::detach_deferred() {
+    std::vector<Timer::ptr> timers;
+    {
+        Mutex::Lock lock(m_deferred_mutex);
+        timers.swap(m_deferred);
+        m_has_deferred.store(false, std::memory_order_relaxed);
+    }
+    for (auto& timer : timers) {
+        timer->detach();
+    }
 }
 
+uint32_t TimerManager::cascade(uint32_t level) {
+    uint32_t index = (m_current >> (TIMER_WHEEL_BITS * level)) & TIMER_WHEEL_MASK;
+    TimerNode& head = m_slots[level][index];
+    if (head.next == &head) {
+        return index;
+    }
+    // 先把整个槽位摘下来, 重新放的定时器可能回到同一个槽位
+    TimerNode list;
+    list.next = head.next;
+    list.prev = head.prev;
+    list.next->prev = &list;
+    list.prev->next = &list;
+    head.next = &head;
+    head.prev = &head;
+    m_bitmap[level] &= ~(1ULL << index);
+    while (list.next != &list) {
+        link(unlink(static_cast<Timer*>(list.next)));
+    }
+    return index;
+}
 
+void TimerManager::advance(uint64_t now_ms, std::vector<Timer::Callback>& cbs) {
+    while (m_current <= now_ms) {
+        if (m_timer_cnt == 0) {
+            m_current = now_ms + 1;
+            break;
+        }
+        uint32_t index = m_current & TIMER_WHEEL_MASK;
+        // 第0层转完一圈, 把上一层的下一个槽位转下来, 上一层也转完一圈时继续往上
+        if (index == 0) {
+            for (uint32_t level = 1; level < TIMER_WHEEL_LEVELS && cascade(level) == 0; ++level) {
+            }
+        }
+        TimerNode& head = m_slots[0][index];
+        while (head.next != &head) {
+            Timer::ptr timer = unlink(static_cast<Timer*>(head.next));
+            // 其他线程已经取消, 摘下来的请求还没到
+            if (timer->m_cancelled.load(std::memory_order_relaxed)) {
+                timer->m_cb = nullptr;
+                continue;
+            }
+            if (timer->m_recurring) {
+                // 循环定时器的回调还要用, 交给执行线程的是一个持有定时器的小对象
+                cbs.push_back([timer]() { timer->run_recurring(); });
+                m_expired.push_back(std::move(timer));
+            }
+            else {
+                cbs.push_back(std::move(timer->m_cb));
+            }
+        }
+        // 中间没有定时器的槽位直接跳过
+        ++m_current;
+        if (m_timer_cnt != 0) {
+            m_current = std::min(next_pending_tick(), now_ms + 1);
+        }
+    }
+}
 
+uint64_t TimerManager::next_pending_tick() const noexcept {
+    uint32_t index = m_current & TIMER_WHEEL_MASK;
+    uint64_t pending = m_bitmap[0] >> index;
+    if (pending != 0) {
+        return m_current + __builtin_ctzll(pending);
+    }
+    uint64_t tick = ~0ULL;
+    // 第0层下一圈的槽位
+    if (m_bitmap[0] != 0) {
+        tick = (m_current | TIMER_WHEEL_MASK) + 1 + __builtin_ctzll(m_bitmap[0]);
+    }
+    // 高层的定时器要等那一层转动时才会转下来, 更高层转动的时间都是它的整数倍
+    for (uint32_t level = 1; level < TIMER_WHEEL_LEVELS; ++level) {
+        if (m_bitmap[level] != 0) {
+            uint64_t span = 1ULL << (TIMER_WHEEL_BITS * level);
+            tick = std::min(tick, (m_current + span - 1) & ~(span - 1));
+            break;
+        }
+    }
+    return tick;
+}
 
 } // namespace tinytcp
-
-
@@ -1,72 +1,137 @@
 #pragma once
 
+#include <atomic>
 #include <memory>
 #include <functional>
-#include <set>
 #include <vector>
+#include "noncopyable.h"
+#include "inplace_function.h"
 #include "mutex.h"
 
 namespace tinytcp {
+
+// 定时器回调的内联容量, 捕获一个shared_ptr/weak_ptr加一个std::function也能放下
+#define TIMER_CALLBACK_SIZE 64
+
+// 分层时间轮: 每层64个槽位, 第0层一个槽位1ms, 往上每层的槽位是下一层的64倍
+// 6层一共覆盖2^36ms(约795天), 更远的定时器放在最高层的最后, 转下来之后再重新放
+#define TIMER_WHEEL_BITS    6
+#define TIMER_WHEEL_SLOTS   (1U << TIMER_WHEEL_BITS)
+#define TIMER_WHEEL_MASK    (TIMER_WHEEL_SLOTS - 1)
+#define TIMER_WHEEL_LEVELS  6
+
+// 侵入式的双向链表节点, 定时器直接挂在时间轮的槽位上, 插入和摘除不申请内存
+struct TimerNode {
+    TimerNode* prev = nullptr;
+    TimerNode* next = nullptr;
+
+    bool is_linked() const noexcept { return next != nullptr; }
+};
+
 class TimerManager;
-class Timer : public std::enable_shared_from_this<Timer> {
+class Timer : public TimerNode, public std::enable_shared_from_this<Timer> {
 friend class TimerManager;
 public:
     using ptr = std::shared_ptr<Timer>;
+    // 到期时只移动, 不拷贝, 也不申请内存
+    using Callback = InplaceFunction<void(), TIMER_CALLBACK_SIZE>;
+
+    // 在TimerManager所在的线程调用时直接修改时间轮, 都是O(1)
+    // 其他线程调用时转给所在的线程执行, 返回的是请求有没有发出去; cancel先标记取消, 之后到期也不会再执行,
+    // 请求发不出去时由所在的线程下一次推进时间轮时摘下来
     bool cancel();
     bool refresh();
     bool reset(uint64_t ms, bool from_now);
 
 private:
-    Timer(uint64_t ms, std::function<void()> cb, bool recurring, TimerManager* manager);
-    Timer(uint64_t next);
+    Timer(uint64_t ms, Callback cb, bool recurring, TimerManager* manager);
+
+    // 在所在的线程中从时间轮上摘下来, 释放回调
+    void detach();
+
+    // 循环定时器到期之后调用, 执行期间回调从定时器中移出来, 回调里可以cancel/reset自己
+    void run_recurring();
 
 private:
     bool m_recurring = false; // 是否循环定时器
+    std::atomic<bool> m_cancelled{false}; // 已经取消, 其他线程也可能设置; 循环定时器执行完之后不再放回回调
     uint64_t m_ms = 0;        // 执行周期
     uint64_t m_next = 0;      // 精确的执行时间(当前时间加上需要执行的时间)
-    std::function<void()> m_cb;
+    Callback m_cb;
     TimerManager* m_manager = nullptr;
-
-private:
-    struct Comparator {
-        bool operator()(const Timer::ptr& lhs, const Timer::ptr& rhs) const;
-    };
-
+    uint32_t m_slot = 0;      // 挂在哪个槽位上: 层数 * TIMER_WHEEL_SLOTS + 下标
+    // 挂在时间轮上时持有自己, 调用者不保存返回的Timer::ptr也会按时执行
+    Timer::ptr m_self;
 };
 
-class TimerManager {
+/**
+* 分层时间轮, 添加、取消、重新设置定时器都是O(1)
+* 不加锁, 时间轮只在所在的线程中修改; 协议栈每个工作线程一个, 定时器在所属的工作线程到期和执行
+* 子类实现in_owner_thread和post之后, 其他线程添加和操作定时器会转到所在的线程执行
+*/
+class TimerManager : Noncopyable {
 friend class Timer;
 
 public:
-    using RWMutexType = RWMutex;
     using ptr = std::shared_ptr<TimerManager>;
 
     TimerManager();
     virtual ~TimerManager();
 
-    Timer::ptr add_timer(uint64_t ms, std::function<void()> cb, bool recurring = false);
+    // cb可以是lambda, 函数指针或者std::function, 超过TIMER_CALLBACK_SIZE时编译报错
+    // 其他线程添加时, 从所在的线程收到请求开始计时; 请求发不出去时返回nullptr
+    Timer::ptr add_timer(uint64_t ms, Timer::Callback cb, bool recurring = false);
 
     // 用weak_ptr当条件，有一个引用计数，如果已经消失了，那么说明条件已经不满足了，就不用执行了
     Timer::ptr add_condition_timer(uint64_t ms, std::function<void()> cb,
                                    std::weak_ptr<void> weak_cond,
                                    bool recurring = false);
-    
+
+    // 距离下一次需要推进时间轮还有多少毫秒, 没有定时器时返回~0ULL
+    // 只有高层槽位有定时器时返回的是它们转到低层的时间, 不会晚于真正的到期时间
     uint64_t get_next_time();
-    void list_expired_cb(std::vector<std::function<void()> >& cbs); // 返回已经超时了的，需要执行的回调函数
+    // 推进时间轮, 把已经超时了的，需要执行的回调函数追加到cbs
+    // 调用者复用cbs时, 整个过程不申请内存
+    void list_expired_cb(std::vector<Timer::Callback>& cbs);
+
+    size_t get_timer_cnt() const noexcept { return m_timer_cnt; }
+    bool has_timer() const noexcept { return m_timer_cnt != 0; }
+
 protected:
-    virtual void on_timer_inserted_at_front() = 0;
-    void add_timer(Timer::ptr val, RWMutexType::WriteLock& lock);
-    bool has_timer();
+    // 时间轮用的时钟, 默认是单调时钟, 测试时可以替换
+    virtual uint64_t get_now_ms() const;
+    // 当前线程是不是时间轮所在的线程, 默认只在一个线程中使用
+    virtual bool in_owner_thread() const { return true; }
+    // 在时间轮所在的线程中执行cb, 不等待执行完成, 返回false表示没有发出去
+    virtual bool post(Timer::Callback /*cb*/) { return false; }
+
 private:
-    // 检测是否调整了系统时间
-    bool detect_clock_roll_over(uint64_t now_ms);
+    // 从现在开始计时, 挂到时间轮上
+    void start(Timer::ptr timer);
+    // 按到期时间挂到对应层的槽位上
+    void link(Timer::ptr timer);
+    // 从槽位上摘下来, 返回时间轮持有的引用
+    Timer::ptr unlink(Timer* timer);
+    // 其他线程取消时请求发不出去, 记下来等所在的线程摘
+    void defer_detach(Timer::ptr timer);
+    // 在所在的线程中摘下记下来的定时器
+    void detach_deferred();
+    // 把第level层当前的槽位转到下面几层, 返回这一层的槽位下标
+    uint32_t cascade(uint32_t level);
+    // 处理完now_ms之前的所有槽位
+    void advance(uint64_t now_ms, std::vector<Timer::Callback>& cbs);
+    // 第0层从第m_current个tick开始, 下一个有定时器的tick; 没有时返回下一次转动高层的tick
+    uint64_t next_pending_tick() const noexcept;
+
 private:
-    RWMutexType m_mutex;
-    std::set<Timer::ptr, Timer::Comparator> m_timers;
-    bool m_tickled = false;
-    uint64_t m_previous_time = 0;
+    TimerNode m_slots[TIMER_WHEEL_LEVELS][TIMER_WHEEL_SLOTS];  // 每个槽位一个循环链表的头
+    uint64_t m_bitmap[TIMER_WHEEL_LEVELS] = {0};                // 每层哪些槽位上有定时器
+    uint64_t m_current = 0;     // 下一个要处理的tick(ms), 之前的槽位都已经处理过
+    size_t m_timer_cnt = 0;
+    std::vector<Timer::ptr> m_expired;  // 到期的循环定时器, 这一轮处理完之后再放回去, 复用内存
+    Mutex m_deferred_mutex;
+    std::vector<Timer::ptr> m_deferred;         // 等待摘下的已取消定时器, 受m_deferred_mutex保护
+    std::atomic<bool> m_has_deferred{false};    // 推进时间轮时不用每次都加锁
 };
 
 } // namespace tinytcp
-
-
@@ -2,6 +2,7 @@
 #include "log.h"
 #include <execinfo.h>
 #include <sys/time.h>
+#include <time.h>
 #include <iomanip>
 
 
@@ -51,6 +52,12 @@ uint64_t get_current_us() {
     return tv.tv_sec * 1000 * 1000UL + tv.tv_usec;
 }
 
+uint64_t get_monotonic_ms() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000UL + ts.tv_nsec / 1000000;
+}
+
 
 std::string string_to_hex(const std::string& str) {
     std::stringstream ss;
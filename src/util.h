@@ -17,6 +17,8 @@ std::string back_trace_to_string(int size = 64, int skip = 2, const std::string&
 // 时间相关
 uint64_t get_current_ms();
 uint64_t get_current_us();
+// 单调时钟, 不受调整系统时间的影响, 用来算超时
+uint64_t get_monotonic_ms();
 
 std::string string_to_hex(const std::string& str);
 std::ostream& operator<<(std::ostream& os, const std::pair<const std::string&, bool>& p);
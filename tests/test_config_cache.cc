@@ -0,0 +1,86 @@
+// 热路径读取配置的开销: ConfigVar::value()(读写锁) 和 ConfigCache::value()(原子变量) 对比
+// 多个线程同时读时, 读写锁的计数所在的cache line在核之间来回失效, 线程越多越慢
+
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <thread>
+#include <vector>
+#include "src/config.h"
+#include "src/net/pktbuf.h"
+#include "src/log.h"
+
+static tinytcp::ConfigVar<uint32_t>::ptr g_bench_value =
+    tinytcp::Config::look_up("bench.config_cache_value", 64U, "bench config value");
+static tinytcp::ConfigCache<uint32_t> g_bench_value_cache(g_bench_value);
+
+// 每个线程跑loop次func, 返回所有线程合计平均每次的耗时(ns), 没有争用时不随线程数变化
+template<class Func>
+static double run_threads(int thread_cnt, uint32_t loop, Func func) {
+    std::atomic<bool> start{false};
+    std::vector<std::thread> threads;
+    for (int i = 0; i < thread_cnt; ++i) {
+        threads.emplace_back([&]() {
+            while (!start.load(std::memory_order_acquire)) {
+                std::this_thread::yield();
+            }
+            func(loop);
+        });
+    }
+    auto begin = std::chrono::steady_clock::now();
+    start.store(true, std::memory_order_release);
+    for (auto& t : threads) {
+        t.join();
+    }
+    auto end = std::chrono::steady_clock::now();
+    uint64_t ns = std::chrono::duration_cast<std::chrono::nanoseconds>(end - begin).count();
+    return (double)ns / ((uint64_t)loop * thread_cnt);
+}
+
+int main() {
+    TINYTCP_LOG_NAME("system")->set_level(tinytcp::LogLevel::ERROR);
+    TINYTCP_LOG_ROOT()->set_level(tinytcp::LogLevel::ERROR);
+    auto pktmgr = tinytcp::PktMgr::get_instance();
+
+    const uint32_t loop = 2000000;
+    static std::atomic<uint64_t> s_sink{0};
+    for (int thread_cnt : {1, 2, 4, 8}) {
+        double rwlock_ns = run_threads(thread_cnt, loop, [](uint32_t n) {
+            uint64_t sum = 0;
+            for (uint32_t i = 0; i < n; ++i) {
+                sum += g_bench_value->value();
+            }
+            s_sink += sum;
+        });
+        double cache_ns = run_threads(thread_cnt, loop, [](uint32_t n) {
+            uint64_t sum = 0;
+            for (uint32_t i = 0; i < n; ++i) {
+                sum += g_bench_value_cache.value();
+            }
+            s_sink += sum;
+        });
+        // 每个线程收一个包再释放, alloc_rx里读取headroom配置
+        double alloc_ns = run_threads(thread_cnt, loop / 10, [pktmgr](uint32_t n) {
+            for (uint32_t i = 0; i < n; ++i) {
+                tinytcp::PktBuffer* buf = pktmgr->get_pktbuffer();
+                if (buf == nullptr) {
+                    continue;
+                }
+                buf->alloc_rx(1514);
+                buf->free();
+            }
+        });
+        std::cout << "threads=" << thread_cnt
+                  << "\tconfig_var ns/read=" << rwlock_ns
+                  << "\tconfig_cache ns/read=" << cache_ns
+                  << "\talloc_rx ns/pkt=" << alloc_ns << std::endl;
+    }
+
+    // 配置变更之后缓存跟着刷新
+    g_bench_value->set_value(128U);
+    if (g_bench_value_cache.value() != 128U) {
+        std::cout << "config cache not refreshed" << std::endl;
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,66 @@
+#include <gtest/gtest.h>
+
+#include <vector>
+#include "src/net/netif.h"
+#include "src/net/pktbuf.h"
+#include "src/net/protocol.h"
+#include "src/log.h"
+
+
+using namespace tinytcp;
+
+
+class EtherNetTest : public ::testing::Test {
+protected:
+    void SetUp() override {
+        m_pktmgr = PktMgr::get_instance();
+        m_free_buf = m_pktmgr->get_buf_list_size();
+    }
+
+    void TearDown() override {
+        EXPECT_EQ(m_pktmgr->get_buf_list_size(), m_free_buf);
+    }
+
+    // size字节的帧, 以太网协议类型放在第12, 13字节(如果装得下)
+    PktBuffer* make_frame(uint32_t size, uint16_t protocol) {
+        PktBuffer* buf = m_pktmgr->get_pktbuffer();
+        EXPECT_NE(buf, nullptr);
+        EXPECT_TRUE(buf->alloc_rx(size));
+        std::vector<uint8_t> data(size, 0);
+        if (size >= 14) {
+            data[12] = (uint8_t)(protocol >> 8);
+            data[13] = (uint8_t)protocol;
+        }
+        buf->reset_access();
+        EXPECT_EQ(buf->write(data.data(), size), net_err_t::NET_ERR_OK);
+        return buf;
+    }
+
+    PktManager* m_pktmgr;
+    uint32_t m_free_buf;
+};
+
+TEST_F(EtherNetTest, TruncatedFrame) {
+    EtherNet netif(nullptr, "eth_test");
+    // 比以太网包头短的帧直接丢掉, 由调用者释放
+    for (uint32_t size : {1U, 6U, 12U, 13U}) {
+        PktBuffer* buf = make_frame(size, 0);
+        EXPECT_EQ(netif.link_in(buf), net_err_t::NET_ERR_SIZE) << "size=" << size;
+        EXPECT_EQ(buf->get_capacity(), size);
+        buf->free();
+    }
+}
+
+TEST_F(EtherNetTest, HeaderOnlyFrame) {
+    EtherNet netif(nullptr, "eth_test");
+    PktBuffer* buf = make_frame(14, NET_PROTOCOL_IPv4);
+    EXPECT_EQ(netif.link_in(buf), net_err_t::NET_ERR_OK);
+    buf->free();
+}
+
+
+int main(int argc, char** argv) {
+    TINYTCP_LOG_NAME("system")->set_level(LogLevel::ERROR);
+    ::testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
@@ -0,0 +1,167 @@
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <functional>
+#include <memory>
+#include <new>
+#include <thread>
+#include <vector>
+#include "src/inplace_function.h"
+#include "src/timer.h"
+
+
+using namespace tinytcp;
+
+// 统计当前线程的堆分配次数
+static thread_local uint64_t t_alloc_cnt = 0;
+
+void* operator new(size_t size) {
+    ++t_alloc_cnt;
+    void* ptr = std::malloc(size == 0 ? 1 : size);
+    if (ptr == nullptr) {
+        throw std::bad_alloc();
+    }
+    return ptr;
+}
+
+void operator delete(void* ptr) noexcept {
+    std::free(ptr);
+}
+
+void operator delete(void* ptr, size_t) noexcept {
+    std::free(ptr);
+}
+
+using Func = InplaceFunction<void(), 64>;
+
+TEST(InplaceFunctionTest, EmptyAndInvoke) {
+    Func empty;
+    EXPECT_FALSE(empty);
+    EXPECT_THROW(empty(), std::bad_function_call);
+
+    int value = 0;
+    Func func([&value]() { ++value; });
+    EXPECT_TRUE(func);
+    func();
+    func();
+    EXPECT_EQ(value, 2);
+
+    func = nullptr;
+    EXPECT_FALSE(func);
+}
+
+TEST(InplaceFunctionTest, ReturnValueAndArgs) {
+    InplaceFunction<int(int, int), 16> add([](int a, int b) { return a + b; });
+    EXPECT_EQ(add(2, 3), 5);
+}
+
+// 空的std::function和函数指针当成空对象
+TEST(InplaceFunctionTest, NullCallable) {
+    std::function<void()> empty_func;
+    Func from_func(empty_func);
+    EXPECT_FALSE(from_func);
+
+    void (*empty_ptr)() = nullptr;
+    Func from_ptr(empty_ptr);
+    EXPECT_FALSE(from_ptr);
+}
+
+// 只能移动的捕获, 移动之后原对象为空, 析构只发生一次
+TEST(InplaceFunctionTest, MoveOnlyCapture) {
+    auto counter = std::make_shared<int>(0);
+    {
+        auto owned = std::make_unique<int>(7);
+        Func func([owned = std::move(owned), counter]() { *counter += *owned; });
+        EXPECT_EQ(counter.use_count(), 2);
+
+        Func moved(std::move(func));
+        EXPECT_FALSE(func);
+        EXPECT_TRUE(moved);
+        moved();
+        EXPECT_EQ(*counter, 7);
+
+        Func assigned;
+        assigned = std::move(moved);
+        EXPECT_FALSE(moved);
+        assigned();
+        EXPECT_EQ(*counter, 14);
+        EXPECT_EQ(counter.use_count(), 2);
+    }
+    EXPECT_EQ(counter.use_count(), 1);
+}
+
+TEST(InplaceFunctionTest, Swap) {
+    int a = 0;
+    int b = 0;
+    Func fa([&a]() { ++a; });
+    Func fb([&b]() { ++b; });
+    fa.swap(fb);
+    fa();
+    EXPECT_EQ(a, 0);
+    EXPECT_EQ(b, 1);
+}
+
+// 构造, 移动, 调用都不申请内存
+TEST(InplaceFunctionTest, NoAllocation) {
+    int value = 0;
+    auto shared = std::make_shared<int>(1);
+    uint64_t begin = t_alloc_cnt;
+    Func func([&value, shared]() { value += *shared; });
+    Func moved(std::move(func));
+    moved();
+    EXPECT_EQ(t_alloc_cnt, begin);
+    EXPECT_EQ(value, 1);
+}
+
+// 定时器到期时取出回调并执行, 不申请内存
+TEST(InplaceFunctionTest, TimerExpireNoAllocation) {
+    TimerManager manager;
+    int once = 0;
+    int recurring = 0;
+    manager.add_timer(0, [&once]() { ++once; });
+    Timer::ptr timer = manager.add_timer(0, [&recurring]() { ++recurring; }, true);
+    auto cond = std::make_shared<int>(0);
+    manager.add_condition_timer(0, [&once]() { ++once; }, cond);
+
+    std::vector<Timer::Callback> cbs;
+    cbs.reserve(16);
+    // 第一轮把复用的内存准备好
+    std::this_thread::sleep_for(std::chrono::milliseconds(2));
+    manager.list_expired_cb(cbs);
+    EXPECT_EQ(cbs.size(), 3U);
+    for (auto& cb : cbs) {
+        cb();
+    }
+    EXPECT_EQ(once, 2);
+    EXPECT_EQ(recurring, 1);
+
+    for (int i = 0; i < 3; ++i) {
+        cbs.clear();
+        std::this_thread::sleep_for(std::chrono::milliseconds(2));
+        uint64_t begin = t_alloc_cnt;
+        manager.list_expired_cb(cbs);
+        ASSERT_EQ(cbs.size(), 1U);
+        cbs[0]();
+        EXPECT_EQ(t_alloc_cnt, begin);
+    }
+    EXPECT_EQ(recurring, 4);
+
+    // 取消之后已经取出来的回调也不再执行
+    cbs.clear();
+    std::this_thread::sleep_for(std::chrono::milliseconds(2));
+    manager.list_expired_cb(cbs);
+    EXPECT_TRUE(timer->cancel());
+    EXPECT_FALSE(timer->cancel());
+    for (auto& cb : cbs) {
+        cb();
+    }
+    EXPECT_EQ(recurring, 4);
+}
+
+
+int main(int argc, char** argv) {
+    ::testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
@@ -3,7 +3,9 @@
 #include <gtest/gtest.h>
 
 #include <algorithm>
+#include <chrono>
 #include <memory>
+#include <mutex>
 #include <thread>
 #include <vector>
 #include "src/lock_free_ring_queue.h"
@@ -47,11 +49,14 @@ TEST_F(LockFreeRingQueueTest, SingleEnqueueDequeue) {
 
 // 测试队列满时入队
 TEST_F(LockFreeRingQueueTest, EnqueueFullQueue) {
-    for (uint32_t i = 0; i < m_queue_size - 1; ++i) {  // 注意减1
+    // 每个槽位都有自己的序号, 不需要空出一个位置区分空和满
+    EXPECT_EQ(m_queue->capacity(), m_queue_size);
+    for (uint32_t i = 0; i < m_queue_size; ++i) {
         EXPECT_TRUE(m_queue->push(static_cast<int>(i)));
     }
 
-    EXPECT_EQ(m_queue->size(), m_queue_size - 1);
+    EXPECT_EQ(m_queue->size(), m_queue_size);
+    EXPECT_TRUE(m_queue->is_full());
     EXPECT_FALSE(m_queue->push(100));  // 队列已满，入队失败
 }
 
@@ -113,18 +118,149 @@ TEST_F(LockFreeRingQueueTest, MultiThreadedEnqueueDequeue) {
     }
 }
 
+// 批量入队和出队
+TEST_F(LockFreeRingQueueTest, BulkEnqueueDequeue) {
+    std::vector<int> values_in(m_queue_size);
+    for (uint32_t i = 0; i < m_queue_size; ++i) {
+        values_in[i] = static_cast<int>(i);
+    }
+
+    EXPECT_EQ(m_queue->push_bulk(values_in.data(), 10), 10U);
+    EXPECT_EQ(m_queue->size(), 10U);
+    // 空间不够时只放入能放下的部分
+    EXPECT_EQ(m_queue->push_bulk(values_in.data() + 10, m_queue_size), m_queue_size - 10);
+    EXPECT_EQ(m_queue->push_bulk(values_in.data(), 1), 0U);
+
+    std::vector<int> values_out(m_queue_size, -1);
+    EXPECT_EQ(m_queue->pop_bulk(values_out.data(), 5), 5U);
+    EXPECT_EQ(m_queue->pop_bulk(values_out.data() + 5, m_queue_size), m_queue_size - 5);
+    EXPECT_TRUE(m_queue->is_empty());
+    EXPECT_EQ(m_queue->pop_bulk(values_out.data(), 1), 0U);
+    for (uint32_t i = 0; i < m_queue_size; ++i) {
+        EXPECT_EQ(values_out[i], static_cast<int>(i));
+    }
+}
+
+// 多线程批量入队和出队
+TEST_F(LockFreeRingQueueTest, MultiThreadedBulk) {
+    const int num_threads = 4;
+    const int num_elements_per_thread = 1000;
+    const int batch = 7;
+    std::vector<int> results;
+    std::mutex results_mutex;
+
+    auto enqueue_function = [&](int thread_id) {
+        int values[batch];
+        for (int i = 0; i < num_elements_per_thread; ) {
+            int cnt = std::min(batch, num_elements_per_thread - i);
+            for (int j = 0; j < cnt; ++j) {
+                values[j] = thread_id * num_elements_per_thread + i + j;
+            }
+            int pushed = 0;
+            while (pushed < cnt) {
+                pushed += m_queue->push_bulk(values + pushed, cnt - pushed);
+                std::this_thread::yield();
+            }
+            i += cnt;
+        }
+    };
+    auto dequeue_function = [&]() {
+        int values[batch];
+        int total = 0;
+        std::vector<int> local;
+        while (total < num_elements_per_thread) {
+            uint32_t cnt = m_queue->pop_bulk(values, std::min(batch, num_elements_per_thread - total));
+            local.insert(local.end(), values, values + cnt);
+            total += cnt;
+            std::this_thread::yield();
+        }
+        std::lock_guard<std::mutex> lock(results_mutex);
+        results.insert(results.end(), local.begin(), local.end());
+    };
+
+    std::vector<std::thread> threads;
+    for (int i = 0; i < num_threads; ++i) {
+        threads.emplace_back(enqueue_function, i);
+        threads.emplace_back(dequeue_function);
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+
+    EXPECT_TRUE(m_queue->is_empty());
+    ASSERT_EQ(results.size(), (size_t)(num_threads * num_elements_per_thread));
+    std::sort(results.begin(), results.end());
+    for (int i = 0; i < num_threads * num_elements_per_thread; ++i) {
+        EXPECT_EQ(results[i], i);
+    }
+}
+
 // 边界条件测试：初始化大小为1的队列
 TEST(LockFreeRingQueueBoundaryTest, InitializationWithSizeOne) {
     LockFreeRingQueue<int> small_queue(1);
 
+    // 最少两个槽位, 只有一个槽位时分不清空闲和已写入
+    EXPECT_EQ(small_queue.capacity(), 2U);
     EXPECT_EQ(small_queue.size(), 0U);
     EXPECT_TRUE(small_queue.is_empty());
 
     int value_in = 99;
     EXPECT_TRUE(small_queue.push(value_in));
+    EXPECT_TRUE(small_queue.push(value_in));
     EXPECT_FALSE(small_queue.push(value_in));  // 队列应该已经满了
 }
 
+// 测试超时等待, 空队列上等待到超时返回false
+TEST_F(LockFreeRingQueueTest, PopTimeout) {
+    int value_out = 0;
+    auto begin = std::chrono::steady_clock::now();
+    EXPECT_FALSE(m_queue->pop(&value_out, 50));
+    auto cost = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - begin);
+    EXPECT_GE(cost.count(), 45);
+    EXPECT_FALSE(m_queue->has_pop_waiter());
+}
+
+// 测试阻塞出队, 挂起的消费者被入队唤醒
+TEST_F(LockFreeRingQueueTest, BlockingPopWakeup) {
+    const int num_items = 1000;
+    long long sum = 0;
+    std::thread consumer([&]() {
+        for (int i = 0; i < num_items; ++i) {
+            int value = 0;
+            ASSERT_TRUE(m_queue->pop(&value, -1));
+            sum += value;
+        }
+    });
+    // 等消费者挂起之后再入队
+    while (!m_queue->has_pop_waiter()) {
+        std::this_thread::yield();
+    }
+    for (int i = 0; i < num_items; ++i) {
+        while (!m_queue->push(i)) {
+            std::this_thread::yield();
+        }
+    }
+    consumer.join();
+    EXPECT_EQ(sum, (long long)num_items * (num_items - 1) / 2);
+    EXPECT_TRUE(m_queue->is_empty());
+}
+
+// 测试阻塞入队, 队列满时生产者挂起, 出队之后被唤醒
+TEST_F(LockFreeRingQueueTest, BlockingPushWhenFull) {
+    std::vector<int> values(m_queue->capacity(), 1);
+    ASSERT_EQ(m_queue->push_bulk(values.data(), values.size()), values.size());
+    ASSERT_FALSE(m_queue->push(2));
+
+    std::thread producer([&]() {
+        EXPECT_TRUE(m_queue->push(2, 1000));
+    });
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    int value_out = 0;
+    EXPECT_TRUE(m_queue->pop(&value_out));
+    producer.join();
+    EXPECT_EQ(m_queue->size(), values.size());
+}
+
 // 边界条件测试：入队和出队仅一个元素
 TEST(LockFreeRingQueueBoundaryTest, SingleElementQueue) {
     LockFreeRingQueue<int> small_queue(1);
@@ -133,11 +269,16 @@ TEST(LockFreeRingQueueBoundaryTest, SingleElementQueue) {
     int value_out = 0;
 
     EXPECT_TRUE(small_queue.push(value_in));
-    EXPECT_FALSE(small_queue.push(value_in));  // 队列已满
-
     EXPECT_TRUE(small_queue.pop(&value_out));
     EXPECT_EQ(value_out, value_in);
+    EXPECT_FALSE(small_queue.pop(&value_out));  // 队列为空
 
+    // 绕回之后槽位的序号继续可用
+    for (int i = 0; i < 10; ++i) {
+        EXPECT_TRUE(small_queue.push(i));
+        EXPECT_TRUE(small_queue.pop(&value_out));
+        EXPECT_EQ(value_out, i);
+    }
     EXPECT_FALSE(small_queue.pop(&value_out));  // 队列为空
 }
 
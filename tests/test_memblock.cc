@@ -0,0 +1,286 @@
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <thread>
+#include <vector>
+#include <string.h>
+#include "src/config.h"
+#include "src/net/memblock.h"
+#include "src/log.h"
+
+
+using namespace tinytcp;
+
+
+TEST(MemBlockTest, MagazineHitMiss) {
+    MemBlock pool(64, 1024);
+    ASSERT_GT(pool.magazine_size(), 0U);
+    int free_cnt = pool.size();
+
+    // 第一次分配magazine是空的, 从全局队列补充一批, 之后都在本线程完成
+    std::vector<void*> ptrs;
+    for (uint32_t i = 0; i < pool.magazine_size() / 2; ++i) {
+        void* ptr = nullptr;
+        ASSERT_TRUE(pool.alloc(&ptr, 0));
+        ptrs.push_back(ptr);
+    }
+    EXPECT_EQ(pool.size(), free_cnt - (int)ptrs.size());
+    for (void* ptr : ptrs) {
+        ASSERT_TRUE(pool.free(ptr));
+    }
+    EXPECT_EQ(pool.size(), free_cnt);
+
+    memblock_magazine_stat_t stat;
+    pool.get_magazine_stat(stat);
+    EXPECT_EQ(stat.magazine_cnt, 1U);
+    EXPECT_EQ(stat.alloc_miss, 1U);
+    EXPECT_EQ(stat.alloc_hit, ptrs.size() - 1);
+    EXPECT_EQ(stat.free_hit, ptrs.size());
+    EXPECT_EQ(stat.cached, pool.magazine_size() / 2);
+}
+
+TEST(MemBlockTest, AllocAll) {
+    // 所有对象都能分配出来, magazine满了会还给全局队列
+    MemBlock pool(64, 256);
+    std::vector<void*> ptrs;
+    void* ptr = nullptr;
+    while (pool.alloc(&ptr, 0)) {
+        ptrs.push_back(ptr);
+    }
+    EXPECT_EQ((int)ptrs.size(), pool.capacity());
+    EXPECT_EQ(pool.size(), 0);
+    for (void* p : ptrs) {
+        ASSERT_TRUE(pool.free(p));
+    }
+    EXPECT_EQ(pool.size(), pool.capacity());
+
+    memblock_magazine_stat_t stat;
+    pool.get_magazine_stat(stat);
+    EXPECT_GT(stat.free_miss, 0U);
+    EXPECT_LE(stat.cached, pool.magazine_size());
+}
+
+TEST(MemBlockTest, ThreadExitReturnsCache) {
+    MemBlock pool(64, 1024);
+    std::vector<void*> ptrs(100);
+    // 在一个线程分配, 另一个线程释放, 线程退出时缓存的对象还给内存池
+    std::thread t1([&]() {
+        for (auto& ptr : ptrs) {
+            ASSERT_TRUE(pool.alloc(&ptr, 0));
+        }
+    });
+    t1.join();
+    EXPECT_EQ(pool.size(), pool.capacity() - 100);
+    std::thread t2([&]() {
+        for (auto& ptr : ptrs) {
+            ASSERT_TRUE(pool.free(ptr));
+        }
+    });
+    t2.join();
+    EXPECT_EQ(pool.size(), pool.capacity());
+
+    memblock_magazine_stat_t stat;
+    pool.get_magazine_stat(stat);
+    EXPECT_EQ(stat.magazine_cnt, 0U);
+    EXPECT_EQ(stat.cached, 0U);
+
+    // 之后的线程复用退出的线程留下的magazine
+    std::thread t3([&]() {
+        void* ptr = nullptr;
+        ASSERT_TRUE(pool.alloc(&ptr, 0));
+        memblock_magazine_stat_t stat;
+        pool.get_magazine_stat(stat);
+        EXPECT_EQ(stat.magazine_cnt, 1U);
+        ASSERT_TRUE(pool.free(ptr));
+    });
+    t3.join();
+    EXPECT_EQ(pool.size(), pool.capacity());
+}
+
+TEST(MemBlockTest, Bulk) {
+    MemBlock pool(64, 1024);
+    std::vector<void*> ptrs(100, nullptr);
+    ASSERT_EQ(pool.alloc_bulk(ptrs.data(), 100), 100);
+    EXPECT_EQ(pool.size(), pool.capacity() - 100);
+    std::sort(ptrs.begin(), ptrs.end());
+    EXPECT_EQ(std::unique(ptrs.begin(), ptrs.end()), ptrs.end());
+    ASSERT_EQ(pool.free_bulk(ptrs.data(), 100), 100);
+    EXPECT_EQ(pool.size(), pool.capacity());
+
+    // 不够时只分配能分配的部分
+    std::vector<void*> all(pool.capacity() + 10, nullptr);
+    ASSERT_EQ(pool.alloc_bulk(all.data(), (int)all.size()), pool.capacity());
+    EXPECT_EQ(pool.size(), 0);
+    ASSERT_EQ(pool.free_bulk(all.data(), pool.capacity()), pool.capacity());
+    EXPECT_EQ(pool.size(), pool.capacity());
+}
+
+TEST(MemBlockTest, HugepageArena) {
+    // 系统没有预留大页时退回到透明大页, 两种情况内存池都要能正常使用
+    auto hugepage = Config::look_up<bool>("tcp.memblock_hugepage");
+    auto mlock = Config::look_up<bool>("tcp.memblock_mlock");
+    ASSERT_NE(hugepage, nullptr);
+    ASSERT_NE(mlock, nullptr);
+    hugepage->set_value(true);
+    mlock->set_value(true);
+    {
+        MemBlock pool(2048, 1024, 64);
+        std::vector<void*> ptrs(pool.capacity(), nullptr);
+        ASSERT_EQ(pool.alloc_bulk(ptrs.data(), pool.capacity()), pool.capacity());
+        for (void* ptr : ptrs) {
+            EXPECT_EQ((uintptr_t)ptr % 64, 0U);
+            memset(ptr, 0xAB, pool.block_size());
+        }
+        ASSERT_EQ(pool.free_bulk(ptrs.data(), pool.capacity()), pool.capacity());
+        EXPECT_EQ(pool.size(), pool.capacity());
+    }
+    hugepage->set_value(false);
+    mlock->set_value(false);
+}
+
+TEST(MemBlockTest, SmallPoolNoMagazine) {
+    // 小的内存池不使用magazine, 避免对象都被缓存在线程里
+    MemBlock pool(64, 16);
+    EXPECT_EQ(pool.magazine_size(), 0U);
+    void* ptr = nullptr;
+    ASSERT_TRUE(pool.alloc(&ptr, 0));
+    ASSERT_TRUE(pool.free(ptr));
+    EXPECT_EQ(pool.size(), pool.capacity());
+}
+
+TEST(MemBlockTest, ElasticInit) {
+    // 初始化回调对启动时和扩充出来的内存块都要调用
+    int init_cnt = 0;
+    memblock_elastic_t elastic;
+    elastic.max_capacity = 64;
+    MemBlock pool(64, 16, alignof(std::max_align_t), elastic, [&init_cnt](void* ptr) {
+        memset(ptr, 0x5A, 64);
+        ++init_cnt;
+    });
+    EXPECT_TRUE(pool.is_elastic());
+    EXPECT_EQ(init_cnt, 16);
+
+    std::vector<void*> ptrs(32, nullptr);
+    ASSERT_EQ(pool.alloc_bulk(ptrs.data(), 32), 32);
+    EXPECT_GE(init_cnt, 32);
+    EXPECT_EQ(init_cnt, pool.capacity());
+    for (void* ptr : ptrs) {
+        EXPECT_EQ(((uint8_t*)ptr)[0], 0x5A);
+    }
+    ASSERT_EQ(pool.free_bulk(ptrs.data(), 32), 32);
+}
+
+TEST(MemBlockTest, ElasticGrowShrink) {
+    memblock_elastic_t elastic;
+    elastic.max_capacity = 64;
+    elastic.chunk_capacity = 16;
+    MemBlock pool(64, 16, alignof(std::max_align_t), elastic);
+    ASSERT_EQ(pool.capacity(), 16);
+    size_t grow_bytes = MemBlock::get_grow_bytes();
+
+    // 超过初始容量后按chunk扩充, 直到max_capacity
+    std::vector<void*> ptrs;
+    void* ptr = nullptr;
+    while (pool.alloc(&ptr, 0)) {
+        ptrs.push_back(ptr);
+    }
+    EXPECT_EQ(ptrs.size(), 64U);
+    EXPECT_EQ(pool.capacity(), 64);
+    EXPECT_EQ(pool.size(), 0);
+    EXPECT_EQ(MemBlock::get_grow_bytes(), grow_bytes + (size_t)48 * pool.block_size());
+
+    memblock_elastic_stat_t stat;
+    pool.get_elastic_stat(stat);
+    EXPECT_EQ(stat.init_capacity, 16);
+    EXPECT_EQ(stat.max_capacity, 64);
+    EXPECT_EQ(stat.chunk_cnt, 3U);
+    EXPECT_EQ(stat.grow_cnt, 3U);
+    EXPECT_EQ(stat.grow_fail, 1U);
+
+    // 释放路径上不归还
+    for (auto it = ptrs.rbegin(); it != ptrs.rend(); ++it) {
+        ASSERT_TRUE(pool.free(*it));
+    }
+    pool.get_elastic_stat(stat);
+    EXPECT_EQ(stat.shrink_cnt, 0U);
+    EXPECT_EQ(pool.capacity(), 64);
+
+    // 由定时器调用reclaim, 每次归还一个整块空闲的chunk, 直到空闲块不超过高水位(4 + 16 * 2)
+    EXPECT_TRUE(pool.reclaim());
+    EXPECT_EQ(pool.capacity(), 48);
+    while (pool.reclaim()) {
+    }
+    pool.get_elastic_stat(stat);
+    EXPECT_EQ(stat.shrink_cnt, 2U);
+    EXPECT_EQ(pool.capacity(), 32);
+    EXPECT_EQ(pool.size(), pool.capacity());
+
+    while (pool.shrink()) {
+    }
+    EXPECT_EQ(pool.capacity(), 16);
+    EXPECT_EQ(pool.size(), 16);
+    EXPECT_EQ(MemBlock::get_grow_bytes(), grow_bytes);
+}
+
+TEST(MemBlockTest, ElasticGrowBudget) {
+    // 所有池子扩充的内存总量受预算限制, 超出预算时分配失败而不是继续申请内存
+    auto budget = Config::look_up<uint64_t>("tcp.memblock_grow_budget");
+    ASSERT_NE(budget, nullptr);
+    uint64_t old_budget = budget->value();
+    budget->set_value(MemBlock::get_grow_bytes() + 16 * 1024);
+    {
+        memblock_elastic_t elastic;
+        elastic.max_capacity = 64;
+        elastic.chunk_capacity = 16;
+        MemBlock pool(1024, 16, 64, elastic);
+        std::vector<void*> ptrs(64, nullptr);
+        EXPECT_EQ(pool.alloc_bulk(ptrs.data(), 64), 32);
+        EXPECT_EQ(pool.capacity(), 32);
+
+        memblock_elastic_stat_t stat;
+        pool.get_elastic_stat(stat);
+        EXPECT_EQ(stat.grow_cnt, 1U);
+        EXPECT_GE(stat.grow_fail, 1U);
+        ASSERT_EQ(pool.free_bulk(ptrs.data(), 32), 32);
+    }
+    budget->set_value(old_budget);
+}
+
+TEST(MemBlockTest, FixedPoolDoesNotGrow) {
+    MemBlock pool(64, 16);
+    EXPECT_FALSE(pool.is_elastic());
+    std::vector<void*> ptrs(32, nullptr);
+    EXPECT_EQ(pool.alloc_bulk(ptrs.data(), 32), pool.capacity());
+    EXPECT_FALSE(pool.shrink());
+    ASSERT_EQ(pool.free_bulk(ptrs.data(), pool.capacity()), pool.capacity());
+}
+
+TEST(MemBlockTest, AllocTimeout) {
+    // 不用magazine, 归还的块直接回到全局队列
+    MemBlock pool(64, 16);
+    std::vector<void*> ptrs(pool.capacity(), nullptr);
+    ASSERT_EQ(pool.alloc_bulk(ptrs.data(), pool.capacity()), pool.capacity());
+
+    // 没有空闲块, 等到超时
+    void* ptr = nullptr;
+    EXPECT_FALSE(pool.alloc(&ptr, 20));
+
+    // 其他线程归还之后, 挂起的分配被唤醒
+    std::thread waiter([&pool]() {
+        void* p = nullptr;
+        EXPECT_TRUE(pool.alloc(&p, -1));
+        EXPECT_TRUE(pool.free(p));
+    });
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    ASSERT_TRUE(pool.free(ptrs.back()));
+    ptrs.pop_back();
+    waiter.join();
+
+    ASSERT_EQ(pool.free_bulk(ptrs.data(), ptrs.size()), (int)ptrs.size());
+}
+
+int main(int argc, char** argv) {
+    TINYTCP_LOG_NAME("system")->set_level(LogLevel::ERROR);
+    ::testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
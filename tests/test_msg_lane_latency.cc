@@ -0,0 +1,231 @@
+// 工作线程消息通道的优先级: 控制消息(定时器回调, post_to_worker)和收包分在不同的通道
+// 1. 收包打满时控制消息的延迟: 控制消息最多等一轮网卡轮询, 和输入队列里积压了多少包无关
+// 2. 控制消息打满时收包的吞吐: 每轮最多处理tcp.work_ctrl_weight个控制消息, 收包不会被饿死
+// 3. 收包打满时定时器的延迟: 工作线程自己的时间轮, 到期的回调和控制消息一样优先执行
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <thread>
+#include <vector>
+#include "src/net/net.h"
+#include "src/net/pktbuf.h"
+#include "src/config.h"
+#include "src/log.h"
+#include "src/macro.h"
+
+#define BENCH_WORK_ROUNDS   200     // 每个包模拟的处理开销
+#define BENCH_PROBE_CNT     2000
+
+// 只统计收到的包, 每个包模拟一段协议处理的开销
+class BenchNetIF : public tinytcp::INetIF {
+public:
+    BenchNetIF(tinytcp::INetWork* network, const char* name)
+        : INetIF(network, name) {
+    }
+
+    tinytcp::net_err_t link_in(tinytcp::PktBuffer* buf) override {
+        uint32_t h = (uint32_t)m_recv_cnt.load(std::memory_order_relaxed);
+        for (int i = 0; i < BENCH_WORK_ROUNDS; ++i) {
+            h = h * 0x9e3779b1U + (h >> 15);
+        }
+        m_sink.store(h, std::memory_order_relaxed);
+        buf->free();
+        m_recv_cnt.fetch_add(1, std::memory_order_relaxed);
+        return tinytcp::net_err_t::NET_ERR_OK;
+    }
+
+    uint64_t get_recv_cnt() const noexcept { return m_recv_cnt.load(std::memory_order_relaxed); }
+
+private:
+    std::atomic<uint64_t> m_recv_cnt{0};
+    std::atomic<uint32_t> m_sink{0};
+};
+
+static uint64_t now_ns() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// 一直往输入队列里放包, 直到stop
+static void flood_pkts(BenchNetIF* netif, std::atomic<bool>* stop) {
+    auto pktmgr = tinytcp::PktMgr::get_instance();
+    while (!stop->load(std::memory_order_relaxed)) {
+        tinytcp::PktBuffer* buf = pktmgr->get_pktbuffer();
+        if (buf == nullptr || !buf->alloc_rx(60)) {
+            if (buf != nullptr) {
+                buf->free();
+            }
+            std::this_thread::yield();
+            continue;
+        }
+        if ((int8_t)netif->put_buf_to_in_queue(buf, 0) < 0) {
+            buf->free();
+            std::this_thread::yield();
+        }
+    }
+}
+
+static void print_lane_stat(const tinytcp::net_poll_stat_t& stat, const tinytcp::net_poll_stat_t& stat_begin) {
+    std::cout << "\tctrl_msgs=" << stat.lane_msgs[tinytcp::NET_MSG_LANE_CTRL] - stat_begin.lane_msgs[tinytcp::NET_MSG_LANE_CTRL]
+              << "\tctrl_deferred=" << stat.lane_deferred[tinytcp::NET_MSG_LANE_CTRL] - stat_begin.lane_deferred[tinytcp::NET_MSG_LANE_CTRL]
+              << "\tdata_msgs=" << stat.lane_msgs[tinytcp::NET_MSG_LANE_DATA] - stat_begin.lane_msgs[tinytcp::NET_MSG_LANE_DATA]
+              << "\tpkts=" << stat.pkts - stat_begin.pkts << std::endl;
+}
+
+// 收包打满时, 从发出控制消息到工作线程执行的延迟
+static void bench_ctrl_latency(tinytcp::ProtocolStack& stack, uint32_t budget) {
+    tinytcp::Config::look_up<uint32_t>("tcp.netif_in_budget")->set_value(budget);
+    BenchNetIF netif(stack.get_network(), "bench");
+    tinytcp::net_poll_stat_t stat_begin;
+    stack.get_poll_stat(stat_begin);
+
+    std::atomic<bool> stop{false};
+    std::thread producer(flood_pkts, &netif, &stop);
+    // 输入队列里有积压之后再开始测
+    while (netif.get_in_queue_size(0) == 0) {
+        std::this_thread::yield();
+    }
+
+    std::vector<uint64_t> latencies;
+    latencies.reserve(BENCH_PROBE_CNT);
+    std::atomic<uint64_t> done{0};
+    std::atomic<uint64_t> latency{0};
+    for (uint32_t i = 0; i < BENCH_PROBE_CNT; ++i) {
+        uint64_t begin = now_ns();
+        auto probe = [begin, &done, &latency]() {
+            latency.store(now_ns() - begin, std::memory_order_relaxed);
+            done.fetch_add(1, std::memory_order_release);
+        };
+        if ((int8_t)stack.post_to_worker(0, probe) < 0) {
+            continue;
+        }
+        while (done.load(std::memory_order_acquire) <= i) {
+            std::this_thread::yield();
+        }
+        latencies.push_back(latency.load(std::memory_order_relaxed));
+    }
+    stop.store(true, std::memory_order_relaxed);
+    producer.join();
+
+    std::sort(latencies.begin(), latencies.end());
+    size_t cnt = latencies.size();
+    std::cout << "ctrl latency under pkt flood, budget=" << budget
+              << "\tcnt=" << cnt
+              << "\tp50_us=" << (cnt ? latencies[cnt / 2] / 1000 : 0)
+              << "\tp99_us=" << (cnt ? latencies[cnt * 99 / 100] / 1000 : 0)
+              << "\tmax_us=" << (cnt ? latencies[cnt - 1] / 1000 : 0)
+              << "\tin_queue=" << netif.get_in_queue_size(0) << std::endl;
+    tinytcp::net_poll_stat_t stat;
+    stack.get_poll_stat(stat);
+    print_lane_stat(stat, stat_begin);
+    tinytcp::net_err_t err = stack.drain_netif(&netif);
+    TINYTCP_ASSERT2(err == tinytcp::net_err_t::NET_ERR_OK, "drain_netif error");
+}
+
+// 收包打满时, 工作线程上的定时器比设定的时间晚了多久
+static void bench_timer_lateness(tinytcp::ProtocolStack& stack) {
+    tinytcp::Config::look_up<uint32_t>("tcp.netif_in_budget")->set_value(64);
+    BenchNetIF netif(stack.get_network(), "bench");
+    std::atomic<bool> stop{false};
+    std::thread producer(flood_pkts, &netif, &stop);
+
+    const uint32_t probe_cnt = 200;
+    const uint64_t timeout_ms = 5;
+    std::vector<uint64_t> lateness;
+    lateness.reserve(probe_cnt);
+    std::atomic<uint64_t> done{0};
+    std::atomic<uint64_t> late{0};
+    for (uint32_t i = 0; i < probe_cnt; ++i) {
+        // 在工作线程中添加, 从添加时开始计时
+        auto probe = [&stack, &done, &late, timeout_ms]() {
+            uint64_t expect = now_ns() + timeout_ms * 1000000;
+            stack.add_timer(timeout_ms, [expect, &done, &late]() {
+                uint64_t now = now_ns();
+                late.store(now > expect ? now - expect : 0, std::memory_order_relaxed);
+                done.fetch_add(1, std::memory_order_release);
+            });
+        };
+        if ((int8_t)stack.post_to_worker(0, probe) < 0) {
+            continue;
+        }
+        while (done.load(std::memory_order_acquire) <= i) {
+            std::this_thread::yield();
+        }
+        lateness.push_back(late.load(std::memory_order_relaxed));
+    }
+    stop.store(true, std::memory_order_relaxed);
+    producer.join();
+
+    std::sort(lateness.begin(), lateness.end());
+    size_t cnt = lateness.size();
+    std::cout << "timer lateness under pkt flood, timeout_ms=" << timeout_ms
+              << "\tcnt=" << cnt
+              << "\tp50_us=" << (cnt ? lateness[cnt / 2] / 1000 : 0)
+              << "\tp99_us=" << (cnt ? lateness[cnt * 99 / 100] / 1000 : 0)
+              << "\tmax_us=" << (cnt ? lateness[cnt - 1] / 1000 : 0) << std::endl;
+    tinytcp::net_err_t err = stack.drain_netif(&netif);
+    TINYTCP_ASSERT2(err == tinytcp::net_err_t::NET_ERR_OK, "drain_netif error");
+}
+
+// 控制消息打满时的收包吞吐
+static void bench_pkt_pps(tinytcp::ProtocolStack& stack, uint32_t ctrl_weight) {
+    tinytcp::Config::look_up<uint32_t>("tcp.work_ctrl_weight")->set_value(ctrl_weight);
+    tinytcp::Config::look_up<uint32_t>("tcp.netif_in_budget")->set_value(64);
+    BenchNetIF netif(stack.get_network(), "bench");
+    tinytcp::net_poll_stat_t stat_begin;
+    stack.get_poll_stat(stat_begin);
+
+    std::atomic<bool> stop{false};
+    std::atomic<uint32_t> sink{0};
+    std::thread ctrl_flood([&stack, &stop, &sink]() {
+        while (!stop.load(std::memory_order_relaxed)) {
+            auto work = [&sink]() {
+                uint32_t h = sink.load(std::memory_order_relaxed);
+                for (int i = 0; i < BENCH_WORK_ROUNDS; ++i) {
+                    h = h * 0x9e3779b1U + (h >> 15);
+                }
+                sink.store(h, std::memory_order_relaxed);
+            };
+            if ((int8_t)stack.post_to_worker(0, work) < 0) {
+                std::this_thread::yield();
+            }
+        }
+    });
+    std::thread producer(flood_pkts, &netif, &stop);
+
+    uint64_t recv_begin = netif.get_recv_cnt();
+    auto begin = std::chrono::steady_clock::now();
+    std::this_thread::sleep_for(std::chrono::milliseconds(500));
+    uint64_t recv = netif.get_recv_cnt() - recv_begin;
+    double sec = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+    stop.store(true, std::memory_order_relaxed);
+    producer.join();
+    ctrl_flood.join();
+
+    std::cout << "pkt pps under ctrl flood, ctrl_weight=" << ctrl_weight
+              << "\tpps=" << (uint64_t)(recv / sec) << std::endl;
+    tinytcp::net_poll_stat_t stat;
+    stack.get_poll_stat(stat);
+    print_lane_stat(stat, stat_begin);
+    tinytcp::net_err_t err = stack.drain_netif(&netif);
+    TINYTCP_ASSERT2(err == tinytcp::net_err_t::NET_ERR_OK, "drain_netif error");
+}
+
+int main() {
+    TINYTCP_LOG_NAME("system")->set_level(tinytcp::LogLevel::ERROR);
+    TINYTCP_LOG_ROOT()->set_level(tinytcp::LogLevel::ERROR);
+    tinytcp::PktMgr::get_instance();
+    tinytcp::ProtocolStack stack;
+
+    std::cout << "hardware_concurrency=" << std::thread::hardware_concurrency() << std::endl;
+    for (uint32_t budget : {64U, 256U}) {
+        bench_ctrl_latency(stack, budget);
+    }
+    bench_timer_lateness(stack);
+    for (uint32_t ctrl_weight : {1U, 16U, 128U}) {
+        bench_pkt_pps(stack, ctrl_weight);
+    }
+    return 0;
+}
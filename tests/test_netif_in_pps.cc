@@ -0,0 +1,124 @@
+// 收包线程 -> 网卡输入队列 -> 工作线程 的吞吐(pps)
+// 对比每个包发一个NETIF_IN消息 和 队列从空变成非空时才发消息(tcp.netif_in_coalesce)
+// 每包一个消息时, 消息池和消息队列很快被占满, 通知被丢掉, 有的包会一直留在输入队列里等下一个包
+
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <thread>
+#include <time.h>
+#include "src/net/net.h"
+#include "src/net/pktbuf.h"
+#include "src/config.h"
+#include "src/log.h"
+#include "src/macro.h"
+
+// 只统计收到的包, 不走协议解析
+class BenchNetIF : public tinytcp::INetIF {
+public:
+    BenchNetIF(tinytcp::INetWork* network, const char* name)
+        : INetIF(network, name) {
+    }
+
+    tinytcp::net_err_t link_in(tinytcp::PktBuffer* buf) override {
+        buf->free();
+        m_recv_cnt.fetch_add(1, std::memory_order_relaxed);
+        return tinytcp::net_err_t::NET_ERR_OK;
+    }
+
+    uint64_t get_recv_cnt() const noexcept { return m_recv_cnt.load(std::memory_order_relaxed); }
+
+private:
+    std::atomic<uint64_t> m_recv_cnt{0};
+};
+
+static void bench(tinytcp::ProtocolStack& stack, bool coalesce, uint32_t loop) {
+    auto config = tinytcp::Config::look_up<bool>("tcp.netif_in_coalesce");
+    config->set_value(coalesce);
+    auto pktmgr = tinytcp::PktMgr::get_instance();
+    BenchNetIF netif(stack.get_network(), "bench");
+    tinytcp::net_poll_stat_t stat_begin;
+    stack.get_poll_stat(stat_begin);
+
+    uint64_t queued = 0;
+    uint64_t dropped = 0;
+    auto begin = std::chrono::steady_clock::now();
+    for (uint32_t i = 0; i < loop; ++i) {
+        tinytcp::PktBuffer* buf = pktmgr->get_pktbuffer();
+        if (buf == nullptr || !buf->alloc_rx(60)) {
+            if (buf != nullptr) {
+                buf->free();
+            }
+            ++dropped;
+            std::this_thread::yield();
+            continue;
+        }
+        if ((int8_t)netif.put_buf_to_in_queue(buf, 0) < 0) {
+            buf->free();
+            ++dropped;
+            std::this_thread::yield();
+            continue;
+        }
+        ++queued;
+    }
+    // 等工作线程处理完, 通知丢失的包会一直留在队列里, 等一段时间之后算作滞留
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(500);
+    while (netif.get_recv_cnt() < queued && std::chrono::steady_clock::now() < deadline) {
+        std::this_thread::yield();
+    }
+    auto end = std::chrono::steady_clock::now();
+    uint64_t recv_cnt = netif.get_recv_cnt();
+    double sec = std::chrono::duration<double>(end - begin).count();
+
+    std::cout << (coalesce ? "coalesce" : "per_pkt ")
+              << "\tpps=" << (uint64_t)(recv_cnt / sec)
+              << "\trecv=" << recv_cnt
+              << "\tdropped=" << dropped
+              << "\tstranded=" << queued - recv_cnt << std::endl;
+
+    // 每轮处理的包数分布, 大部分落在最后一个桶说明预算偏小, 都在前面的桶说明收包跟不上
+    tinytcp::net_poll_stat_t stat;
+    stack.get_poll_stat(stat);
+    uint64_t rounds = stat.rounds - stat_begin.rounds;
+    std::cout << "\trounds=" << rounds
+              << "\tpkts/round=" << (rounds ? (double)(stat.pkts - stat_begin.pkts) / rounds : 0)
+              << "\tbudget_exhausted=" << stat.budget_exhausted - stat_begin.budget_exhausted
+              << "\tspin_hit=" << stat.spin_hit - stat_begin.spin_hit
+              << "\tpark=" << stat.park - stat_begin.park
+              << "\tbatch_hist=";
+    for (int i = 0; i < NET_POLL_HIST_SIZE; ++i) {
+        std::cout << (i ? "," : "") << (1 << i) << (i + 1 == NET_POLL_HIST_SIZE ? "+:" : ":")
+                  << stat.batch_hist[i] - stat_begin.batch_hist[i];
+    }
+    std::cout << std::endl;
+    // 滞留的包由工作线程释放, 工作线程都不再引用网卡之后再析构
+    tinytcp::net_err_t err = stack.drain_netif(&netif);
+    TINYTCP_ASSERT2(err == tinytcp::net_err_t::NET_ERR_OK, "drain_netif error");
+}
+
+int main() {
+    TINYTCP_LOG_NAME("system")->set_level(tinytcp::LogLevel::ERROR);
+    TINYTCP_LOG_ROOT()->set_level(tinytcp::LogLevel::ERROR);
+    tinytcp::PktMgr::get_instance();
+    tinytcp::ProtocolStack stack;
+
+    const uint32_t loop = 1000000;
+    bench(stack, false, loop);
+    bench(stack, true, loop);
+    // 预算对批量大小和吞吐的影响
+    auto budget = tinytcp::Config::look_up<uint32_t>("tcp.netif_in_budget");
+    for (uint32_t value : {16U, 256U}) {
+        budget->set_value(value);
+        std::cout << "budget=" << value << std::endl;
+        bench(stack, true, loop);
+    }
+
+    // 空闲时工作线程和定时器线程都应该挂起, 整个进程几乎不占CPU
+    timespec cpu_begin, cpu_end;
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &cpu_begin);
+    std::this_thread::sleep_for(std::chrono::seconds(1));
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &cpu_end);
+    double cpu_ms = (cpu_end.tv_sec - cpu_begin.tv_sec) * 1e3 + (cpu_end.tv_nsec - cpu_begin.tv_nsec) / 1e6;
+    std::cout << "idle 1s, cpu_ms=" << cpu_ms << std::endl;
+    return 0;
+}
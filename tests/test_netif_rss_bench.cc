@@ -0,0 +1,147 @@
+// 多工作线程按流分发(软件RSS)的环回吞吐: tcp.work_thread_cnt = 1, 2, 4
+// 收包线程构造带IPv4/UDP包头的包放进环回网卡, 按流的哈希分到各个工作线程,
+// 每个包模拟一段协议处理的开销, 工作线程越多总吞吐越高, 同时检查同一个流始终在同一个工作线程处理
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <thread>
+#include <vector>
+#include "src/net/net.h"
+#include "src/net/pktbuf.h"
+#include "src/net/pktview.h"
+#include "src/config.h"
+#include "src/log.h"
+#include "src/macro.h"
+
+#define BENCH_FLOW_CNT      256
+#define BENCH_WORK_ROUNDS   200     // 每个包模拟的处理开销
+#define BENCH_NO_OWNER      0xFFFFFFFFU
+
+// 环回网卡, 只统计收到的包, 记录每个流由哪个工作线程处理
+class BenchLoopNet : public tinytcp::LoopNet {
+public:
+    BenchLoopNet(tinytcp::INetWork* network, const char* name)
+        : LoopNet(network, name) {
+        for (auto& owner : m_flow_owner) {
+            owner.store(BENCH_NO_OWNER, std::memory_order_relaxed);
+        }
+    }
+
+    tinytcp::net_err_t link_in(tinytcp::PktBuffer* buf) override {
+        tinytcp::PktView view(buf);
+        uint16_t src_port = 0;
+        view.read_be16(20, src_port);
+        // 模拟协议处理
+        uint32_t h = src_port;
+        for (int i = 0; i < BENCH_WORK_ROUNDS; ++i) {
+            h = h * 0x9e3779b1U + (h >> 15);
+        }
+        m_sink.store(h, std::memory_order_relaxed);
+
+        uint32_t worker = tinytcp::ProtocolStack::get_current_worker();
+        uint32_t expect = BENCH_NO_OWNER;
+        auto& owner = m_flow_owner[src_port % BENCH_FLOW_CNT];
+        if (!owner.compare_exchange_strong(expect, worker, std::memory_order_relaxed) && expect != worker) {
+            m_flow_moved.fetch_add(1, std::memory_order_relaxed);
+        }
+        buf->free();
+        m_recv_cnt.fetch_add(1, std::memory_order_relaxed);
+        return tinytcp::net_err_t::NET_ERR_OK;
+    }
+
+    uint64_t get_recv_cnt() const noexcept { return m_recv_cnt.load(std::memory_order_relaxed); }
+    uint64_t get_flow_moved() const noexcept { return m_flow_moved.load(std::memory_order_relaxed); }
+
+private:
+    std::atomic<uint64_t> m_recv_cnt{0};
+    std::atomic<uint64_t> m_flow_moved{0};
+    std::atomic<uint32_t> m_sink{0};
+    std::atomic<uint32_t> m_flow_owner[BENCH_FLOW_CNT];
+};
+
+// 20字节IPv4包头 + 8字节UDP包头, 不同的流只有源端口不一样
+static void make_udp_pkt(uint8_t* pkt, uint16_t src_port) {
+    memset(pkt, 0, 28);
+    pkt[0] = 0x45;
+    pkt[9] = 17;
+    pkt[12] = 127; pkt[15] = 1;
+    pkt[16] = 127; pkt[19] = 1;
+    pkt[20] = src_port >> 8;
+    pkt[21] = src_port & 0xFF;
+    pkt[22] = 0x1F;
+    pkt[23] = 0x90;
+}
+
+static void bench(uint32_t worker_cnt, uint32_t loop) {
+    auto config = tinytcp::Config::look_up<uint32_t>("tcp.work_thread_cnt");
+    config->set_value(worker_cnt);
+    // 网卡后构造先析构, 协议栈析构时等工作线程退出
+    auto stack = std::make_unique<tinytcp::ProtocolStack>();
+    auto pktmgr = tinytcp::PktMgr::get_instance();
+    auto netif = std::make_unique<BenchLoopNet>(stack->get_network(), "bench");
+
+    uint8_t pkt[28];
+    uint64_t queued = 0;
+    uint64_t dropped = 0;
+    auto begin = std::chrono::steady_clock::now();
+    for (uint32_t i = 0; i < loop; ++i) {
+        tinytcp::PktBuffer* buf = pktmgr->get_pktbuffer();
+        if (buf == nullptr || !buf->alloc_rx(sizeof(pkt))) {
+            if (buf != nullptr) {
+                buf->free();
+            }
+            ++dropped;
+            std::this_thread::yield();
+            continue;
+        }
+        make_udp_pkt(pkt, (uint16_t)(10000 + i % BENCH_FLOW_CNT));
+        buf->reset_access();
+        buf->write(pkt, sizeof(pkt));
+        if ((int8_t)netif->put_buf_to_in_queue(buf, 0) < 0) {
+            buf->free();
+            ++dropped;
+            std::this_thread::yield();
+            continue;
+        }
+        ++queued;
+    }
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+    while (netif->get_recv_cnt() < queued && std::chrono::steady_clock::now() < deadline) {
+        std::this_thread::yield();
+    }
+    auto end = std::chrono::steady_clock::now();
+    uint64_t recv_cnt = netif->get_recv_cnt();
+    double sec = std::chrono::duration<double>(end - begin).count();
+
+    std::cout << "workers=" << worker_cnt
+              << "\tpps=" << (uint64_t)(recv_cnt / sec)
+              << "\trecv=" << recv_cnt
+              << "\tdropped=" << dropped
+              << "\tflow_moved=" << netif->get_flow_moved()
+              << "\tper_worker=";
+    for (uint32_t i = 0; i < worker_cnt; ++i) {
+        tinytcp::net_poll_stat_t stat;
+        stack->get_poll_stat(i, stat);
+        std::cout << (i ? "," : "") << stat.pkts;
+    }
+    std::cout << std::endl;
+    tinytcp::net_err_t err = stack->drain_netif(netif.get());
+    TINYTCP_ASSERT2(err == tinytcp::net_err_t::NET_ERR_OK, "drain_netif error");
+}
+
+int main() {
+    TINYTCP_LOG_NAME("system")->set_level(tinytcp::LogLevel::ERROR);
+    TINYTCP_LOG_ROOT()->set_level(tinytcp::LogLevel::ERROR);
+    tinytcp::PktMgr::get_instance();
+
+    std::cout << "hardware_concurrency=" << std::thread::hardware_concurrency() << std::endl;
+    const uint32_t loop = 500000;
+    for (uint32_t worker_cnt : {1U, 2U, 4U}) {
+        bench(worker_cnt, loop);
+    }
+    return 0;
+}
@@ -0,0 +1,454 @@
+#include <gtest/gtest.h>
+
+#include <string.h>
+#include <vector>
+#include "src/net/pktbuf.h"
+#include "src/log.h"
+
+
+using namespace tinytcp;
+
+
+class PktBufferTest : public ::testing::Test {
+protected:
+    void SetUp() override {
+        m_pktmgr = PktMgr::get_instance();
+        m_free_blk = m_pktmgr->get_blk_list_size();
+        m_free_buf = m_pktmgr->get_buf_list_size();
+        m_free_desc = m_pktmgr->get_desc_list_size();
+    }
+
+    void TearDown() override {
+        // 每个用例结束之后，数据块和数据包都应该还给管理器
+        EXPECT_EQ(m_pktmgr->get_blk_list_size(), m_free_blk);
+        EXPECT_EQ(m_pktmgr->get_buf_list_size(), m_free_buf);
+        EXPECT_EQ(m_pktmgr->get_desc_list_size(), m_free_desc);
+    }
+
+    // 写入递增的数据，方便校验
+    static void write_pattern(PktBuffer* buf, uint32_t size, uint8_t start = 0) {
+        std::vector<uint8_t> data(size);
+        for (uint32_t i = 0; i < size; ++i) {
+            data[i] = (uint8_t)(start + i);
+        }
+        buf->reset_access();
+        ASSERT_EQ(buf->write(data.data(), size), net_err_t::NET_ERR_OK);
+    }
+
+    static void check_pattern(PktBuffer* buf, uint32_t offset, uint32_t size, uint8_t start = 0) {
+        std::vector<uint8_t> data(size);
+        buf->reset_access();
+        ASSERT_EQ(buf->seek(offset), net_err_t::NET_ERR_OK);
+        ASSERT_EQ(buf->read(data.data(), size), net_err_t::NET_ERR_OK);
+        for (uint32_t i = 0; i < size; ++i) {
+            ASSERT_EQ(data[i], (uint8_t)(start + i)) << "index=" << i;
+        }
+    }
+
+    // 链表上所有块的大小之和要和容量一致
+    static void check_chain(PktBuffer* buf) {
+        uint32_t total = 0;
+        uint32_t cnt = 0;
+        PktBlock* prev = nullptr;
+        for (PktBlock* blk = buf->get_first_blk(); blk != nullptr; blk = blk->get_next()) {
+            EXPECT_EQ(blk->get_prev(), prev);
+            total += blk->get_size();
+            prev = blk;
+            ++cnt;
+        }
+        EXPECT_EQ(prev, buf->get_last_blk());
+        EXPECT_EQ(cnt, buf->get_blk_cnt());
+        EXPECT_EQ(total, buf->get_capacity());
+    }
+
+    PktManager* m_pktmgr;
+    uint32_t m_free_blk;
+    uint32_t m_free_buf;
+    uint32_t m_free_desc;
+};
+
+TEST_F(PktBufferTest, AllocWriteRead) {
+    PktBuffer* buf = m_pktmgr->get_pktbuffer();
+    ASSERT_NE(buf, nullptr);
+    ASSERT_TRUE(buf->alloc(3000));
+    check_chain(buf);
+    write_pattern(buf, 3000);
+    check_pattern(buf, 0, 3000);
+    check_pattern(buf, 1500, 1000, (uint8_t)1500);
+    buf->free();
+}
+
+TEST_F(PktBufferTest, HeaderAddRemove) {
+    PktBuffer* buf = m_pktmgr->get_pktbuffer();
+    ASSERT_TRUE(buf->alloc(2000));
+    for (int i = 0; i < 10; ++i) {
+        ASSERT_EQ(buf->alloc_header(200, i % 2 == 0), net_err_t::NET_ERR_OK);
+        check_chain(buf);
+    }
+    EXPECT_EQ(buf->get_capacity(), 4000U);
+    for (int i = 0; i < 10; ++i) {
+        ASSERT_EQ(buf->remove_header(200), net_err_t::NET_ERR_OK);
+        check_chain(buf);
+    }
+    EXPECT_EQ(buf->get_capacity(), 2000U);
+    buf->free();
+}
+
+TEST_F(PktBufferTest, Resize) {
+    PktBuffer* buf = m_pktmgr->get_pktbuffer();
+    ASSERT_TRUE(buf->alloc(100));
+    for (uint32_t size : {200U, 2000U, 4000U, 1000U, 100U, 3000U, 7000U}) {
+        ASSERT_EQ(buf->resize(size), net_err_t::NET_ERR_OK);
+        EXPECT_EQ(buf->get_capacity(), size);
+        check_chain(buf);
+    }
+    buf->free();
+}
+
+TEST_F(PktBufferTest, MergeAndContHeader) {
+    PktBuffer* buf_1 = m_pktmgr->get_pktbuffer();
+    PktBuffer* buf_2 = m_pktmgr->get_pktbuffer();
+    ASSERT_TRUE(buf_1->alloc(3000));
+    ASSERT_TRUE(buf_2->alloc(5000));
+    write_pattern(buf_1, 3000);
+    write_pattern(buf_2, 5000, (uint8_t)3000);
+    ASSERT_EQ(buf_1->merge_buf(buf_2), net_err_t::NET_ERR_OK);
+    check_chain(buf_1);
+    EXPECT_EQ(buf_1->get_capacity(), 8000U);
+
+    ASSERT_EQ(buf_1->set_cont_header(1000), net_err_t::NET_ERR_OK);
+    EXPECT_GE(buf_1->get_first_blk()->get_size(), 1000U);
+    check_chain(buf_1);
+    check_pattern(buf_1, 0, 8000);
+    buf_1->free();
+}
+
+TEST_F(PktBufferTest, CopyAndFill) {
+    PktBuffer* src = m_pktmgr->get_pktbuffer();
+    ASSERT_TRUE(src->alloc(256));
+    write_pattern(src, 256);
+
+    PktBuffer* dest = m_pktmgr->get_pktbuffer();
+    ASSERT_TRUE(dest->alloc(256));
+    ASSERT_EQ(dest->seek(40), net_err_t::NET_ERR_OK);
+    src->reset_access();
+    ASSERT_EQ(dest->copy(src, 100), net_err_t::NET_ERR_OK);
+    ASSERT_EQ(dest->fill(233, dest->total_blk_remain()), net_err_t::NET_ERR_OK);
+    check_pattern(dest, 40, 100);
+
+    src->free();
+    dest->free();
+}
+
+TEST_F(PktBufferTest, SizeClassBestFit) {
+    uint32_t small = m_pktmgr->get_min_blk_size();
+    uint32_t large = m_pktmgr->get_max_blk_size();
+
+    // 小包只占用一个最小等级的数据块
+    PktBuffer* buf = m_pktmgr->get_pktbuffer();
+    ASSERT_TRUE(buf->alloc(60));
+    ASSERT_EQ(buf->get_blk_cnt(), 1U);
+    EXPECT_EQ(buf->get_first_blk()->get_capacity(), small);
+    buf->free();
+
+    // 一个完整的以太网帧放在一个连续的数据块中
+    buf = m_pktmgr->get_pktbuffer();
+    ASSERT_TRUE(buf->alloc(1514));
+    ASSERT_EQ(buf->get_blk_cnt(), 1U);
+    EXPECT_EQ(buf->get_first_blk()->get_capacity(), m_pktmgr->get_class_blk_size(m_pktmgr->best_fit_class(1514)));
+    ASSERT_EQ(buf->set_cont_header(1514), net_err_t::NET_ERR_OK);
+    buf->free();
+
+    // 比最大等级还大的包, 用最大等级的块串起来
+    buf = m_pktmgr->get_pktbuffer();
+    ASSERT_TRUE(buf->alloc(large * 2 + 100));
+    check_chain(buf);
+    EXPECT_EQ(buf->get_blk_cnt(), 3U);
+    buf->free();
+}
+
+TEST_F(PktBufferTest, BulkChain) {
+    // 64KB的大包由多个最大等级的块组成, 成批分配和释放
+    uint32_t large = m_pktmgr->get_max_blk_size();
+    uint32_t total = 64 * 1024;
+    PktBuffer* buf = m_pktmgr->get_pktbuffer();
+    ASSERT_TRUE(buf->alloc(total));
+    check_chain(buf);
+    EXPECT_EQ(buf->get_blk_cnt(), (total + large - 1) / large);
+    write_pattern(buf, total);
+    check_pattern(buf, 0, total);
+    buf->free();
+
+    PktBlock* blks[4];
+    ASSERT_EQ(m_pktmgr->get_pktblock_bulk(large, blks, 4), 4U);
+    for (int i = 0; i < 4; ++i) {
+        EXPECT_EQ(blks[i]->get_capacity(), large);
+        EXPECT_EQ(m_pktmgr->release_pktblock(blks[i]), net_err_t::NET_ERR_OK);
+    }
+}
+
+TEST_F(PktBufferTest, SizeClassStats) {
+    std::vector<pktblk_class_stat_t> stats;
+    m_pktmgr->get_class_stats(stats);
+    ASSERT_EQ(stats.size(), m_pktmgr->get_class_cnt());
+    uint32_t used = stats[0].used;
+
+    PktBuffer* buf = m_pktmgr->get_pktbuffer();
+    ASSERT_TRUE(buf->alloc(10));
+    m_pktmgr->get_class_stats(stats);
+    EXPECT_EQ(stats[0].used, used + 1);
+    EXPECT_EQ(stats[0].used + stats[0].free, stats[0].capacity);
+    buf->free();
+}
+
+TEST_F(PktBufferTest, HeadroomTailroom) {
+    PktBuffer* buf = m_pktmgr->get_pktbuffer();
+    ASSERT_TRUE(buf->alloc_with_room(28, 128, 18));
+    ASSERT_EQ(buf->get_blk_cnt(), 1U);
+    EXPECT_EQ(buf->get_headroom(), 128U);
+    EXPECT_GE(buf->get_tailroom(), 18U);
+    write_pattern(buf, 28, 14);
+    PktBlock* blk = buf->get_first_blk();
+
+    // 包头和填充都在同一个块里原地完成
+    ASSERT_EQ(buf->resize(46), net_err_t::NET_ERR_OK);
+    ASSERT_EQ(buf->alloc_header(14), net_err_t::NET_ERR_OK);
+    EXPECT_EQ(buf->get_blk_cnt(), 1U);
+    EXPECT_EQ(buf->get_first_blk(), blk);
+    EXPECT_EQ(buf->get_headroom(), 114U);
+    EXPECT_EQ(buf->get_capacity(), 60U);
+    check_chain(buf);
+    check_pattern(buf, 14, 28, 14);
+    buf->free();
+}
+
+TEST_F(PktBufferTest, RxFrameContiguous) {
+    PktBuffer* buf = m_pktmgr->get_pktbuffer();
+    ASSERT_TRUE(buf->alloc_rx(1514));
+    ASSERT_EQ(buf->get_blk_cnt(), 1U);
+    uint8_t* data = buf->get_data();
+    ASSERT_EQ(buf->set_cont_header(14), net_err_t::NET_ERR_OK);
+    EXPECT_EQ(buf->get_data(), data);
+    buf->free();
+}
+
+TEST_F(PktBufferTest, CloneShared) {
+    PktBuffer* buf = m_pktmgr->get_pktbuffer();
+    ASSERT_TRUE(buf->alloc(3000));
+    write_pattern(buf, 3000);
+    uint32_t free_blk = m_pktmgr->get_blk_list_size();
+
+    // 复制不占用新的数据块, 也不拷贝数据
+    PktBuffer* clone = buf->clone();
+    ASSERT_NE(clone, nullptr);
+    EXPECT_EQ(m_pktmgr->get_blk_list_size(), free_blk);
+    EXPECT_EQ(clone->get_blk_cnt(), buf->get_blk_cnt());
+    EXPECT_EQ(clone->get_first_blk()->get_data(), buf->get_first_blk()->get_data());
+    EXPECT_TRUE(clone->get_first_blk()->is_shared());
+    check_chain(clone);
+    check_pattern(clone, 0, 3000);
+
+    // 原数据包释放之后, 复制出来的数据包仍然有效
+    buf->free();
+    EXPECT_EQ(m_pktmgr->get_blk_list_size(), free_blk);
+    EXPECT_FALSE(clone->get_first_blk()->is_shared());
+    check_pattern(clone, 0, 3000);
+    clone->free();
+}
+
+TEST_F(PktBufferTest, CloneCopyOnWrite) {
+    PktBuffer* buf = m_pktmgr->get_pktbuffer();
+    ASSERT_TRUE(buf->alloc_tx(1000));
+    write_pattern(buf, 1000);
+    PktBuffer* clone = buf->clone();
+    ASSERT_NE(clone, nullptr);
+
+    // 改写复制品的一部分, 只有被写的块会复制, 原数据包不受影响
+    std::vector<uint8_t> data(100, 0xAB);
+    clone->reset_access();
+    ASSERT_EQ(clone->seek(500), net_err_t::NET_ERR_OK);
+    ASSERT_EQ(clone->write(data.data(), 100), net_err_t::NET_ERR_OK);
+    EXPECT_NE(clone->get_first_blk()->get_data(), buf->get_first_blk()->get_data());
+    check_pattern(buf, 0, 1000);
+    check_pattern(clone, 0, 500);
+    check_pattern(clone, 600, 400, (uint8_t)600);
+
+    // 共享的headroom不能原地使用, 加包头时原数据包的数据保持不变
+    PktBuffer* clone_2 = buf->clone();
+    ASSERT_NE(clone_2, nullptr);
+    ASSERT_EQ(clone_2->alloc_header(20), net_err_t::NET_ERR_OK);
+    ASSERT_EQ(clone_2->set_cont_header(40), net_err_t::NET_ERR_OK);
+    memset(clone_2->get_data(), 0xCD, 20);
+    EXPECT_EQ(clone_2->get_capacity(), 1020U);
+    check_chain(clone_2);
+    check_pattern(clone_2, 20, 1000);
+    check_pattern(buf, 0, 1000);
+
+    // 共享的tailroom也不能原地使用
+    ASSERT_EQ(buf->resize(1100), net_err_t::NET_ERR_OK);
+    check_chain(buf);
+    check_pattern(buf, 0, 1000);
+
+    buf->free();
+    clone->free();
+    clone_2->free();
+}
+
+TEST_F(PktBufferTest, CloneContHeader) {
+    PktBuffer* buf = m_pktmgr->get_pktbuffer();
+    ASSERT_TRUE(buf->alloc(3000));
+    write_pattern(buf, 3000);
+    // 共享时headroom不能原地使用, 包头单独占一个块
+    PktBuffer* tmp = buf->clone();
+    ASSERT_NE(tmp, nullptr);
+    ASSERT_EQ(buf->alloc_header(20), net_err_t::NET_ERR_OK);
+    tmp->free();
+    ASSERT_EQ(buf->get_first_blk()->get_size(), 20U);
+    memset(buf->get_data(), 0xCD, 20);
+    PktBuffer* clone = buf->clone();
+    ASSERT_NE(clone, nullptr);
+
+    // 包头已经连续, 不需要改动, 块继续共享
+    ASSERT_EQ(buf->set_cont_header(14), net_err_t::NET_ERR_OK);
+    EXPECT_EQ(buf->get_first_blk()->get_owner(), clone->get_first_blk()->get_owner());
+    EXPECT_TRUE(buf->get_first_blk()->is_shared());
+    check_pattern(clone, 20, 3000);
+
+    // 包头跨块, 只有调整的数据包复制第一个块, 另一个数据包不受影响
+    uint8_t* clone_data = clone->get_data();
+    ASSERT_EQ(clone->set_cont_header(40), net_err_t::NET_ERR_OK);
+    EXPECT_NE(clone->get_first_blk()->get_owner(), buf->get_first_blk()->get_owner());
+    EXPECT_FALSE(buf->get_first_blk()->is_shared());
+    EXPECT_EQ(buf->get_data(), clone_data);
+    EXPECT_EQ(buf->get_first_blk()->get_size(), 20U);
+    check_chain(buf);
+    check_chain(clone);
+    check_pattern(buf, 20, 3000);
+    check_pattern(clone, 20, 3000);
+
+    buf->free();
+    clone->free();
+}
+
+TEST_F(PktBufferTest, Split) {
+    PktBuffer* buf = m_pktmgr->get_pktbuffer();
+    uint32_t large = m_pktmgr->get_max_blk_size();
+    uint32_t total = large * 2 + 1000;
+    ASSERT_TRUE(buf->alloc(total));
+    write_pattern(buf, total);
+    uint32_t free_blk = m_pktmgr->get_blk_list_size();
+
+    // 从块中间切开, 边界块共享, 不占用新的数据块
+    uint32_t first_size = buf->get_first_blk()->get_size();
+    uint32_t offset = first_size + 100;
+    PktBuffer* tail = buf->split(offset);
+    ASSERT_NE(tail, nullptr);
+    EXPECT_EQ(m_pktmgr->get_blk_list_size(), free_blk);
+    EXPECT_EQ(buf->get_capacity(), offset);
+    EXPECT_EQ(tail->get_capacity(), total - offset);
+    EXPECT_TRUE(buf->get_last_blk()->is_shared());
+    EXPECT_EQ(tail->get_first_blk()->get_owner(), buf->get_last_blk()->get_owner());
+    check_chain(buf);
+    check_chain(tail);
+    check_pattern(buf, 0, offset);
+    check_pattern(tail, 0, total - offset, (uint8_t)offset);
+
+    // 在块边界切开, 直接挂链
+    PktBuffer* tail_2 = buf->split(first_size);
+    ASSERT_NE(tail_2, nullptr);
+    EXPECT_EQ(buf->get_blk_cnt(), 1U);
+    EXPECT_EQ(tail_2->get_blk_cnt(), 1U);
+    check_chain(buf);
+    check_chain(tail_2);
+    check_pattern(tail_2, 0, 100, (uint8_t)first_size);
+
+    // 两端切开得到空包, 合并回去数据不变
+    PktBuffer* empty = tail->split(tail->get_capacity());
+    ASSERT_NE(empty, nullptr);
+    EXPECT_EQ(empty->get_capacity(), 0U);
+    EXPECT_EQ(empty->get_blk_cnt(), 0U);
+    ASSERT_EQ(tail_2->merge_buf(tail), net_err_t::NET_ERR_OK);
+    ASSERT_EQ(tail_2->merge_buf(empty), net_err_t::NET_ERR_OK);
+    ASSERT_EQ(buf->merge_buf(tail_2), net_err_t::NET_ERR_OK);
+    check_chain(buf);
+    check_pattern(buf, 0, total);
+
+    EXPECT_EQ(buf->split(total + 1), nullptr);
+    buf->free();
+}
+
+TEST_F(PktBufferTest, ExportIovec) {
+    PktBuffer* buf = m_pktmgr->get_pktbuffer();
+    uint32_t total = m_pktmgr->get_max_blk_size() * 2 + 100;
+    ASSERT_TRUE(buf->alloc(total));
+    write_pattern(buf, total);
+
+    struct iovec iov[8];
+    int cnt = buf->get_iovec(iov, 8);
+    ASSERT_EQ(cnt, (int)buf->get_blk_cnt());
+    uint32_t size = 0;
+    PktBlock* blk = buf->get_first_blk();
+    for (int i = 0; i < cnt; ++i, blk = blk->get_next()) {
+        EXPECT_EQ(iov[i].iov_base, blk->get_data());
+        EXPECT_EQ(iov[i].iov_len, blk->get_size());
+        for (size_t j = 0; j < iov[i].iov_len; ++j) {
+            ASSERT_EQ(((uint8_t*)iov[i].iov_base)[j], (uint8_t)(size + j));
+        }
+        size += iov[i].iov_len;
+    }
+    EXPECT_EQ(size, total);
+
+    // iovec数组不够时返回-1
+    EXPECT_EQ(buf->get_iovec(iov, 1), -1);
+    buf->free();
+}
+struct ext_mem_t {
+    uint8_t data[2000];
+    int free_cnt = 0;
+};
+
+static void ext_mem_free(void* arg, uint8_t* data, uint32_t size) {
+    ext_mem_t* mem = (ext_mem_t*)arg;
+    EXPECT_EQ(data, mem->data);
+    EXPECT_EQ(size, sizeof(mem->data));
+    ++mem->free_cnt;
+}
+
+TEST_F(PktBufferTest, AttachExternal) {
+    ext_mem_t mem;
+    for (uint32_t i = 0; i < sizeof(mem.data); ++i) {
+        mem.data[i] = (uint8_t)i;
+    }
+    pktblk_ext_t ext = {ext_mem_free, &mem};
+    uint32_t free_blk = m_pktmgr->get_blk_list_size();
+
+    // 外部内存直接作为数据块, 不占用池子里的块, 也不拷贝
+    PktBuffer* buf = m_pktmgr->get_pktbuffer();
+    ASSERT_TRUE(buf->attach_ext(mem.data, sizeof(mem.data), &ext));
+    EXPECT_EQ(m_pktmgr->get_blk_list_size(), free_blk);
+    EXPECT_EQ(buf->get_data(), mem.data);
+    EXPECT_EQ(buf->get_capacity(), (uint32_t)sizeof(mem.data));
+    check_pattern(buf, 0, sizeof(mem.data));
+
+    // 解析时去掉包头, 切出来的部分和复制品都引用同一块外部内存
+    ASSERT_EQ(buf->remove_header(14), net_err_t::NET_ERR_OK);
+    PktBuffer* tail = buf->split(1000);
+    ASSERT_NE(tail, nullptr);
+    PktBuffer* clone = tail->clone();
+    ASSERT_NE(clone, nullptr);
+    check_pattern(clone, 0, 986, (uint8_t)1014);
+
+    buf->free();
+    tail->free();
+    EXPECT_EQ(mem.free_cnt, 0);
+    // 最后一个引用释放时才交还外部内存
+    clone->free();
+    EXPECT_EQ(mem.free_cnt, 1);
+}
+
+
+int main(int argc, char** argv) {
+    TINYTCP_LOG_NAME("system")->set_level(LogLevel::ERROR);
+    ::testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
@@ -0,0 +1,98 @@
+// 收包路径的内存分配次数统计: recv -> link_in -> free
+// 重载全局 operator new, 统计每个数据包在热路径上调用了多少次堆分配
+
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <new>
+#include <stdlib.h>
+#include <string.h>
+#include "src/net/netif.h"
+#include "src/net/pktbuf.h"
+#include "src/net/link_layer.h"
+#include "src/net/protocol.h"
+#include "src/endiantool.h"
+#include "src/log.h"
+
+static std::atomic<uint64_t> s_alloc_cnt{0};
+
+void* operator new(size_t size) {
+    s_alloc_cnt.fetch_add(1, std::memory_order_relaxed);
+    void* p = malloc(size);
+    if (p == nullptr) {
+        throw std::bad_alloc();
+    }
+    return p;
+}
+
+void* operator new[](size_t size) {
+    s_alloc_cnt.fetch_add(1, std::memory_order_relaxed);
+    void* p = malloc(size);
+    if (p == nullptr) {
+        throw std::bad_alloc();
+    }
+    return p;
+}
+
+void operator delete(void* p) noexcept { free(p); }
+void operator delete[](void* p) noexcept { free(p); }
+void operator delete(void* p, size_t) noexcept { free(p); }
+void operator delete[](void* p, size_t) noexcept { free(p); }
+
+// 模拟 PcapNetWork::recv_func 收到一帧之后的处理流程
+static bool recv_one(tinytcp::INetIF* netif, const uint8_t* frame, uint32_t len) {
+    auto pktmgr = tinytcp::PktMgr::get_instance();
+    tinytcp::PktBuffer* buf = pktmgr->get_pktbuffer();
+    if (buf == nullptr) {
+        return false;
+    }
+    if (!buf->alloc_rx(len)) {
+        buf->free();
+        return false;
+    }
+    buf->reset_access();
+    buf->write(frame, len);
+    netif->link_in(buf);
+    buf->free();
+    return true;
+}
+
+static void bench(tinytcp::INetIF* netif, uint32_t len, uint32_t loop) {
+    uint8_t frame[9018] = {0};
+    tinytcp::ether_hdr_t* hdr = (tinytcp::ether_hdr_t*)frame;
+    memset(hdr->dest, 0xFF, ETHER_HWA_SIZE);
+    hdr->protocol = tinytcp::host_to_net((uint16_t)tinytcp::NET_PROTOCOL_IPv4);
+
+    // 预热一次, 把单例, 线程局部变量之类的初始化排除在外
+    recv_one(netif, frame, len);
+
+    uint64_t begin_cnt = s_alloc_cnt.load();
+    auto begin = std::chrono::steady_clock::now();
+    for (uint32_t i = 0; i < loop; ++i) {
+        recv_one(netif, frame, len);
+    }
+    auto end = std::chrono::steady_clock::now();
+    uint64_t alloc_cnt = s_alloc_cnt.load() - begin_cnt;
+    uint64_t ns = std::chrono::duration_cast<std::chrono::nanoseconds>(end - begin).count();
+
+    std::cout << "frame_len=" << len
+              << "\tallocs/pkt=" << (double)alloc_cnt / loop
+              << "\tns/pkt=" << (double)ns / loop << std::endl;
+}
+
+int main() {
+    // 热路径上的debug日志本身就会分配内存, 这里只关心数据包本身
+    TINYTCP_LOG_NAME("system")->set_level(tinytcp::LogLevel::ERROR);
+    TINYTCP_LOG_ROOT()->set_level(tinytcp::LogLevel::ERROR);
+
+    tinytcp::PktMgr::get_instance();
+    tinytcp::EtherNet netif(nullptr, "bench");
+
+    const uint32_t loop = 200000;
+    bench(&netif, 60, loop);
+    bench(&netif, 590, loop);
+    bench(&netif, 1514, loop);
+    bench(&netif, 4000, loop);
+
+    return 0;
+}
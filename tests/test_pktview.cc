@@ -0,0 +1,106 @@
+#include <gtest/gtest.h>
+
+#include <vector>
+#include "src/net/pktbuf.h"
+#include "src/net/pktview.h"
+#include "src/log.h"
+
+
+using namespace tinytcp;
+
+
+class PktViewTest : public ::testing::Test {
+protected:
+    void SetUp() override {
+        m_pktmgr = PktMgr::get_instance();
+        // 跨块的数据包: 用最大等级的块拼起来, 数据是递增序列
+        m_size = m_pktmgr->get_max_blk_size() * 2 + 100;
+        m_buf = m_pktmgr->get_pktbuffer();
+        ASSERT_NE(m_buf, nullptr);
+        ASSERT_TRUE(m_buf->alloc(m_size));
+        std::vector<uint8_t> data(m_size);
+        for (uint32_t i = 0; i < m_size; ++i) {
+            data[i] = (uint8_t)i;
+        }
+        m_buf->reset_access();
+        ASSERT_EQ(m_buf->write(data.data(), m_size), net_err_t::NET_ERR_OK);
+        m_first_size = m_buf->get_first_blk()->get_size();
+    }
+
+    void TearDown() override {
+        m_buf->free();
+    }
+
+    PktManager* m_pktmgr;
+    PktBuffer* m_buf;
+    uint32_t m_size;
+    uint32_t m_first_size;
+};
+
+TEST_F(PktViewTest, SpanInOneBlock) {
+    PktView view(m_buf);
+    EXPECT_EQ(view.size(), m_size);
+    const uint8_t* ptr = view.span(10, 20);
+    ASSERT_NE(ptr, nullptr);
+    EXPECT_EQ(ptr, m_buf->get_first_blk()->get_data() + 10);
+
+    // 跨块的范围不能直接返回指针
+    EXPECT_EQ(view.span(m_first_size - 2, 4), nullptr);
+    EXPECT_EQ(view.span(m_size - 1, 2), nullptr);
+}
+
+TEST_F(PktViewTest, PeekAcrossBlocks) {
+    PktView view(m_buf);
+    uint8_t data[8];
+    uint32_t offset = m_first_size - 4;
+    ASSERT_TRUE(view.peek(offset, data, sizeof(data)));
+    for (uint32_t i = 0; i < sizeof(data); ++i) {
+        EXPECT_EQ(data[i], (uint8_t)(offset + i));
+    }
+
+    uint16_t v16 = 0;
+    ASSERT_TRUE(view.read_be16(offset + 3, v16));
+    EXPECT_EQ(v16, (uint16_t)(((uint8_t)(offset + 3) << 8) | (uint8_t)(offset + 4)));
+    uint32_t v32 = 0;
+    ASSERT_TRUE(view.read_be32(0, v32));
+    EXPECT_EQ(v32, 0x00010203U);
+    EXPECT_FALSE(view.read_be32(m_size - 3, v32));
+}
+
+TEST_F(PktViewTest, SubViewAndAdvance) {
+    PktView view(m_buf);
+    PktView payload = view.advance(m_first_size + 10);
+    EXPECT_EQ(payload.size(), m_size - m_first_size - 10);
+    uint8_t v = 0;
+    ASSERT_TRUE(payload.peek(0, v));
+    EXPECT_EQ(v, (uint8_t)(m_first_size + 10));
+
+    PktView part(m_buf, 100, 50);
+    EXPECT_EQ(part.size(), 50U);
+    ASSERT_TRUE(part.peek(49, v));
+    EXPECT_EQ(v, (uint8_t)149);
+    EXPECT_FALSE(part.peek(50, v));
+
+    EXPECT_TRUE(view.sub(m_size, 1).empty());
+    EXPECT_TRUE(PktView(m_buf, m_size - 1, 2).empty());
+}
+
+TEST_F(PktViewTest, ReadOnly) {
+    // 视图不改变数据包的读写位置, 多个视图互不影响
+    ASSERT_EQ(m_buf->seek(30), net_err_t::NET_ERR_OK);
+    PktView view_1(m_buf);
+    PktView view_2 = view_1.advance(5);
+    uint8_t v_1 = 0, v_2 = 0;
+    ASSERT_TRUE(view_1.peek(0, v_1));
+    ASSERT_TRUE(view_2.peek(0, v_2));
+    EXPECT_EQ(v_1, 0);
+    EXPECT_EQ(v_2, 5);
+    EXPECT_EQ(m_buf->get_pos(), 30U);
+}
+
+
+int main(int argc, char** argv) {
+    TINYTCP_LOG_NAME("system")->set_level(LogLevel::ERROR);
+    ::testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
@@ -0,0 +1,177 @@
+// 环形队列的吞吐和延迟: 每个槽位带序号的MPMC队列 和 原来按m_last_write_index排队确认的实现对比
+// 原来的实现每个生产者都要等前面的生产者确认写入, 生产者越多(或者被抢占)越慢
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <memory>
+#include <thread>
+#include <vector>
+#include "src/lock_free_ring_queue.h"
+#include "src/spsc_ring_queue.h"
+
+// 原来的实现, 只保留try push/pop, 用来对比
+template <typename T>
+class LegacyRingQueue {
+public:
+    explicit LegacyRingQueue(uint32_t size)
+        : m_size(size), m_length(0U), m_read_index(0U), m_write_index(0U), m_last_write_index(0U),
+          m_queue(std::make_unique<T[]>(size)) {
+    }
+
+    bool push(const T& data) {
+        uint32_t current_read_index;
+        uint32_t current_write_index;
+        do {
+            current_read_index  = m_read_index.load(std::memory_order_relaxed);
+            current_write_index = m_write_index.load(std::memory_order_relaxed);
+            if (index_of_queue(current_write_index + 1U) == index_of_queue(current_read_index)) {
+                return false;
+            }
+        } while (!m_write_index.compare_exchange_weak(current_write_index, current_write_index + 1U,
+                                                      std::memory_order_release, std::memory_order_relaxed));
+        m_queue[index_of_queue(current_write_index)] = data;
+        while (!m_last_write_index.compare_exchange_weak(current_write_index, current_write_index + 1U,
+                                                         std::memory_order_release, std::memory_order_relaxed)) {
+            std::this_thread::yield();
+        }
+        m_length.fetch_add(1U, std::memory_order_relaxed);
+        return true;
+    }
+
+    bool pop(T* data) {
+        uint32_t current_read_index;
+        uint32_t current_last_write_index;
+        do {
+            current_read_index = m_read_index.load(std::memory_order_relaxed);
+            current_last_write_index = m_last_write_index.load(std::memory_order_relaxed);
+            if (index_of_queue(current_last_write_index) == index_of_queue(current_read_index)) {
+                return false;
+            }
+            *data = m_queue[index_of_queue(current_read_index)];
+            if (m_read_index.compare_exchange_weak(current_read_index, current_read_index + 1U,
+                                                   std::memory_order_release, std::memory_order_relaxed)) {
+                m_length.fetch_sub(1U, std::memory_order_relaxed);
+                return true;
+            }
+        } while (true);
+    }
+
+private:
+    uint32_t index_of_queue(uint32_t index) const noexcept { return index & (m_size - 1U); }
+
+private:
+    const uint32_t m_size;
+    std::atomic<uint32_t> m_length;
+    std::atomic<uint32_t> m_read_index;
+    std::atomic<uint32_t> m_write_index;
+    std::atomic<uint32_t> m_last_write_index;
+    std::unique_ptr<T[]> m_queue;
+};
+
+struct bench_result_t {
+    double mops;      // 每秒百万次(入队+出队算一次)
+    uint64_t p50_ns;  // 入队到出队的延迟
+    uint64_t p99_ns;
+};
+
+static uint64_t now_ns() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// producer_cnt个生产者各入队loop个时间戳, consumer_cnt个消费者取出并记录延迟
+template <typename Queue>
+static bench_result_t run_bench(Queue& queue, int producer_cnt, int consumer_cnt, uint32_t loop) {
+    std::atomic<bool> start{false};
+    std::atomic<uint64_t> consumed{0};
+    const uint64_t total = (uint64_t)loop * producer_cnt;
+    std::vector<std::vector<uint64_t> > latencies(consumer_cnt);
+    std::vector<std::thread> threads;
+
+    for (int i = 0; i < consumer_cnt; ++i) {
+        threads.emplace_back([&, i]() {
+            auto& lat = latencies[i];
+            lat.reserve(total / consumer_cnt + 1);
+            while (!start.load(std::memory_order_acquire)) {
+                std::this_thread::yield();
+            }
+            uint64_t ts;
+            while (consumed.load(std::memory_order_relaxed) < total) {
+                if (!queue.pop(&ts)) {
+                    std::this_thread::yield();
+                    continue;
+                }
+                lat.push_back(now_ns() - ts);
+                consumed.fetch_add(1, std::memory_order_relaxed);
+            }
+        });
+    }
+    for (int i = 0; i < producer_cnt; ++i) {
+        threads.emplace_back([&]() {
+            while (!start.load(std::memory_order_acquire)) {
+                std::this_thread::yield();
+            }
+            for (uint32_t j = 0; j < loop; ++j) {
+                while (!queue.push(now_ns())) {
+                    std::this_thread::yield();
+                }
+            }
+        });
+    }
+
+    auto begin = std::chrono::steady_clock::now();
+    start.store(true, std::memory_order_release);
+    for (auto& t : threads) {
+        t.join();
+    }
+    auto end = std::chrono::steady_clock::now();
+
+    std::vector<uint64_t> all;
+    for (auto& lat : latencies) {
+        all.insert(all.end(), lat.begin(), lat.end());
+    }
+    std::sort(all.begin(), all.end());
+    bench_result_t result;
+    double sec = std::chrono::duration<double>(end - begin).count();
+    result.mops   = (double)total / sec / 1e6;
+    result.p50_ns = all.empty() ? 0 : all[all.size() / 2];
+    result.p99_ns = all.empty() ? 0 : all[all.size() * 99 / 100];
+    return result;
+}
+
+static void print_result(const char* name, int producer_cnt, int consumer_cnt, const bench_result_t& result) {
+    std::cout << name
+              << "\tproducers=" << producer_cnt
+              << "\tconsumers=" << consumer_cnt
+              << "\tMops/s=" << result.mops
+              << "\tp50_ns=" << result.p50_ns
+              << "\tp99_ns=" << result.p99_ns << std::endl;
+}
+
+int main() {
+    const uint32_t queue_size = 1024;
+    const uint32_t loop = 200000;
+    int max_thread = std::max(2U, std::thread::hardware_concurrency());
+    for (int producer_cnt = 1; producer_cnt <= max_thread; producer_cnt *= 2) {
+        // 多生产者单消费者(协议栈消息队列) 和 多生产者多消费者
+        for (int consumer_cnt : {1, producer_cnt}) {
+            {
+                tinytcp::LockFreeRingQueue<uint64_t> queue(queue_size);
+                print_result("mpmc  ", producer_cnt, consumer_cnt, run_bench(queue, producer_cnt, consumer_cnt, loop));
+            }
+            {
+                LegacyRingQueue<uint64_t> queue(queue_size);
+                print_result("legacy", producer_cnt, consumer_cnt, run_bench(queue, producer_cnt, consumer_cnt, loop));
+            }
+            if (producer_cnt == 1) {
+                // 单生产者单消费者(网卡队列)专用的实现, 交接没有CAS
+                tinytcp::SpscRingQueue<uint64_t> queue(queue_size);
+                print_result("spsc  ", producer_cnt, consumer_cnt, run_bench(queue, producer_cnt, consumer_cnt, loop));
+                break;
+            }
+        }
+    }
+    return 0;
+}
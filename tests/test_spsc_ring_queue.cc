@@ -0,0 +1,132 @@
+#include <gtest/gtest.h>
+
+#include <chrono>
+#include <memory>
+#include <thread>
+#include <vector>
+#include "src/spsc_ring_queue.h"
+
+
+using namespace tinytcp;
+
+
+class SpscRingQueueTest : public ::testing::Test {
+protected:
+    void SetUp() override {
+        m_queue_size = 64;
+        m_queue = std::make_unique<SpscRingQueue<int>>(m_queue_size);
+    }
+
+    std::unique_ptr<SpscRingQueue<int>> m_queue;
+    uint32_t m_queue_size;
+};
+
+TEST_F(SpscRingQueueTest, Initialization) {
+    EXPECT_EQ(m_queue->capacity(), m_queue_size);
+    EXPECT_EQ(m_queue->size(), 0U);
+    EXPECT_TRUE(m_queue->is_empty());
+}
+
+// 入队直到满, 再全部取出, 顺序不变
+TEST_F(SpscRingQueueTest, FillAndDrain) {
+    for (uint32_t i = 0; i < m_queue_size; ++i) {
+        EXPECT_TRUE(m_queue->push(static_cast<int>(i)));
+    }
+    EXPECT_TRUE(m_queue->is_full());
+    EXPECT_FALSE(m_queue->push(100));
+
+    int value_out = -1;
+    for (uint32_t i = 0; i < m_queue_size; ++i) {
+        EXPECT_TRUE(m_queue->pop(&value_out));
+        EXPECT_EQ(value_out, static_cast<int>(i));
+    }
+    EXPECT_FALSE(m_queue->pop(&value_out));
+}
+
+// 批量入队/出队, 空间不够时只放入能放下的部分, 绕回之后数据正确
+TEST_F(SpscRingQueueTest, Burst) {
+    std::vector<int> values_in(m_queue_size * 2);
+    for (size_t i = 0; i < values_in.size(); ++i) {
+        values_in[i] = static_cast<int>(i);
+    }
+    std::vector<int> values_out(m_queue_size * 2, -1);
+
+    EXPECT_EQ(m_queue->push_burst(values_in.data(), 40), 40U);
+    EXPECT_EQ(m_queue->pop_burst(values_out.data(), 30), 30U);
+    EXPECT_EQ(m_queue->push_burst(values_in.data() + 40, m_queue_size), m_queue_size - 10);
+    EXPECT_EQ(m_queue->push_burst(values_in.data(), 1), 0U);
+    EXPECT_EQ(m_queue->pop_burst(values_out.data() + 30, m_queue_size * 2), m_queue_size);
+    EXPECT_EQ(m_queue->pop_burst(values_out.data(), 1), 0U);
+    for (uint32_t i = 0; i < 30 + m_queue_size; ++i) {
+        EXPECT_EQ(values_out[i], static_cast<int>(i));
+    }
+}
+
+TEST_F(SpscRingQueueTest, PopTimeout) {
+    int value_out = 0;
+    auto begin = std::chrono::steady_clock::now();
+    EXPECT_FALSE(m_queue->pop(&value_out, 30));
+    auto cost = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - begin);
+    EXPECT_GE(cost.count(), 25);
+}
+
+// 一个生产者一个消费者, 消费者阻塞等待, 所有数据按顺序到达
+TEST_F(SpscRingQueueTest, ProducerConsumer) {
+    const int num_items = 100000;
+    std::thread consumer([&]() {
+        int expect = 0;
+        int values[16];
+        while (expect < num_items) {
+            uint32_t cnt = m_queue->pop_burst(values, 16, -1);
+            for (uint32_t i = 0; i < cnt; ++i) {
+                ASSERT_EQ(values[i], expect);
+                ++expect;
+            }
+        }
+    });
+    for (int i = 0; i < num_items; ++i) {
+        while (!m_queue->push(i)) {
+            std::this_thread::yield();
+        }
+    }
+    consumer.join();
+    EXPECT_TRUE(m_queue->is_empty());
+}
+
+// 两个队列来回传一个数, 双方都无限等待, 丢失一次唤醒就会卡住
+TEST_F(SpscRingQueueTest, PingPongWakeup) {
+    const int rounds = 20000;
+    SpscRingQueue<int> back(m_queue_size);
+    std::thread peer([&]() {
+        int value = 0;
+        for (int i = 0; i < rounds; ++i) {
+            ASSERT_TRUE(m_queue->pop(&value, -1));
+            ASSERT_TRUE(back.push(value + 1));
+        }
+    });
+    int value = 0;
+    for (int i = 0; i < rounds; ++i) {
+        ASSERT_TRUE(m_queue->push(value));
+        ASSERT_TRUE(back.pop(&value, -1));
+    }
+    peer.join();
+    EXPECT_EQ(value, rounds);
+}
+
+TEST(SpscRingQueueBoundaryTest, RoundUpSize) {
+    SpscRingQueue<int> queue(100);
+    EXPECT_EQ(queue.capacity(), 128U);
+    SpscRingQueue<int> one(1);
+    EXPECT_EQ(one.capacity(), 1U);
+    int value_out = 0;
+    EXPECT_TRUE(one.push(1));
+    EXPECT_FALSE(one.push(2));
+    EXPECT_TRUE(one.pop(&value_out));
+    EXPECT_EQ(value_out, 1);
+}
+
+
+int main(int argc, char** argv) {
+    ::testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
@@ -0,0 +1,351 @@
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <thread>
+#include <vector>
+#include "src/timer.h"
+
+
+using namespace tinytcp;
+
+// 时钟由测试控制的时间轮
+class FakeTimerManager : public TimerManager {
+public:
+    uint64_t now = 1000;
+
+    // 把时钟拨到now_ms, 执行这期间到期的回调, 返回执行的数量
+    size_t run_until(uint64_t now_ms) {
+        now = now_ms;
+        m_cbs.clear();
+        list_expired_cb(m_cbs);
+        for (auto& cb : m_cbs) {
+            if (cb) {
+                cb();
+            }
+        }
+        return m_cbs.size();
+    }
+
+protected:
+    uint64_t get_now_ms() const override { return now; }
+
+private:
+    std::vector<Timer::Callback> m_cbs;
+};
+
+// 属于创建它的线程, 其他线程的请求先放在队列里, 由所在的线程在推进时间轮之前执行
+class OwnedTimerManager : public FakeTimerManager {
+public:
+    std::atomic<bool> post_ok{true};   // false时模拟消息发不出去
+
+    size_t run_posted() {
+        std::vector<Timer::Callback> posted;
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            posted.swap(m_posted);
+        }
+        for (auto& cb : posted) {
+            cb();
+        }
+        return posted.size();
+    }
+
+protected:
+    bool in_owner_thread() const override { return std::this_thread::get_id() == m_owner; }
+    bool post(Timer::Callback cb) override {
+        if (!post_ok.load()) {
+            return false;
+        }
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_posted.push_back(std::move(cb));
+        return true;
+    }
+
+private:
+    std::thread::id m_owner = std::this_thread::get_id();
+    std::mutex m_mutex;
+    std::vector<Timer::Callback> m_posted;
+};
+
+TEST(TimerWheelTest, ExpireInOrder) {
+    FakeTimerManager manager;
+    std::vector<int> order;
+    manager.add_timer(5, [&order]() { order.push_back(5); });
+    manager.add_timer(1, [&order]() { order.push_back(1); });
+    manager.add_timer(3, [&order]() { order.push_back(3); });
+    EXPECT_EQ(manager.get_timer_cnt(), 3U);
+    EXPECT_EQ(manager.get_next_time(), 1U);
+
+    EXPECT_EQ(manager.run_until(1000), 0U);
+    EXPECT_EQ(manager.run_until(1001), 1U);
+    EXPECT_EQ(manager.get_next_time(), 2U);
+    EXPECT_EQ(manager.run_until(1004), 1U);
+    EXPECT_EQ(manager.run_until(1010), 1U);
+    EXPECT_EQ(order, (std::vector<int>{1, 3, 5}));
+    EXPECT_FALSE(manager.has_timer());
+    EXPECT_EQ(manager.get_next_time(), ~0ULL);
+}
+
+// 不同层的定时器都不会提前, 也不会晚于到期之后的第一次推进
+TEST(TimerWheelTest, CascadeExactExpire) {
+    FakeTimerManager manager;
+    std::mt19937_64 rng(12345);
+    const int cnt = 2000;
+    std::vector<uint64_t> expire(cnt);
+    std::vector<uint64_t> fired(cnt, 0);
+    for (int i = 0; i < cnt; ++i) {
+        // 覆盖所有层: 几毫秒到几十天
+        uint64_t ms = 1 + rng() % (1ULL << (6 * (i % 6 + 1)));
+        expire[i] = manager.now + ms;
+        manager.add_timer(ms, [i, &fired, &manager]() { fired[i] = manager.now; });
+    }
+
+    uint64_t prev = manager.now;
+    while (manager.has_timer()) {
+        // 有时按get_next_time走, 有时随机跳一大段
+        uint64_t step = manager.get_next_time();
+        ASSERT_NE(step, ~0ULL);
+        if (rng() % 4 == 0) {
+            step += rng() % 100000;
+        }
+        manager.run_until(manager.now + std::max<uint64_t>(step, 1));
+        for (int i = 0; i < cnt; ++i) {
+            if (fired[i] == manager.now) {
+                ASSERT_GE(manager.now, expire[i]) << "timer " << i << " fired early";
+                ASSERT_LT(prev, expire[i]) << "timer " << i << " fired late";
+            }
+        }
+        prev = manager.now;
+    }
+    for (int i = 0; i < cnt; ++i) {
+        EXPECT_NE(fired[i], 0U) << "timer " << i << " never fired";
+    }
+}
+
+// get_next_time不会晚于最早的到期时间
+TEST(TimerWheelTest, NextTimeIsLowerBound) {
+    FakeTimerManager manager;
+    int fired = 0;
+    manager.add_timer(100000, [&fired]() { ++fired; });
+    uint64_t wakeups = 0;
+    while (fired == 0) {
+        uint64_t next = manager.get_next_time();
+        ASSERT_LE(manager.now + next, 1000 + 100000U);
+        manager.run_until(manager.now + std::max<uint64_t>(next, 1));
+        ++wakeups;
+    }
+    EXPECT_EQ(manager.now, 1000 + 100000U);
+    // 只在高层转动时醒来, 不会每毫秒醒一次
+    EXPECT_LT(wakeups, 200U);
+}
+
+TEST(TimerWheelTest, CancelRefreshReset) {
+    FakeTimerManager manager;
+    int a = 0;
+    int b = 0;
+    int c = 0;
+    Timer::ptr ta = manager.add_timer(10, [&a]() { ++a; });
+    Timer::ptr tb = manager.add_timer(10, [&b]() { ++b; });
+    Timer::ptr tc = manager.add_timer(10, [&c]() { ++c; });
+
+    EXPECT_TRUE(ta->cancel());
+    EXPECT_FALSE(ta->cancel());
+    EXPECT_FALSE(ta->refresh());
+
+    // 刷新之后从现在开始重新计时
+    manager.run_until(1005);
+    EXPECT_TRUE(tb->refresh());
+    // 改成从创建时开始的3ms, 已经过了, 下一次推进就到期
+    EXPECT_TRUE(tc->reset(3, false));
+
+    manager.run_until(1006);
+    EXPECT_EQ(c, 1);
+    EXPECT_FALSE(tc->cancel());
+    manager.run_until(1014);
+    EXPECT_EQ(b, 0);
+    manager.run_until(1015);
+    EXPECT_EQ(a, 0);
+    EXPECT_EQ(b, 1);
+    EXPECT_FALSE(manager.has_timer());
+}
+
+TEST(TimerWheelTest, Recurring) {
+    FakeTimerManager manager;
+    int cnt = 0;
+    Timer::ptr timer;
+    timer = manager.add_timer(10, [&cnt, &timer]() {
+        // 回调里可以取消自己
+        if (++cnt == 3) {
+            EXPECT_TRUE(timer->cancel());
+        }
+    }, true);
+    for (uint64_t t = 1001; t <= 1100; ++t) {
+        manager.run_until(t);
+    }
+    EXPECT_EQ(cnt, 3);
+    EXPECT_FALSE(manager.has_timer());
+}
+
+TEST(TimerWheelTest, ConditionTimer) {
+    FakeTimerManager manager;
+    int cnt = 0;
+    auto alive = std::make_shared<int>(0);
+    auto dead = std::make_shared<int>(0);
+    manager.add_condition_timer(1, [&cnt]() { ++cnt; }, alive);
+    manager.add_condition_timer(1, [&cnt]() { cnt += 10; }, dead);
+    dead.reset();
+    manager.run_until(1001);
+    EXPECT_EQ(cnt, 1);
+}
+
+// 超过时间轮范围的定时器按真正的到期时间执行
+TEST(TimerWheelTest, BeyondRange) {
+    FakeTimerManager manager;
+    uint64_t ms = (1ULL << (TIMER_WHEEL_BITS * TIMER_WHEEL_LEVELS)) * 3 + 12345;
+    bool fired = false;
+    manager.add_timer(ms, [&fired]() { fired = true; });
+    while (!fired) {
+        uint64_t next = manager.get_next_time();
+        ASSERT_NE(next, ~0ULL);
+        manager.run_until(manager.now + std::max<uint64_t>(next, 1));
+        ASSERT_LE(manager.now, 1000 + ms);
+    }
+    EXPECT_EQ(manager.now, 1000 + ms);
+}
+
+// 调用者不保存Timer::ptr也会执行; 时间轮析构之后留下的Timer::ptr不再可用, 也不会泄漏
+TEST(TimerWheelTest, Ownership) {
+    Timer::ptr kept;
+    int fired = 0;
+    {
+        FakeTimerManager manager;
+        manager.add_timer(1, [&fired]() { ++fired; });
+        kept = manager.add_timer(100, [&fired]() { ++fired; });
+        EXPECT_EQ(kept.use_count(), 2);
+        manager.run_until(1001);
+        EXPECT_EQ(fired, 1);
+    }
+    EXPECT_EQ(kept.use_count(), 1);
+    EXPECT_FALSE(kept->cancel());
+    EXPECT_FALSE(kept->refresh());
+}
+
+// 其他线程添加、取消、刷新定时器, 都转到所在的线程执行
+TEST(TimerWheelTest, CrossThread) {
+    OwnedTimerManager manager;
+    int a = 0;
+    int b = 0;
+    int c = 0;
+    Timer::ptr ta;
+    Timer::ptr tb;
+    Timer::ptr tc;
+    std::thread other([&]() {
+        ta = manager.add_timer(10, [&a]() { ++a; });
+        tb = manager.add_timer(10, [&b]() { ++b; });
+        tc = manager.add_timer(10, [&c]() { ++c; });
+        ASSERT_NE(ta, nullptr);
+        // 还没挂到时间轮上就取消, 之后不再挂上去
+        EXPECT_TRUE(ta->cancel());
+        EXPECT_FALSE(ta->cancel());
+    });
+    other.join();
+    EXPECT_FALSE(manager.has_timer());
+    EXPECT_EQ(manager.run_posted(), 4U);
+    EXPECT_EQ(manager.get_timer_cnt(), 2U);
+
+    manager.run_until(1005);
+    std::thread other2([&]() {
+        // 已经挂上去的在其他线程取消, 摘下来的请求执行之前到期也不会执行
+        EXPECT_TRUE(tc->cancel());
+        EXPECT_FALSE(tc->refresh());
+    });
+    other2.join();
+    manager.run_until(1010);
+    EXPECT_EQ(a, 0);
+    EXPECT_EQ(b, 1);
+    EXPECT_EQ(c, 0);
+    EXPECT_EQ(manager.run_posted(), 1U);
+    EXPECT_FALSE(manager.has_timer());
+
+    // 刷新从所在的线程收到请求时开始计时
+    Timer::ptr td = manager.add_timer(10, [&b]() { ++b; });
+    manager.run_until(1015);
+    std::thread other3([&]() {
+        EXPECT_TRUE(td->refresh());
+    });
+    other3.join();
+    EXPECT_EQ(manager.run_posted(), 1U);
+    manager.run_until(1024);
+    EXPECT_EQ(b, 1);
+    manager.run_until(1025);
+    EXPECT_EQ(b, 2);
+    EXPECT_FALSE(manager.has_timer());
+}
+
+// 其他线程的请求发不出去: 添加返回nullptr, 刷新返回false, 取消照样生效, 所在的线程下一次推进时摘下来
+TEST(TimerWheelTest, CrossThreadPostFailed) {
+    OwnedTimerManager manager;
+    int fired = 0;
+    auto capture = std::make_shared<int>(0);
+    std::weak_ptr<int> weak_capture = capture;
+    Timer::ptr timer = manager.add_timer(100, [&fired, capture]() { ++fired; });
+    capture.reset();
+    manager.post_ok = false;
+
+    std::thread other([&]() {
+        EXPECT_EQ(manager.add_timer(10, [&fired]() { ++fired; }), nullptr);
+        EXPECT_FALSE(timer->refresh());
+        EXPECT_TRUE(timer->cancel());
+        EXPECT_FALSE(timer->cancel());
+    });
+    other.join();
+    EXPECT_EQ(manager.run_posted(), 0U);
+    EXPECT_EQ(manager.get_timer_cnt(), 1U);
+    EXPECT_FALSE(weak_capture.expired());
+
+    // 远没到期, 下一次推进就摘下来并释放回调
+    EXPECT_EQ(manager.run_until(1001), 0U);
+    EXPECT_FALSE(manager.has_timer());
+    EXPECT_TRUE(weak_capture.expired());
+    EXPECT_EQ(manager.run_until(1200), 0U);
+    EXPECT_EQ(fired, 0);
+}
+
+// 大量连接的定时器不断重新设置, 每次都是O(1)
+TEST(TimerWheelTest, ManyTimersRearm) {
+    FakeTimerManager manager;
+    const int cnt = 100000;
+    std::vector<Timer::ptr> timers;
+    timers.reserve(cnt);
+    uint64_t fired = 0;
+    for (int i = 0; i < cnt; ++i) {
+        timers.push_back(manager.add_timer(200 + i % 1000, [&fired]() { ++fired; }));
+    }
+
+    auto begin = std::chrono::steady_clock::now();
+    const int rounds = 10;
+    for (int r = 0; r < rounds; ++r) {
+        manager.run_until(manager.now + 100);
+        for (auto& timer : timers) {
+            ASSERT_TRUE(timer->refresh());
+        }
+    }
+    double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - begin).count();
+    std::cout << "refresh " << cnt * rounds << " timers, ns/op=" << ns / (cnt * rounds) << std::endl;
+    EXPECT_EQ(fired, 0U);
+    EXPECT_EQ(manager.get_timer_cnt(), (size_t)cnt);
+
+    manager.run_until(manager.now + 2000);
+    EXPECT_EQ(fired, (uint64_t)cnt);
+}
+
+
+int main(int argc, char** argv) {
+    ::testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}